@@ -0,0 +1,103 @@
+/*
+    hexbench - a microbenchmark for szap's hexDump()
+
+    It formats the same buffer with the printf() per byte hexDump that szap
+    used to have (hexDumpPrintf, below) and with the current table driven one,
+    and reports MB/s of input formatted for each.  The formatted text goes to
+    /dev/null so only the formatting (and the stdio/write calls) is timed.
+
+    Build and run it with 'make bench', or by hand:
+        gcc -O2 -pthread -o hexbench hexbench.c libszap.c -lz && ./hexbench [megabytes]
+    Results go to stderr, one line per run.
+*/
+
+#define main szap_main      /*  szap.c is pulled in whole; keep its main() out of the way  */
+#include "szap.c"
+#undef main
+
+#include <time.h>
+
+/*  the original hexDump, kept here only as the "before" number  */
+void hexDumpPrintf(char *desc, void *addr, int len, uint skip) {
+    int i;
+    unsigned char buff[17];
+    unsigned char *pc = (unsigned char*)addr;
+
+    if (desc != NULL)
+        printf ("%s\n", desc);
+    for (i = 0; i < len; i++) {
+        if ((i % 16) == 0) {
+            if (i != 0)
+                printf ("  %s\n", buff);
+            printf ("  %04x ", skip+i);
+        }
+        printf (" %02x", pc[i]);
+        if ((pc[i] < 0x20) || (pc[i] > 0x7e))
+            buff[i % 16] = '.';
+        else
+            buff[i % 16] = pc[i];
+        buff[(i % 16) + 1] = '\0';
+    }
+    while ((i % 16) != 0) {
+        printf ("   ");
+        i++;
+    }
+    printf ("  %s\n", buff);
+}
+
+static double now(void) {
+struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(char *what, size_t bytes, double secs) {
+    fprintf(stderr, "%-32s %8.1f MB/s  (%zu bytes in %.3f s)\n",
+            what, bytes / secs / (1024.0 * 1024.0), bytes, secs);
+}
+
+int main(int argc, char *argv[]) {
+size_t mb = 64;
+size_t len, i;
+unsigned char *buf;
+double t;
+
+    if (argc > 1) mb = strtoul(argv[1], NULL, 0);
+    if (mb == 0) mb = 64;
+    len = mb * 1024 * 1024;
+    if ((buf = malloc(len)) == NULL) {
+        perror("malloc");
+        return 4;
+    }
+    srand(1);
+    for (i = 0; i < len; i++) buf[i] = rand();
+
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        perror("freopen /dev/null");
+        return 4;
+    }
+
+    /*  the old formatter is slow; give it a slice and scale  */
+    t = now();
+    hexDumpPrintf("bench", buf, len / 8, 0);
+    fflush(stdout);
+    report("hexDump (printf, before)", len / 8, now() - t);
+
+    t = now();
+    hexDump("bench", buf, len, 0);
+    hexDumpEnd();
+    fflush(stdout);
+    report("hexDump (tables, after)", len, now() - t);
+
+    /*  a mostly zeroed image, as --squeeze sees it  */
+    memset(buf + len / 16, 0, len - len / 16);
+    squeeze = 1;
+    t = now();
+    hexDump("bench", buf, len, 0);
+    hexDumpEnd();
+    fflush(stdout);
+    report("hexDump --squeeze (94% zeros)", len, now() - t);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,1027 @@
+/*
+MIT License
+
+Copyright (c) 2025 tom lovell
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+    libszap - szap's cards as functions (see szap.h)
+
+    The hex decoding, offset parsing and dump line formatting here are the
+    ones szap itself uses; szap.c is built with this file.  The 'name',
+    'ver', 'rep', 'dump' and 'reset' cards are here too, on a context rather
+    than globals, so a program can zap without starting szap or parsing
+    its output.  The rest of szap (--plan, --uring, --journal, 'find',
+    'sum', 'diff', 'undo', 'extract', 'inject', 'alias', 'zero', 'fill',
+    'copy') is still only in the command line program: szap_card()
+    returns SZAP_EVERB for those.
+    A library dump is always a plain one: no --squeeze, and holes are read.
+    The partition tables behind 'p2+400' offsets are parsed here, for both.
+*/
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#include  <sys/types.h>
+#include  <unistd.h>
+#include  <stdlib.h>
+#include  <stdio.h>
+#include  <stdarg.h>
+#include  <string.h>
+#include  <strings.h>   /*  for strcasecmp  */
+#include  <ctype.h>     /*  for tolower  */
+#include  <stdint.h>
+#include  <inttypes.h>  /*  for PRIx64  */
+#include  <errno.h>
+#include  <fcntl.h>     /*  for open/close  */
+#include  <sys/stat.h>  /*  for fstat  */
+#include  <pthread.h>   /*  for pthread_once and the file locks  */
+
+#include  "szap.h"
+
+#define SZAP_OBUF  (16 * 1024)   /* bytes of text held before the output function gets them */
+#define SZAP_IOBUF (64 * 1024)   /* bytes read at a time by 'ver' and 'dump' (a multiple of 16) */
+#define SZAP_DUMPLEN 512         /* a 'dump' card with no length; szap's LENTODUMP */
+
+typedef struct {
+    char  *fn;
+    int   fd;
+    int   rw;
+    dev_t dev, rdev;
+    ino_t ino;
+    pthread_rwlock_t lock;      /* 'ver' and 'dump' share it; a 'rep' (or a reopen) has it alone */
+    szap_layout *layout;        /* its partitions, once an offset has named one (under the table's mu) */
+} szap_file;
+
+/*  the open files, which any number of contexts may share  */
+struct szap_files {
+    pthread_mutex_t mu;         /* over the table, not the files in it */
+    szap_file       **f;        /* (pointers, so a file stays put when the table grows) */
+    int             n;
+    int             refs;
+};
+
+struct szap_ctx {
+    szap_files  *fs;
+    szap_file   *cur;           /* the current file ('name' or 'dump'), or NULL */
+    int         debug;
+    int         ok_to_write;
+    int         err;            /* errno of the last SZAP_EOPEN or SZAP_EIO */
+    szap_out_fn out;
+    void        *outarg;
+    size_t      olen;
+    char        obuf[SZAP_OBUF];
+    unsigned char io[SZAP_IOBUF];
+};
+
+/*  ---------------------------------------------------------  */
+/*  ---------------------------------------------------------  */
+/*  lookup tables, built once by whichever thread gets first   */
+/*  ---------------------------------------------------------  */
+/*  ---------------------------------------------------------  */
+static pthread_once_t szap_once = PTHREAD_ONCE_INIT;
+static signed char    hexval[256];    /* 0-15, or -1 for "not a hex digit"                */
+static unsigned int   hex3[256];      /* " xx" for every byte value (4th byte is slack)   */
+static char           hexascii[256];  /* the byte itself if printable, else '.'           */
+
+static void szap_tables(void) {
+static const char digits[] = "0123456789abcdef";
+int c;
+    memset(hexval, -1, sizeof(hexval));
+    for (c = 0; c < 10; c++) hexval['0' + c] = c;
+    for (c = 0; c < 6; c++) hexval['a' + c] = hexval['A' + c] = 10 + c;
+    for (c = 0; c < 256; c++) {
+        ((char *) &hex3[c])[0] = ' ';
+        ((char *) &hex3[c])[1] = digits[c >> 4];
+        ((char *) &hex3[c])[2] = digits[c & 0x0f];
+        ((char *) &hex3[c])[3] = ' ';
+        hexascii[c] = ((c < 0x20) || (c > 0x7e)) ? '.' : c;
+    }
+}
+
+const char *szap_strerror(int err) {
+    switch (err) {
+        case SZAP_OK:       return "no error";
+        case SZAP_EINVAL:   return "an offset or data field is missing or not hex";
+        case SZAP_ENOFILE:  return "no file has been named";
+        case SZAP_EOPEN:    return "the file could not be opened";
+        case SZAP_EIO:      return "a read or write failed";
+        case SZAP_EVERIFY:  return "'data' discompares; no writes will be performed";
+        case SZAP_EDRYRUN:  return "write will NOT be done";
+        case SZAP_ENOSPACE: return "the buffer is too small";
+        case SZAP_ENOMEM:   return "out of memory";
+        case SZAP_EVERB:    return "the card is not one the library runs";
+        case SZAP_ENOPART:  return "the file has no such partition";
+        case SZAP_EPASTEND: return "the offset is past the end of the partition";
+    }
+    return "unknown error";
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  the fields of a card: hex offsets and lengths, and hex 'data'    */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+int szap_parse_offset(const char *s, uint64_t *v) {
+char *end;
+uint64_t ui;
+    if (s[0] == '-' || s[0] == '+') return SZAP_EINVAL;  /* strtoull would take these */
+    errno = 0;
+    ui = strtoull(s, &end, 16);
+    if (end == s || *end != '\0' || errno == ERANGE) return SZAP_EINVAL;
+    *v = ui;
+    return SZAP_OK;
+}
+
+/*  Decodes 2*n hex characters at 'src' into n bytes at 'dest', and      */
+/*  returns -1, or the position of the first character that is not hex.  */
+/*  32 characters at a time are classified and converted with SSE2 when  */
+/*  the compiler targets it (every x86-64 does); the rest, and any block  */
+/*  holding a bad character, go through a 256 entry table.  'dest' may    */
+/*  be 'src' itself: no byte is written before the characters it          */
+/*  overwrites have been read.                                            */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+long szap_hexdecode(unsigned char *dest, const char *src, size_t n) {
+const unsigned char *s = (const unsigned char *) src;
+size_t i = 0;
+int    hi, lo;
+    pthread_once(&szap_once, szap_tables);
+#ifdef __SSE2__
+    {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i a    = _mm_set1_epi8('a');
+    const __m128i lc   = _mm_set1_epi8(0x20);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten  = _mm_set1_epi8(10);
+    const __m128i low  = _mm_set1_epi16(0x00ff);
+    __m128i v[2], d, l, isd, isl, w[2];
+    int k;
+    for (; i + 16 <= n; i += 16) {
+        for (k = 0; k < 2; k++) {
+            v[k] = _mm_loadu_si128((const __m128i *) (s + 2 * i + 16 * k));
+            d    = _mm_sub_epi8(v[k], zero);                    /* '0'-'9' -> 0-9           */
+            l    = _mm_sub_epi8(_mm_or_si128(v[k], lc), a);     /* 'a'-'f', 'A'-'F' -> 0-5  */
+            isd  = _mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine); /* unsigned d <= 9          */
+            isl  = _mm_cmpeq_epi8(_mm_max_epu8(l, five), five); /* unsigned l <= 5          */
+            if (_mm_movemask_epi8(_mm_or_si128(isd, isl)) != 0xffff) break;
+            v[k] = _mm_or_si128(_mm_and_si128(isd, d), _mm_and_si128(isl, _mm_add_epi8(l, ten)));
+            /*  each 16 bit lane is (low nibble << 8) | high nibble; fold it to one byte  */
+            w[k] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v[k], low), 4), _mm_srli_epi16(v[k], 8));
+        }
+        if (k < 2) break;  /* a bad character somewhere in here; let the table find it */
+        _mm_storeu_si128((__m128i *) (dest + i), _mm_packus_epi16(w[0], w[1]));
+    }
+    }
+#endif
+    for (; i < n; i++) {
+        hi = hexval[s[2 * i]];
+        lo = hexval[s[2 * i + 1]];
+        if (hi < 0) return 2 * i;
+        if (lo < 0) return 2 * i + 1;
+        dest[i] = (hi << 4) | lo;
+    }
+    return -1;
+}
+
+/*  'data' (pairs of hex digits, 0x or 0X in front allowed) into 'buf';  */
+/*  *len is the byte count, even when it is more than 'cap' and          */
+/*  SZAP_ENOSPACE comes back.  'buf' may be 'hex' itself.                */
+int szap_parse_data(const char *hex, void *buf, size_t cap, size_t *len) {
+size_t srclen = strlen(hex);
+    if (memcmp(hex, "0x", 2) == 0 || memcmp(hex, "0X", 2) == 0) {
+        hex += 2;
+        srclen -= 2;
+    }
+    if ((srclen % 2) == 1 || srclen == 0) return SZAP_EINVAL;
+    *len = srclen / 2;
+    if (*len > cap) return SZAP_ENOSPACE;
+    if (szap_hexdecode(buf, hex, *len) >= 0) return SZAP_EINVAL;
+    return SZAP_OK;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  dump lines: "  oooo  xx xx ... xx  aaaaaaaaaaaaaaaa"             */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  the "  oooo " offset, at least 4 hex digits, as "%04x" would have it  */
+size_t szap_hexoffset(char *out, uint64_t off) {
+static const char digits[] = "0123456789abcdef";
+char *o = out;
+int  n = 4;
+    while (n < 16 && (off >> (4 * n)) != 0) n++;
+    *o++ = ' ';
+    *o++ = ' ';
+    while (n--) *o++ = digits[(off >> (4 * n)) & 0x0f];
+    *o++ = ' ';
+    return o - out;
+}
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+/*  48 characters of " xx" for one full 16 byte line  */
+static char *hexLine16(char *o, const unsigned char *pc) {
+const __m128i lut  = _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+const __m128i mask = _mm_set1_epi8(0x0f);
+const __m128i sp   = _mm_set1_epi8(' ');   /* every hex digit already has the 0x20 bit set */
+const __m128i s1   = _mm_setr_epi8(-1, 0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1);
+const __m128i s2   = _mm_setr_epi8(10, 11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+__m128i v, hi, lo, a, b;
+    v  = _mm_loadu_si128((const __m128i *) pc);
+    hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+    a  = _mm_unpacklo_epi8(hi, lo);  /* digit pairs for bytes 0-7  */
+    b  = _mm_unpackhi_epi8(hi, lo);  /* digit pairs for bytes 8-15 */
+    _mm_storeu_si128((__m128i *) (o +  0), _mm_or_si128(_mm_shuffle_epi8(a, s1), sp));
+    _mm_storel_epi64((__m128i *) (o + 16), _mm_or_si128(_mm_shuffle_epi8(a, s2), sp));
+    _mm_storeu_si128((__m128i *) (o + 24), _mm_or_si128(_mm_shuffle_epi8(b, s1), sp));
+    _mm_storel_epi64((__m128i *) (o + 40), _mm_or_si128(_mm_shuffle_epi8(b, s2), sp));
+    return o + 48;
+}
+#else
+static char *hexLine16(char *o, const unsigned char *pc) {
+int i;
+    for (i = 0; i < 16; i++, o += 3) memcpy(o, &hex3[pc[i]], 4);
+    return o;
+}
+#endif
+
+/*  one line for up to 16 bytes at 'data' (offset 'off'), '\n' and all; returns its length  */
+size_t szap_hexline(char *out, uint64_t off, const void *data, size_t n) {
+const unsigned char *pc = data;
+char   *o;
+size_t j;
+    pthread_once(&szap_once, szap_tables);
+    if (n > 16) n = 16;
+    o = out + szap_hexoffset(out, off);
+
+    // Now the hex code for the line, padded out if it is short.
+    if (n == 16) o = hexLine16(o, pc);
+    else {
+        memset(o, ' ', 48);
+        for (j = 0; j < n; j++) memcpy(o + 3 * j, &hex3[pc[j]], 3);
+        o += 48;
+    }
+
+    // And the printable ASCII bit.
+    *o++ = ' ';
+    *o++ = ' ';
+    for (j = 0; j < n; j++) *o++ = hexascii[pc[j]];
+    *o++ = '\n';
+    return o - out;
+}
+
+/*  Every line for 'len' bytes into 'out'.  Only whole lines are put in;  */
+/*  the return is the length all of them need (more than 'cap' if they    */
+/*  didn't fit, as with snprintf), and nothing is NUL terminated.         */
+size_t szap_hexdump(char *out, size_t cap, const void *data, size_t len, uint64_t off) {
+const unsigned char *pc = data;
+char   line[SZAP_LINEMAX];
+size_t i, n, l, need = 0;
+    for (i = 0; i < len; i += 16) {
+        n = (len - i < 16) ? len - i : 16;
+        if (need + SZAP_LINEMAX <= cap) need += szap_hexline(out + need, off + i, pc + i, n);
+        else {
+            l = szap_hexline(line, off + i, pc + i, n);
+            if (need + l <= cap) memcpy(out + need, line, l);
+            need += l;
+            if (need > cap) cap = 0;  /* no later line goes in after one that didn't */
+        }
+    }
+    return need;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  contexts, and what they print                                    */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+static void szap_stdout(void *arg, const char *text, size_t len) {
+    (void) arg;
+    fwrite(text, 1, len, stdout);
+}
+
+static void zflush(szap_ctx *z) {
+    if (z->olen && z->out != NULL) z->out(z->outarg, z->obuf, z->olen);
+    z->olen = 0;
+}
+
+static void zprintf(szap_ctx *z, const char *fmt, ...) {
+va_list ap;
+int     n;
+    if (z->out == NULL) return;
+    va_start(ap, fmt);
+    n = vsnprintf(z->obuf + z->olen, SZAP_OBUF - z->olen, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && (size_t) n >= SZAP_OBUF - z->olen && z->olen) {
+        zflush(z);  /* it didn't fit behind what was there; try again on its own */
+        va_start(ap, fmt);
+        n = vsnprintf(z->obuf, SZAP_OBUF, fmt, ap);
+        va_end(ap);
+    }
+    if (n < 0) return;
+    z->olen += ((size_t) n < SZAP_OBUF - z->olen) ? (size_t) n : SZAP_OBUF - 1 - z->olen;
+}
+
+/*  lines for 'len' bytes, formatted straight into the output buffer  */
+static void zlines(szap_ctx *z, const unsigned char *pc, size_t len, uint64_t off) {
+size_t i;
+    if (z->out == NULL) return;
+    for (i = 0; i < len; i += 16) {
+        if (z->olen + SZAP_LINEMAX > SZAP_OBUF) zflush(z);
+        z->olen += szap_hexline(z->obuf + z->olen, off + i, pc + i, (len - i < 16) ? len - i : 16);
+    }
+}
+
+szap_files *szap_files_new(void) {
+szap_files *fs;
+    if ((fs = calloc(1, sizeof(*fs))) == NULL) return NULL;
+    pthread_mutex_init(&fs->mu, NULL);
+    fs->refs = 1;
+    return fs;
+}
+
+/*  drops one reference; the last one closes every file  */
+void szap_files_free(szap_files *fs) {
+int i, refs;
+    if (fs == NULL) return;
+    pthread_mutex_lock(&fs->mu);
+    refs = --fs->refs;
+    pthread_mutex_unlock(&fs->mu);
+    if (refs > 0) return;
+    for (i = 0; i < fs->n; i++) {
+        close(fs->f[i]->fd);
+        pthread_rwlock_destroy(&fs->f[i]->lock);
+        szap_layout_free(fs->f[i]->layout);
+        free(fs->f[i]->fn);
+        free(fs->f[i]);
+    }
+    pthread_mutex_destroy(&fs->mu);
+    free(fs->f);
+    free(fs);
+}
+
+szap_ctx *szap_new_shared(szap_files *fs) {
+szap_ctx *z;
+    if ((z = calloc(1, sizeof(*z))) == NULL) return NULL;
+    if (fs == NULL) fs = szap_files_new();
+    else {
+        pthread_mutex_lock(&fs->mu);
+        fs->refs++;
+        pthread_mutex_unlock(&fs->mu);
+    }
+    if ((z->fs = fs) == NULL) {
+        free(z);
+        return NULL;
+    }
+    z->ok_to_write = 1;
+    z->out = szap_stdout;
+    return z;
+}
+
+szap_ctx *szap_new(void) {
+    return szap_new_shared(NULL);
+}
+
+void szap_free(szap_ctx *z) {
+    if (z == NULL) return;
+    zflush(z);
+    szap_files_free(z->fs);
+    free(z);
+}
+
+void szap_set_output(szap_ctx *z, szap_out_fn fn, void *arg) {
+    zflush(z);
+    z->out = fn;
+    z->outarg = arg;
+}
+
+void szap_set_debug(szap_ctx *z, int on)   { z->debug = on; }
+void szap_set_dryrun(szap_ctx *z, int on)  { z->ok_to_write = !on; }
+int  szap_ok_to_write(const szap_ctx *z)   { return z->ok_to_write; }
+void szap_reset(szap_ctx *z)               { z->ok_to_write = 1; }
+int  szap_errno(const szap_ctx *z)         { return z->err; }
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  the open files: opened once, found again by path or inode        */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  As in szap, a file first opened read only (by 'dump') is opened    */
+/*  again read/write when 'name' wants it, with dup2 onto the same fd, */
+/*  so the contexts already using it carry on.  A device is one file   */
+/*  under any of its paths, so its writes are serialized by one lock.  */
+static int zopen(szap_ctx *z, const char *fn, int rw, szap_file **fp) {
+szap_files  *fs = z->fs;
+szap_file   *f = NULL, **nf;
+struct stat st;
+int         i, fd, havest, rc = SZAP_OK;
+
+    havest = (stat(fn, &st) == 0);
+    pthread_mutex_lock(&fs->mu);
+    for (i = 0; i < fs->n; i++) {
+        f = fs->f[i];
+        if (strcmp(f->fn, fn) == 0) break;
+        if (!havest) continue;
+        if (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) {
+            if (f->rdev == st.st_rdev && f->rdev != 0) break;
+        } else if (f->dev == st.st_dev && f->ino == st.st_ino) break;
+    }
+    if (i < fs->n && (f->rw || !rw)) goto done;
+
+    if ((fd = open(fn, (rw ? O_RDWR : O_RDONLY) | O_LARGEFILE | O_CLOEXEC)) == -1) {
+        z->err = errno;
+        rc = SZAP_EOPEN;
+        goto done;
+    }
+    if (i < fs->n) {
+        if(z->debug) zprintf(z, "(debug) reopening %s read/write\n", f->fn);
+        pthread_rwlock_wrlock(&f->lock);
+        dup2(fd, f->fd);  /* the r/w open takes over the old number */
+        f->rw = 1;
+        pthread_rwlock_unlock(&f->lock);
+        close(fd);
+        goto done;
+    }
+    f = NULL;  /* (the loop left it on a file in the table) */
+    if ((nf = realloc(fs->f, (fs->n + 1) * sizeof(*nf))) == NULL
+        || (fs->f = nf, f = calloc(1, sizeof(*f))) == NULL
+        || (f->fn = strdup(fn)) == NULL) {
+        free(f);
+        close(fd);
+        rc = SZAP_ENOMEM;
+        goto done;
+    }
+    if (!havest) fstat(fd, &st);
+    f->fd = fd;
+    f->rw = rw;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->rdev = (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) ? st.st_rdev : 0;
+    pthread_rwlock_init(&f->lock, NULL);
+    fs->f[fs->n++] = f;
+done:
+    pthread_mutex_unlock(&fs->mu);
+    if (rc == SZAP_OK) *fp = f;
+    return rc;
+}
+
+int szap_name(szap_ctx *z, const char *path) {
+szap_file *f;
+int       rc;
+    if ((rc = zopen(z, path, 1, &f)) != SZAP_OK) return rc;
+    z->cur = f;
+    if(z->debug) zprintf(z, "(debug) <fn>, %s, is fd %i\n", f->fn, f->fd);
+    return SZAP_OK;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  ver, rep and dump on the current file                            */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+static void zforget(szap_ctx *z, uint64_t off, uint64_t len);
+
+/*  up to 'len' bytes at 'off'; fewer only at the end of the file  */
+static ssize_t zread(szap_ctx *z, uint64_t off, void *buf, size_t len) {
+size_t  done = 0;
+ssize_t n;
+    while (done < len) {
+        n = pread64(z->cur->fd, (char *) buf + done, len - done, off + done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            z->err = errno;
+            return SZAP_EIO;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+ssize_t szap_read(szap_ctx *z, uint64_t off, void *buf, size_t len) {
+ssize_t got;
+    if (z->cur == NULL) return SZAP_ENOFILE;
+    pthread_rwlock_rdlock(&z->cur->lock);
+    got = zread(z, off, buf, len);
+    pthread_rwlock_unlock(&z->cur->lock);
+    return got;
+}
+
+/*  compared a buffer at a time, so 'len' can be anything; no 'rep' gets in part way  */
+int szap_ver(szap_ctx *z, uint64_t off, const void *data, size_t len) {
+size_t  done, n;
+ssize_t got;
+int     rc = SZAP_OK;
+    if (z->cur == NULL) return SZAP_ENOFILE;
+    pthread_rwlock_rdlock(&z->cur->lock);
+    for (done = 0; done < len; done += n) {
+        n = (len - done < SZAP_IOBUF) ? len - done : SZAP_IOBUF;
+        if ((got = zread(z, off + done, z->io, n)) < 0) {
+            rc = got;
+            break;
+        }
+        if ((size_t) got != n || memcmp(z->io, (const char *) data + done, n) != 0) {
+            z->ok_to_write = 0;
+            rc = SZAP_EVERIFY;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&z->cur->lock);
+    return rc;
+}
+
+int szap_rep(szap_ctx *z, uint64_t off, const void *data, size_t len) {
+size_t  done = 0;
+ssize_t n;
+int     rc = SZAP_OK;
+    if (z->cur == NULL) return SZAP_ENOFILE;
+    if (!z->ok_to_write) return SZAP_EDRYRUN;
+    pthread_rwlock_wrlock(&z->cur->lock);
+    while (done < len) {
+        n = pwrite64(z->cur->fd, (const char *) data + done, len - done, off + done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            z->err = (n == -1) ? errno : EIO;
+            z->ok_to_write = 0;  /* as in szap: no further writes */
+            rc = SZAP_EIO;
+            break;
+        }
+        done += n;
+    }
+    pthread_rwlock_unlock(&z->cur->lock);
+    if (done) zforget(z, off, done);  /* (after the file lock: zopen takes the table's first) */
+    return rc;
+}
+
+/*  'len' bytes of the current file at 'off', under 'desc'  */
+static int zdump(szap_ctx *z, const char *desc, uint64_t len, uint64_t off) {
+struct stat st;
+uint64_t    done;
+size_t      n;
+ssize_t     got = 0;
+    if (fstat(z->cur->fd, &st) == 0 && S_ISREG(st.st_mode) && len && off >= (uint64_t) st.st_size) {
+        zprintf(z, "%s\n  (offset %" PRIx64 " is at or beyond the end of the file; nothing to dump)\n", desc, off);
+        zflush(z);
+        return SZAP_OK;
+    }
+    zprintf(z, "%s\n", desc);
+    for (done = 0; done < len; done += got) {
+        n = (len - done < SZAP_IOBUF) ? len - done : SZAP_IOBUF;
+        if ((got = szap_read(z, off + done, z->io, n)) <= 0) break;  /* (a 'rep' can go between reads) */
+        zlines(z, z->io, got, off + done);
+        if ((size_t) got < n) break;
+    }
+    zflush(z);
+    return got < 0 ? (int) got : SZAP_OK;
+}
+
+/*  'path' (opened read only if it is new) becomes the current file; NULL dumps the current one  */
+int szap_dump(szap_ctx *z, const char *path, uint64_t len, uint64_t off) {
+szap_file *f;
+int       rc;
+    if (path != NULL) {
+        if ((rc = zopen(z, path, 0, &f)) != SZAP_OK) return rc;
+        z->cur = f;
+    }
+    if (z->cur == NULL) return SZAP_ENOFILE;
+    return zdump(z, "dump", len, off);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  partitions: offsets like 'p2+400' and 'gpt:esp+10'               */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The MBR (and the chain of EBRs behind an extended partition, as    */
+/*  p5 on) or the GPT is read once into a szap_layout; after that an   */
+/*  offset costs a look through a few entries and no I/O.  The layout  */
+/*  remembers which bytes it was read from, so a write over the table  */
+/*  can drop it and the next offset reads the new one.  CRCs aren't    */
+/*  checked: a zapped GPT is still the one the card means.             */
+#define SZAP_MAXEBR   128        /* logical partitions followed, at most (a loop ends there) */
+#define SZAP_MAXGPT   (4 << 20)  /* bytes of GPT entries read, at most */
+
+typedef struct {
+    unsigned      num;          /* the N of pN */
+    uint64_t      start, len;   /* in bytes */
+    unsigned char type;         /* the MBR type (0 in a GPT) */
+    unsigned char guid[16];     /* the GPT type */
+    char          name[37];     /* the GPT name (ASCII; anything else is '?') */
+} szap_part;
+
+struct szap_layout {
+    const char *scheme;         /* "MBR", "GPT" or "no partition table" */
+    unsigned   secsize;
+    szap_part  *part;
+    size_t     npart;
+    struct { uint64_t off, len; } from[SZAP_MAXEBR + 4];  /* what was read to find them */
+    size_t     nfrom;
+};
+
+/*  GPT type GUIDs by the names people call them, as they are on disk (the first three fields little endian)  */
+static const struct { const char *alias; unsigned char guid[16]; } gpttypes[] = {
+    { "esp",    { 0x28,0x73,0x2a,0xc1, 0x1f,0xf8, 0xd2,0x11, 0xba,0x4b, 0x00,0xa0,0xc9,0x3e,0xc9,0x3b } },
+    { "efi",    { 0x28,0x73,0x2a,0xc1, 0x1f,0xf8, 0xd2,0x11, 0xba,0x4b, 0x00,0xa0,0xc9,0x3e,0xc9,0x3b } },
+    { "bios",   { 0x48,0x61,0x68,0x21, 0x49,0x64, 0x6f,0x6e, 0x74,0x4e, 0x65,0x65,0x64,0x45,0x46,0x49 } },
+    { "linux",  { 0xaf,0x3d,0xc6,0x0f, 0x83,0x84, 0x72,0x47, 0x8e,0x79, 0x3d,0x69,0xd8,0x47,0x7d,0xe4 } },
+    { "swap",   { 0x6d,0xfd,0x57,0x06, 0xab,0xa4, 0xc4,0x43, 0x84,0xe5, 0x09,0x33,0xc8,0x4b,0x4f,0x4f } },
+    { "msdata", { 0xa2,0xa0,0xd0,0xeb, 0xe5,0xb9, 0x33,0x44, 0x87,0xc0, 0x68,0xb6,0xb7,0x26,0x99,0xc7 } },
+};
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p) {
+    return le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+static int zlayout_add(szap_layout *l, unsigned num, uint64_t start, uint64_t len) {
+szap_part *np;
+    if ((l->npart & 15) == 0) {
+        if ((np = realloc(l->part, (l->npart + 16) * sizeof(*np))) == NULL) return SZAP_ENOMEM;
+        l->part = np;
+    }
+    memset(&l->part[l->npart], 0, sizeof(*np));
+    l->part[l->npart].num = num;
+    l->part[l->npart].start = start;
+    l->part[l->npart].len = len;
+    l->npart++;
+    return SZAP_OK;
+}
+
+/*  exactly 'len' bytes at 'off', noted as something the layout depends on  */
+static int zlayout_get(szap_layout *l, szap_pread_fn rd, void *arg, void *buf, size_t len, uint64_t off) {
+ssize_t got;
+    if (l->nfrom < sizeof(l->from) / sizeof(l->from[0])) {
+        l->from[l->nfrom].off = off;
+        l->from[l->nfrom++].len = len;
+    }
+    if ((got = rd(arg, buf, len, off)) < 0) return SZAP_EIO;
+    return (size_t) got == len ? SZAP_OK : SZAP_ENOPART;
+}
+
+static int zlayout_gpt(szap_layout *l, szap_pread_fn rd, void *arg, const unsigned char *hdr) {
+unsigned char *ents, *e;
+uint64_t      lba, first, last;
+uint32_t      n, esz, i, c;
+int           rc;
+    lba = le64(hdr + 72);
+    n = le32(hdr + 80);
+    esz = le32(hdr + 84);
+    if (esz < 128 || (uint64_t) n * esz > SZAP_MAXGPT) return SZAP_ENOPART;
+    if ((ents = malloc((size_t) n * esz + 1)) == NULL) return SZAP_ENOMEM;
+    if ((rc = zlayout_get(l, rd, arg, ents, (size_t) n * esz, lba * l->secsize)) == SZAP_OK) {
+        for (i = 0; i < n; i++) {
+            e = ents + (size_t) i * esz;
+            first = le64(e + 32);
+            last = le64(e + 40);
+            if (last < first || memcmp(e, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16) == 0) continue;
+            if ((rc = zlayout_add(l, i + 1, first * l->secsize, (last - first + 1) * l->secsize)) != SZAP_OK) break;
+            memcpy(l->part[l->npart - 1].guid, e, 16);
+            for (c = 0; c < 36 && (e[56 + 2 * c] || e[57 + 2 * c]); c++)
+                l->part[l->npart - 1].name[c] = (e[57 + 2 * c] || e[56 + 2 * c] < 0x20 || e[56 + 2 * c] > 0x7e) ? '?' : e[56 + 2 * c];
+        }
+    }
+    free(ents);
+    return rc;
+}
+
+static int zlayout_mbr(szap_layout *l, szap_pread_fn rd, void *arg, const unsigned char *mbr) {
+unsigned char ebr[512];
+const unsigned char *e;
+uint64_t      ext = 0, at;
+unsigned      i, num = 5;
+int           rc;
+    for (i = 0; i < 4; i++) {
+        e = mbr + 446 + 16 * i;
+        if (e[4] == 0) continue;
+        if ((rc = zlayout_add(l, i + 1, (uint64_t) le32(e + 8) * 512, (uint64_t) le32(e + 12) * 512)) != SZAP_OK) return rc;
+        l->part[l->npart - 1].type = e[4];
+        if ((e[4] == 0x05 || e[4] == 0x0f || e[4] == 0x85) && ext == 0) ext = le32(e + 8);
+    }
+    /*  each EBR: a logical partition (relative to it), then the next EBR (relative to the extended one)  */
+    for (at = ext, i = 0; at != 0 && i < SZAP_MAXEBR; i++) {
+        if ((rc = zlayout_get(l, rd, arg, ebr, 512, at * 512)) != SZAP_OK) return rc == SZAP_EIO ? rc : SZAP_OK;
+        if (ebr[510] != 0x55 || ebr[511] != 0xaa) break;
+        if (ebr[446 + 4] != 0) {
+            if ((rc = zlayout_add(l, num++, (at + le32(ebr + 446 + 8)) * 512, (uint64_t) le32(ebr + 446 + 12) * 512)) != SZAP_OK) return rc;
+            l->part[l->npart - 1].type = ebr[446 + 4];
+        }
+        at = le32(ebr + 462 + 8) ? ext + le32(ebr + 462 + 8) : 0;
+    }
+    return SZAP_OK;
+}
+
+int szap_layout_read(szap_pread_fn rd, void *arg, szap_layout **lp) {
+szap_layout   *l;
+unsigned char s[512], hdr[512];
+int           i, gpt = 0, rc;
+    pthread_once(&szap_once, szap_tables);
+    if ((l = calloc(1, sizeof(*l))) == NULL) return SZAP_ENOMEM;
+    l->scheme = "no partition table";
+    l->secsize = 512;
+    if ((rc = zlayout_get(l, rd, arg, s, 512, 0)) == SZAP_OK && s[510] == 0x55 && s[511] == 0xaa) {
+        for (i = 0; i < 4; i++) if (s[446 + 16 * i + 4] == 0xee) gpt = 1;  /* a protective MBR */
+        /*  the GPT header is in the second sector: 512 bytes in, or 4096 on a 4K disk  */
+        for (l->secsize = 512; gpt && l->secsize <= 4096; l->secsize *= 8) {
+            if ((rc = zlayout_get(l, rd, arg, hdr, 512, l->secsize)) == SZAP_EIO) break;
+            if (rc == SZAP_OK && memcmp(hdr, "EFI PART", 8) == 0) break;
+        }
+        if (rc == SZAP_EIO) ;  /* (returned below) */
+        else if (gpt && l->secsize <= 4096) {
+            l->scheme = "GPT";
+            rc = zlayout_gpt(l, rd, arg, hdr);
+        } else {
+            l->scheme = "MBR";
+            l->secsize = 512;
+            rc = zlayout_mbr(l, rd, arg, s);
+        }
+    }
+    if (rc == SZAP_ENOPART) rc = SZAP_OK;  /* too short for a table, or a table cut short: what's there */
+    if (rc != SZAP_OK) {
+        szap_layout_free(l);
+        return rc;
+    }
+    *lp = l;
+    return SZAP_OK;
+}
+
+void szap_layout_free(szap_layout *l) {
+    if (l == NULL) return;
+    free(l->part);
+    free(l);
+}
+
+int szap_is_symbolic(const char *s) {
+    if ((s[0] == 'p' || s[0] == 'P') && s[1] >= '0' && s[1] <= '9') return 1;
+    return strncasecmp(s, "gpt:", 4) == 0;
+}
+
+/*  a GPT name, as a card word: case doesn't matter, and '_' is a space  */
+static int zname_is(const char *name, const char *s, size_t n) {
+size_t i;
+    for (i = 0; i < n; i++) {
+        if (name[i] == '\0') return 0;
+        if (name[i] == ' ' && s[i] == '_') continue;
+        if (tolower((unsigned char) name[i]) != tolower((unsigned char) s[i])) return 0;
+    }
+    return name[n] == '\0';
+}
+
+int szap_layout_offset(const szap_layout *l, const char *s, uint64_t *v) {
+const char      *plus, *end;
+const szap_part *p = NULL;
+uint64_t        add = 0;
+unsigned long   num;
+size_t          i, k, n;
+
+    if (!szap_is_symbolic(s)) return szap_parse_offset(s, v);
+    if ((plus = strrchr(s, '+')) != NULL && szap_parse_offset(plus + 1, &add) != SZAP_OK) return SZAP_EINVAL;
+    n = plus ? (size_t) (plus - s) : strlen(s);
+    if (s[0] == 'p' || s[0] == 'P') {
+        errno = 0;
+        num = strtoul(s + 1, (char **) &end, 10);
+        if (end != s + n || errno == ERANGE) return SZAP_EINVAL;
+        for (i = 0; i < l->npart && p == NULL; i++) if (l->part[i].num == num) p = &l->part[i];
+    } else if (strcmp(l->scheme, "GPT") == 0) {
+        s += 4;
+        n -= 4;
+        /*  a partition's own name first, then the first of the type  */
+        for (i = 0; i < l->npart && p == NULL; i++) if (zname_is(l->part[i].name, s, n)) p = &l->part[i];
+        for (k = 0; k < sizeof(gpttypes) / sizeof(gpttypes[0]) && p == NULL; k++) {
+            if (strlen(gpttypes[k].alias) != n || strncasecmp(gpttypes[k].alias, s, n) != 0) continue;
+            for (i = 0; i < l->npart && p == NULL; i++) if (memcmp(l->part[i].guid, gpttypes[k].guid, 16) == 0) p = &l->part[i];
+        }
+    }
+    if (p == NULL) return SZAP_ENOPART;
+    if (add >= p->len) return SZAP_EPASTEND;
+    *v = p->start + add;
+    return SZAP_OK;
+}
+
+int szap_layout_touches(const szap_layout *l, uint64_t off, uint64_t len) {
+size_t i;
+    for (i = 0; i < l->nfrom; i++)
+        if (off < l->from[i].off + l->from[i].len && (l->from[i].off < off || l->from[i].off - off < len)) return 1;
+    return 0;
+}
+
+/*  the table, as a 'dump' would head it: a line for the file, then one a partition  */
+size_t szap_layout_print(const szap_layout *l, const char *fn, char *out, size_t cap) {
+const szap_part *p;
+size_t          len, i, k;
+const char      *alias;
+
+#define ZPRINT(...)  (len += snprintf(out + (len < cap ? len : 0), len < cap ? cap - len : 0, __VA_ARGS__))
+    len = 0;
+    ZPRINT("partitions of %s: %s", fn, l->scheme);
+    if (strcmp(l->scheme, "GPT") == 0) ZPRINT(" (%u byte sectors)", l->secsize);
+    ZPRINT(", %zu partition(s)\n", l->npart);
+    for (i = 0; i < l->npart; i++) {
+        p = &l->part[i];
+        ZPRINT("  p%-3u offset %12" PRIx64 "  length %12" PRIx64, p->num, p->start, p->len);
+        if (p->type) ZPRINT("  type %02x\n", p->type);
+        else {
+            for (alias = NULL, k = 0; k < sizeof(gpttypes) / sizeof(gpttypes[0]) && alias == NULL; k++)
+                if (memcmp(p->guid, gpttypes[k].guid, 16) == 0) alias = gpttypes[k].alias;
+            ZPRINT("  '%s'%s%s\n", p->name, alias ? " gpt:" : "", alias ? alias : "");
+        }
+    }
+#undef ZPRINT
+    return len;
+}
+
+/*  the layout of the current file, read by whichever context wants it first  */
+static ssize_t zlayout_pread(void *arg, void *buf, size_t len, uint64_t off) {
+    return zread(arg, off, buf, len);
+}
+
+/*  (the context that reads the table prints it, once the table's mu is let go)  */
+int szap_offset(szap_ctx *z, const char *s, uint64_t *v) {
+szap_files *fs = z->fs;
+char       *text = NULL;
+size_t     n;
+int        rc = SZAP_OK;
+
+    if (!szap_is_symbolic(s)) return szap_parse_offset(s, v);
+    if (z->cur == NULL) return SZAP_ENOFILE;
+    pthread_mutex_lock(&fs->mu);
+    if (z->cur->layout == NULL) {
+        pthread_rwlock_rdlock(&z->cur->lock);
+        rc = szap_layout_read(zlayout_pread, z, &z->cur->layout);
+        pthread_rwlock_unlock(&z->cur->lock);
+        if (rc == SZAP_OK) {
+            n = szap_layout_print(z->cur->layout, z->cur->fn, NULL, 0);
+            if ((text = malloc(n + 1)) != NULL) szap_layout_print(z->cur->layout, z->cur->fn, text, n + 1);
+        }
+    }
+    if (rc == SZAP_OK) rc = szap_layout_offset(z->cur->layout, s, v);
+    pthread_mutex_unlock(&fs->mu);
+    if (text != NULL) zprintf(z, "%s", text);
+    free(text);
+    if(z->debug && rc == SZAP_OK) zprintf(z, "(debug) %s is offset %" PRIx64 "\n", s, *v);
+    return rc;
+}
+
+/*  a 'rep' of [off, off+len): if the current file's table was there, read it again next time  */
+static void zforget(szap_ctx *z, uint64_t off, uint64_t len) {
+szap_file *f = z->cur;
+int       gone = 0;
+    pthread_mutex_lock(&z->fs->mu);
+    if (f->layout != NULL && szap_layout_touches(f->layout, off, len)) {
+        szap_layout_free(f->layout);
+        f->layout = NULL;
+        gone = 1;
+    }
+    pthread_mutex_unlock(&z->fs->mu);
+    if(z->debug && gone) zprintf(z, "(debug) the 'rep' at %" PRIx64 " changes the partitions of %s\n", off, f->fn);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  cards: one at a time, or a deck of them                          */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The card is cut up in place (its 'data' is decoded over itself), so  */
+/*  nothing is allocated.  What it prints is what szap would print;      */
+/*  what szap would exit on comes back as an error instead.              */
+static char *ztok(char **s) {
+char *p = *s, *t;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p == '\0') return NULL;
+    for (t = p; *t && *t != ' ' && *t != '\t' && *t != '\r' && *t != '\n'; t++) ;
+    if (*t) *t++ = '\0';
+    *s = t;
+    return p;
+}
+
+/*  the offset and data of a 'ver' or 'rep'  */
+static int zfields(szap_ctx *z, char **s, uint64_t *off, char **data, size_t *len) {
+char *p;
+int  rc;
+    if ((p = ztok(s)) == NULL) {
+        zprintf(z, "missing offset\n");
+        return SZAP_EINVAL;
+    }
+    if ((rc = szap_offset(z, p, off)) != SZAP_OK) {
+        if (rc == SZAP_EINVAL) zprintf(z, "offset or length '%s' is not hex\n", p);
+        else zprintf(z, "offset '%s': %s\n", p, szap_strerror(rc));
+        return rc;
+    }
+    if(z->debug) zprintf(z, "(debug) offset in hex: %" PRIx64 "\n", *off);
+    if ((*data = ztok(s)) == NULL) {
+        zprintf(z, "missing data\n");
+        return SZAP_EINVAL;
+    }
+    if ((rc = szap_parse_data(*data, *data, strlen(*data), len)) != SZAP_OK) {
+        zprintf(z, "'data' must be pairs of hex bytes\n");
+        return rc;
+    }
+    if(z->debug) zprintf(z, "(debug) datalen in hex = %zx\n", *len);
+    return SZAP_OK;
+}
+
+int szap_card(szap_ctx *z, char *card) {
+char     *s = card, *p, *data;
+uint64_t off, len;
+size_t   datalen;
+int      rc;
+
+    if ((p = ztok(&s)) == NULL) return SZAP_OK;
+    if (strcasecmp(p, "ver") == 0 || strcasecmp(p, "verify") == 0) {
+        if (z->cur == NULL) {
+            zprintf(z, "'ver' before any 'name' card\n");
+            rc = SZAP_ENOFILE;
+        } else if ((rc = zfields(z, &s, &off, &data, &datalen)) == SZAP_OK
+                   && (rc = szap_ver(z, off, data, datalen)) == SZAP_EVERIFY) {
+            zprintf(z, "*** 'data' discompares; no writes will be performed ***\n");
+            zdump(z, "hexDump of data in named file", datalen, off);
+        }
+    } else if (strcasecmp(p, "rep") == 0) {
+        if (z->cur == NULL) {
+            zprintf(z, "'rep' before any 'name' card\n");
+            rc = SZAP_ENOFILE;
+        } else if ((rc = zfields(z, &s, &off, &data, &datalen)) == SZAP_OK) {
+            zprintf(z, z->ok_to_write ? "write will be done\n" : "write will NOT be done\n");
+            if ((rc = szap_rep(z, off, data, datalen)) == SZAP_EIO)
+                zprintf(z, "*** write at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n",
+                        off, strerror(z->err));
+        }
+    } else if (strcasecmp(p, "name") == 0) {
+        if ((p = ztok(&s)) == NULL) {
+            zprintf(z, "<fn> missing\n");
+            rc = SZAP_EINVAL;
+        } else if ((rc = szap_name(z, p)) != SZAP_OK)
+            zprintf(z, "The input file '%s' could not be opened (%s)\n", p, strerror(z->err));
+    } else if (strcasecmp(p, "dump") == 0) {
+        if ((p = ztok(&s)) == NULL) {
+            zprintf(z, "<fn> missing\n");
+            rc = SZAP_EINVAL;
+        } else {
+            data = p;
+            len = SZAP_DUMPLEN;
+            off = 0;
+            /*  (anything that isn't hex, or in a partition, starts a comment)  */
+            if ((p = ztok(&s)) == NULL || szap_parse_offset(p, &len) != SZAP_OK) p = NULL;
+            else p = ztok(&s);
+            if ((rc = zopen(z, data, 0, &z->cur)) == SZAP_EOPEN)
+                zprintf(z, "open: %s\n(filename=%s)\n", strerror(z->err), data);
+            else if (rc == SZAP_OK && p != NULL && (rc = szap_offset(z, p, &off)) != SZAP_OK) {
+                if (rc != SZAP_EINVAL) zprintf(z, "offset '%s': %s\n", p, szap_strerror(rc));
+                else rc = SZAP_OK;
+            }
+            if (rc == SZAP_OK) rc = szap_dump(z, NULL, len, off);
+        }
+    } else if (strcasecmp(p, "reset") == 0) {
+        szap_reset(z);
+        zprintf(z, "*** 'reset' overrides the 'dryrun' flag and resets all prior errors to allow writes\n");
+        rc = SZAP_OK;
+    } else if (strcasecmp(p, "find") == 0 || strcasecmp(p, "sum") == 0 || strcasecmp(p, "diff") == 0
+               || strcasecmp(p, "undo") == 0 || strcasecmp(p, "extract") == 0
+               || strcasecmp(p, "inject") == 0 || strcasecmp(p, "alias") == 0 || strcasecmp(p, "zero") == 0
+               || strcasecmp(p, "fill") == 0 || strcasecmp(p, "copy") == 0) {
+        zprintf(z, "*** '%s' is not run by libszap ***\n", p);
+        rc = SZAP_EVERB;
+    } else rc = SZAP_OK;  /* anything unrecognised is a comment */
+    zflush(z);
+    return rc;
+}
+
+/*  Every card (one a line) of a NUL terminated deck, which is cut up in  */
+/*  place.  A failed 'ver' or an unwritten 'rep' doesn't stop it, as in   */
+/*  szap; anything that would end szap ends the deck.  The first error    */
+/*  is returned.                                                          */
+int szap_deck(szap_ctx *z, char *deck) {
+char *card = deck, *nl;
+int  rc, first = SZAP_OK;
+    while (card != NULL && *card) {
+        if ((nl = strchr(card, '\n')) != NULL) *nl++ = '\0';
+        rc = szap_card(z, card);
+        if (first == SZAP_OK) first = rc;
+        if (rc != SZAP_OK && rc != SZAP_EVERIFY && rc != SZAP_EDRYRUN) break;
+        card = nl;
+    }
+    return first;
+}
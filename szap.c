@@ -44,16 +44,21 @@ SOFTWARE.
     Remember it's a makefile, so tab out to 'sudo'. Also, you won't have to 'sudo'
     the executable if it's 'chown'd/'chmod'd:
 
-TEMPFILES = *.o *.out
+TEMPFILES = *.o *.out libszap.a libszap.so
 PROGS = szap
 
 all:
-        gcc -o ${PROGS} ${PROGS}.c
+        gcc -pthread -o ${PROGS} ${PROGS}.c libszap.c -lz
         sudo chown root:root ${PROGS}
         sudo chmod u+s       ${PROGS}
         if [ ! -e ~/bin ]; then mkdir ~/bin/; fi
         sudo mv ${PROGS} ~/bin/${PROGS}
 
+lib:
+        gcc -O2 -fPIC -pthread -c libszap.c
+        ar rcs libszap.a libszap.o
+        gcc -shared -pthread -o libszap.so libszap.o
+
 clean:
         -rm -f ${PROGS} ${TEMPFILES}
         sudo rm ~/bin/${PROGS}
@@ -63,7 +68,7 @@ clean:
     There is a check done to make sure you are EUID == root, as a warning in case
     the file(s) is/are inaccessible by your uid.
 
-    Or you can just do 'gcc -o szap szap.c' and 'sudo ./szap'.  Your option.
+    Or you can just do 'gcc -pthread -o szap szap.c libszap.c -lz' and 'sudo ./szap'.  Your option.
 
     This program can be run interactively, but is more useful when run in a shell
     script, something like this:
@@ -81,19 +86,224 @@ clean:
     reset by (duh) 'reset'..
 
     The first token of the any control card is a verb: 'name', 'ver'/'verify',
-    'rep', 'dump', or 'reset'.  These verbs are in the format, and are, pretty much,
-    self-explanitory:
+    'rep', 'dump', 'find', 'sum', 'diff', 'undo', 'extract', 'inject', 'zero',
+    'fill', 'copy', 'alias', or 'reset'.  These verbs are in the format, and are,
+    pretty much, self-explanitory:
       name <filename>
       ver <offset> <data>
       verify same
       rep <offset> <data>
       dump <name> [<length> [<skip>]]
+      find <data> [<start> [<length>]]
+      sum <offset> <length> [crc32c|fast64] [<expected>]
+      diff <old> <new> [<offset> [<length>]]
+      undo <journal>
+      extract <offset> <length> <outfile>
+      inject <infile> <offset>
+      zero <offset> <length>
+      fill <offset> <length> <pattern>
+      copy <from> <to> <length>
+      alias <alias> <filename>
       reset
 
+    Every file a 'name' or 'dump' card opens stays open until the end, so switching
+    back and forth between files costs nothing.  'dump' opens a file read only and
+    'name' read/write; a file already open read/write is used as is.  'alias' gives
+    a file a short name that 'name' and 'dump' cards can use in place of the path.
+
     The <offset> and <data> are hex and may be preceeded by '0x' or '0X'.  The <data>
-    must be pairs of valid hex digits. Commas are not allowed in required fields: nor
-    is continuation of a control card, but as control cards can be 4096 bytes long,
-    that probably isn't necessary. Not much validity checking is done.
+    must be pairs of valid hex digits. Commas are not allowed in required fields.  A
+    control card can be any length (a several hundred KB <data> is fine), and a line
+    that ends with a '\' is continued on the next one.  A <data> with anything but hex
+    digits in it is reported and the program exits.
+
+    The cards are read from stdin a MB at a time and split in place, one pass per
+    card; the verb may be in any case.  Each line is echoed, after a '> ', as it is
+    read; --quiet (-q) turns that off.
+
+    A 'dump' <length> is not limited by any buffer; the range is read (or mapped)
+    a few MB at a time and printed as it goes, so a whole partition can be dumped.
+    Offsets and lengths are 64 bits, so anything past 4 GiB can be addressed.  In a
+    sparse image, holes are not read: 'dump' shows one line of zeros and a '*'.
+
+    With --plan (-p) the zap is all-or-nothing.  'rep' cards are only recorded;
+    'ver' cards run as they are read, against the file as it will be once the
+    recorded reps are in.  A 'dump' of a file with reps waiting is held back.
+    After the last card, if no 'ver' failed, each file's reps are sorted and
+    adjacent or overlapping ones merged (the later card wins), then written
+    with one pwritev per merged range.  The held dumps run after that.
+
+    With --uring (-u), and a kernel with io_uring, the reads for a run of 'ver'
+    cards (or the writes for a run of 'rep' cards) are all submitted together, and
+    a 'dump' of a device keeps several large reads in flight.  Any other card ends
+    the run.  Writes that overlap are never in flight at the same time.  Results are
+    reported in card order when the run ends, so a discompare names its offset.  If
+    io_uring can't be set up, szap says so and uses the ordinary blocking calls.
+
+    With --direct (-D), files and devices are opened O_DIRECT, so reads are not
+    stale and the page cache is left alone.  Every transfer is made to whole logical
+    sectors (BLKSSZGET for a device, the filesystem block for a file) through pooled
+    aligned buffers.  A 'rep' that doesn't cover whole sectors is a read-modify-write
+    of the sectors it touches.  --readback (-r) rereads each direct write and checks
+    it; a mismatch is reported like a failed write.
+
+    'find <data> [<start> [<length>]]' lists every offset in the current file (the
+    last 'name' or 'dump') where <data> occurs, from <start> (default 0) for <length>
+    bytes (default, to the end).  The range is searched 8 MB at a time by a thread
+    per CPU (--threads (-t) <n> to change that) with SSE2 compares; a match that
+    crosses from one 8 MB piece into the next is still found.  Holes in a sparse
+    image are not read unless <data> is all zeros.
+
+    'sum <offset> <length> [crc32c|fast64] [<expected>]' checksums a range of the
+    current file: CRC32C (with the CPU's CRC instruction when it has one) or fast64
+    (XXH64 of each 1 MiB, then of those).  Pieces are summed in parallel, like 'find',
+    and holes are not read.  If <expected> is given and the sum isn't it, the sum is
+    reported and, as with a failed 'ver', no writes will be performed.
+
+    'diff <old> <new> [<offset> [<length>]]' compares two files (or devices), 8 MB at
+    a time on the same threads as 'find', and prints the cards that make <old> into
+    <new>: a 'name' for <old>, a 'ver' of the old bytes for each range that differs
+    (ranges less than 16 bytes apart are one range; a card holds at most 2 KB), then
+    a 'rep' of the new bytes for each.  Everything else it prints is a comment to
+    szap, so the output can be fed straight back in (or edited to 'name' another
+    copy of <old>).  Files of different sizes are compared as far as the shorter.
+
+    With --journal (-j) <file>, the bytes a write is about to cover are saved in
+    <file> first.  Writes go in batches (a run of 'rep' cards, as with --uring, or a
+    whole --plan), and the journal gets one write and one fdatasync per batch, before
+    any of the batch is written; each file written gets one fdatasync at the end.
+    'undo <file>' puts the saved bytes back, newest first, and cuts a file a 'rep'
+    made longer back to its old size.  A record left half written by a crash is
+    ignored (its batch was never started).  'undo' obeys dryrun and, under
+    --journal, is journaled itself, so it can be undone (into another file: an
+    'undo' of the journal the run is writing is refused).
+
+    --compile (-c) <patch> reads the deck but reads and writes nothing else: its
+    'name', 'ver' and 'rep' cards ('alias' too) are decoded once and written to
+    <patch>, a binary file with a checksum, each file's reps sorted and merged as
+    --plan would write them and its vers joined where they touch.  A 'ver' of bytes
+    that an earlier 'rep' sets is settled then (one that could never pass is an
+    error).  'reset', 'undo' and a 'sum' with an <expected> value change what gets
+    written, so they end the compile with an error; other cards that can't be
+    compiled are ignored.  --apply (-a) <patch> maps the file and runs it
+    instead of reading cards: every 'ver' in it first, then, if they all passed, every
+    'rep', straight from the map.  The patch is usually smaller than the deck.
+
+    --stats (-S) prints, after '*** end of control cards ***' (and any --plan
+    writes), where the run went: the cards and time for each verb, the bytes and
+    time spent lexing cards, decoding <data> and formatting dumps, and for each kind
+    of system call (read, write, writev, sync, mmap, io_uring, stdin, copy, zero) its count,
+    bytes, short transfers, errors, total time and a histogram of its latencies in
+    power-of-two buckets.  --stats=json (-Sjson) prints it as one line of JSON.  A
+    card's time runs until the next card is read, so a --uring or --journal batch
+    is charged to the card that ends it.  Without --stats nothing is timed.
+
+    'extract <offset> <length> <outfile>' copies <length> bytes of the current file,
+    from <offset>, to <outfile> (made, or emptied, first), and 'inject <infile>
+    <offset>' copies all of <infile> into the current file ('name') at <offset>: a
+    backup of an MBR or a boot partition before a zap, and a way to put it back, with
+    no hex in between.  The bytes are moved by the kernel (copy_file_range, else
+    sendfile, else splice), so hundreds of MB go at device speed; only under --direct
+    or --plan are they read and written through a buffer.  'extract' is synced before
+    the next card and, as it only reads the target, runs even in dryrun; if it fails,
+    no writes will be performed.  'inject' is a write like 'rep': dryrun stops it,
+    --journal saves what it covers first, and under --plan (or --compile) it is read
+    in and held as a 'rep'.  Under --plan 'extract' sees the planned reps.
+
+    What 'ver' cards and 'dump's of up to 1 MB read is kept in a block cache (4 KB
+    blocks, by file and block number, least recently used out first; --cache (-C)
+    <MB> sets its size, default 16, 0 for none), so a deck that dumps, verifies,
+    replaces and dumps the same sectors reads them once.  It is write through: a
+    'rep' updates the cached copy as it writes the file, and anything else that
+    writes ('inject', --plan's pwritevs, 'undo') drops the blocks it covers.  With
+    --uring, only a 'ver' whose blocks are all cached is served from it.  Under
+    --direct there is no cache unless --cache is given, as the point there is to
+    read the device every time.  --stats reports its hits, misses and evictions.
+
+    The hex decoding, offsets and dump lines live in libszap.c, which is built in
+    with szap.c and is also a library ('make lib': libszap.a and libszap.so; the
+    calls are in szap.h).  It runs the 'name', 'ver', 'rep', 'dump' and 'reset'
+    cards for another program, one card (szap_card) or a deck (szap_deck) at a
+    time, or as calls (szap_name, szap_ver, szap_rep, szap_read, szap_dump).  What
+    szap keeps in globals is in a szap_ctx, so threads can each zap with their own;
+    nothing exits, every call returns an SZAP_E code (szap_strerror), and cards,
+    data and dump lines are in the caller's buffers.  What a card prints goes to a
+    function the caller gives (stdout by default).  szap's own 'name', 'ver',
+    'rep' and short 'dump' cards go through it too, unless --plan, --uring,
+    --journal, --direct, --stats or --cache is given, the file is a .gz image, or
+    (for a 'dump') --squeeze or a hole wants szap's folding.  The other cards are
+    still only in szap itself.
+
+    With --serve (-l) <socket>, szap reads no cards from stdin but stays up, listening
+    on a unix socket (made for its owner only), and runs the cards each connection
+    sends, one line at a time, through libszap: a session per connection, on a
+    thread of its own, with its own dryrun state (set to begin with by --dryrun).
+    The targets stay open between sessions and are shared by them: 'ver's and
+    'dump's of one run together and 'rep's to it go one at a time.  What a card
+    prints comes back as soon as it has run, then a line '= <rc> <message>' (0 is
+    success; a failed 'ver' is -5), so a client can send thousands of cards without
+    waiting on each.  A card that would end szap writes nothing more in its session
+    until a 'reset'.  Only libszap's cards ('name', 'ver', 'rep', 'dump', 'reset')
+    are run; --journal, --plan, --direct, --stats and --cache are refused, as are
+    compressed targets, and --uring and the rest don't apply.  SIGINT or SIGTERM
+    stop it (the socket is removed).  For example:
+      szap --serve /run/szap.sock &
+      printf 'name /dev/sdb\nver 1c2 07\nrep 1c2 0c\n' | socat - UNIX-CONNECT:/run/szap.sock
+
+    With --fleet (-F) <targets>, the deck is read once and run against every file
+    <targets> names: a glob ('~/images/sd*.img', quoted so szap expands it), or
+    '@<file>', a file of paths, one a line.  In the deck, 'name {}' and 'dump {}'
+    stand for the target (no other file may be named), and only 'name', 'ver',
+    'rep', 'dump' and 'reset' can be used; their <data> is decoded once.  The
+    targets are shared out to a pool of threads (--threads, default one per CPU;
+    more if the images are on many disks) and each is zapped through libszap as a
+    run of szap on it alone would zap it, with its own dryrun state.  What a target
+    prints comes out in one piece when it is done, then a line 'fleet <file>: ...'
+    with the 'ver's passed and 'rep's written (and the 'ver' that failed, or why it
+    stopped), and at the end a summary: how many were zapped, failed a 'ver', were
+    not (all) written (dryrun), or had an error.  The exit code is 4 if any target
+    failed a 'ver' or had an error.  --journal, --plan and --direct are refused.
+
+    'zero <offset> <length>', 'fill <offset> <length> <pattern>' and 'copy <from>
+    <to> <length>' write big ranges of the current file with no hex to decode:
+    zeros, <pattern> (hex, as <data>) repeated from <offset> on, or the bytes at
+    <from>, all in the one file.  Zeros are the kernel's job where it can: BLKZEROOUT
+    on a block device, fallocate on a file (a hole inside the file, ZERO_RANGE past
+    its end); 'copy' uses copy_file_range, as 'inject' does.  Otherwise they are
+    written from an 8 MB buffer, so gigabytes go at the speed of the storage.
+    Overlapping 'copy' ranges are copied as memmove would.  They are writes like
+    'rep': dryrun stops them, --journal saves what they cover first, and --plan
+    holds them as a 'rep' (up to 64 MB).  'copy' can't be --compile'd.
+
+    A file named '<image>.gz' that is gzip inside is zapped as the image it holds:
+    'name', 'dump' and the other cards see (and offsets count) the uncompressed
+    bytes.  The first time, it is inflated once, end to end, and an access point is
+    noted every 4 MB of the image; the points are saved beside it in '<image>.gz.szi'
+    (made again if the .gz file changes), so later runs start straight away.  A read
+    inflates from the last point before it, so a 'ver' 20 GB in costs no more than
+    one at the start, and reads that follow on carry on from where the last stopped.
+    Writes are held until after the last card; then the .gz file is rewritten from
+    the last point before the first byte written: what comes before it is kept as
+    it is (copied by the kernel), the rest is deflated again as 4 MB gzip members,
+    and the new file is renamed over the old.  A zap near the end of a big image is
+    quick, one near the start rewrites most of it, and a run that exits early writes
+    nothing to it.  A '.zst' image is refused (no writes will be performed): there
+    is no zstd in this szap.  --fleet and --serve won't take compressed targets, and
+    libszap sees a .gz file's compressed bytes.
+
+    An offset (not a length) can be in a partition of the current file instead:
+    'p2+400' is 400 hex bytes into partition 2, 'gpt:esp+10' 10 into the GPT
+    partition of that name (any case, '_' for a space) or, failing that, the first of
+    that type (esp or efi, bios, linux, swap, msdata); with no '+' it is the start.
+    The MBR (with the logical partitions of an extended one as p5 on) or the GPT is
+    read the first time such an offset is used on a file, printed, and kept: later
+    cards, and decks that go back and forth between files, find offsets with no I/O,
+    and one deck runs against disks laid out differently (under --fleet, each target
+    has its own).  A write over the sectors the table was read from (a 'rep' to the
+    MBR, say) means it is read again for the next one; under --plan, where nothing is
+    written until the end, offsets are all found in the table as it was.  A partition
+    that isn't there, or an offset past its end, ends the run.  'diff' takes only hex,
+    and --compile, which opens no file, takes none of these.
 
     Anything unrecognised is considered a comment.
 
@@ -103,6 +313,7 @@ clean:
 
 #define VERS "0.99"
 
+#define   _GNU_SOURCE  /* SEEK_DATA/SEEK_HOLE, among others */
 #define   _LARGEFILE_SOURCE
 #define   _LARGEFILE64_SOURCE
 #define  __USE_LARGEFILE64
@@ -119,21 +330,261 @@ clean:
 #include  <stdlib.h>
 #include  <stdio.h>
 #include  <string.h>
+#include  <ctype.h>     /*  for tolower  */
+#include  <stdint.h>
+#include  <inttypes.h>  /*  for PRIx64  */
+#include  <errno.h>
 #include  <getopt.h>    /*  for getopt_long  */
 #include  <fcntl.h>     /*  for open/close  */
-#define   SRCSIZE 4096
-#define  DESTSIZE 2045
+#include  <sys/stat.h>  /*  for fstat  */
+#include  <sys/mman.h>  /*  for mmap/munmap  */
+#include  <sys/uio.h>   /*  for pwritev  */
+#include  <limits.h>    /*  for IOV_MAX  */
+#include  <sys/syscall.h>     /*  for the io_uring system calls  */
+#include  <linux/io_uring.h>
+#include  <sys/ioctl.h>   /*  for BLKSSZGET and BLKZEROOUT  */
+#include  <linux/fs.h>
+#include  <pthread.h>   /*  for the 'find' workers  */
+#include  <sys/sendfile.h>  /*  for 'extract' and 'inject'  */
+#include  <sys/socket.h>    /*  for --serve  */
+#include  <sys/un.h>
+#include  <signal.h>
+#include  <glob.h>          /*  for --fleet  */
+#include  <zlib.h>          /*  for .gz images  */
+
+#include  "szap.h"      /*  libszap: decoding, offsets and dump lines are shared with it  */
+#define ARENAMIN  4096            /* smallest arena allocation; they grow by doubling */
 #define LENTODUMP 512
 #define      SKIP 0
+#define DUMPCHUNK (4 * 1024 * 1024) /* bytes per streamed 'dump' window; a multiple of 16 and of the page size */
+#define URINGDEPTH 64               /* io_uring submission queue entries */
+#define DUMPDEPTH  4                /* DUMPCHUNK reads a --uring dump keeps in flight */
+#define FINDCHUNK (8 * 1024 * 1024) /* bytes each 'find' thread reads and searches at a time */
+#define SUMCHUNK  (8 * 1024 * 1024) /* bytes each 'sum' thread reads and sums at a time */
+#define DIFFCHUNK (8 * 1024 * 1024) /* bytes of each file a 'diff' thread compares at a time */
+#define DIFFGAP   16                /* differences closer than this are joined into one card */
+#define DIFFCARD  2048              /* most bytes of data 'diff' puts on one card */
+#define STATBUCKETS 40              /* --stats latency buckets: 1ns to 2^40ns (18 minutes) */
+#define COPYCHUNK (8 * 1024 * 1024) /* 'extract'/'inject' buffer (and splice) size */
+#define COPYMAX   (1024 * 1024 * 1024) /* most one copy_file_range or sendfile is asked for */
+#define HOLDMAX   (64 * 1024 * 1024)  /* most a 'zero', 'fill' or 'copy' held by --plan or --compile */
+#define CACHEBLOCK 4096             /* the block cache's unit */
+#define CACHERUN  256               /* most blocks one cache miss reads */
+#define CACHEMB   16                /* default --cache size, MB */
+#define CACHEDUMP (1024 * 1024)     /* a 'dump' this long or shorter goes through the cache */
+#define CARDBLOCK (1024 * 1024)     /* bytes of stdin read at a time; the buffer grows for longer cards */
+#define GZSPAN    (4 * 1024 * 1024) /* bytes of a .gz image between its access points */
+#define GZWINDOW  32768             /* deflate's window: what an access point has to keep */
+#define GZINCHUNK (256 * 1024)      /* compressed bytes read at a time */
+#define SUM_CRC32C 0                /* 'sum' algorithms */
+#define SUM_FAST64 1
+
+uint64_t do_offset(char *p);
+int      try_offset(char *p, uint64_t *v);
+uint64_t do_address(char *p, int fd);
+int      try_address(char *p, int fd, uint64_t *v);
+void     layout_forget(int fd, off64_t off, uint64_t len);
+ssize_t  pread_full(int fd, void *buf, size_t len, off64_t off);
+ssize_t  pwrite_full(int fd, const void *buf, size_t len, off64_t off);
+int      zopen(char *fn, int flags);
+void     zclose(int fd);
+int      zsync(int fd);
+unsigned dio_blocksize(int fd);
+
+/*  every file 'name'd or 'dump'ed stays open, in this table, until the end  */
+typedef struct {
+    char  *fn;     /*  the path it was first opened by                   */
+    char  *alias;  /*  set by an 'alias' card, or NULL                    */
+    int   fd;
+    int   rw;      /*  opened O_RDWR (else O_RDONLY)                      */
+    dev_t dev;     /*  so another path to the same file finds this entry  */
+    ino_t ino;
+    dev_t rdev;
+    szap_layout *layout;  /*  its partitions, once an offset has named one  */
+} handle_t;
 
-uint do_offset(char *p);
-uint do_data(char *dest, char *src);
+handle_t *handle_open(char *name, int rw);
+void      handle_alias(char *alias, char *fn);
+void      handle_closeall(void);
+char     *handle_name(int fd);
+char     *handle_resolve(char *name);
+int      next_data(int fd, off64_t pos, off64_t end, off64_t *dstart, off64_t *dend);
+/*  a growable buffer: 'ver'/'rep' data (and what 'ver' reads back) live in  */
+/*  these, so a card's data is limited only by memory.  They only grow.      */
+typedef struct {
+    char   *base;
+    size_t  cap;
+} arena_t;
+
+char  *arena_reserve(arena_t *a, size_t n);
+size_t do_data(arena_t *dest, char *src);
 void strtolower(char *s);
-void hexDump(char *desc, void *addr, int len, uint skip);
+
+/*  the control cards: stdin, a block at a time, split into tokens in place  */
+typedef struct {
+    char     *buf;
+    size_t   cap, fill;
+    size_t   beg;          /*  where the next card starts                 */
+    int      eof;
+    char     **tok;        /*  this card's tokens                         */
+    size_t   *off;         /*  (and where they are, while it is lexed)    */
+    size_t   ntok, tcap, next;
+    uint64_t lineno, bytes;
+} card_t;
+
+/*  the verbs, as verb_lookup tells them  */
+enum { V_NONE, V_VER, V_REP, V_NAME, V_DUMP, V_FIND, V_SUM, V_DIFF, V_UNDO, V_ALIAS, V_RESET, V_EXTRACT, V_INJECT, V_ZERO, V_FILL, V_COPY, V_NVERBS };
+
+int   card_read(card_t *c);
+char *card_tok(card_t *c);
+int   verb_lookup(const char *p);
+
+/*  --stats: the system calls, by type, and the phases of reading a deck  */
+enum { ST_READ, ST_WRITE, ST_WRITEV, ST_SYNC, ST_MMAP, ST_URING, ST_STDIN, ST_COPY, ST_ZERO, ST_NIO };
+enum { SP_LEX, SP_DECODE, SP_PRINT, SP_NPHASE };
+typedef struct {
+    uint64_t calls, bytes, shorts, errors, ns;
+    uint64_t hist[STATBUCKETS];     /*  calls that took [2^k, 2^(k+1)) ns  */
+} iostat_t;
+typedef struct {
+    uint64_t calls, bytes, ns;
+} phasestat_t;
+
+uint64_t stat_now(void);
+void     stat_start(void);
+void     stat_io(int type, uint64_t t0, ssize_t got, size_t want);
+void     stat_bytes(int type, uint64_t n);
+void     stat_phase(int phase, uint64_t t0, uint64_t bytes);
+void     stat_lexstart(void);
+void     stat_card(int verb, uint64_t t0);
+void     stat_report(void);
+void hexDump(char *desc, void *addr, int len, uint64_t skip);
+void hexDumpEnd(void);
+void hexDumpZeros(uint64_t skip, uint64_t len);
+void dump_range(int fd, uint64_t len, uint64_t skip);
+int  dump_short(int fd, uint64_t len, uint64_t skip);
+off64_t target_size(int fd);
+
+/*  --plan: 'rep's are held, per file, until every card has been read  */
+typedef struct {
+    off64_t  off;
+    size_t   len;
+    char     *data;    /*  a private copy of the decoded 'rep' data          */
+    unsigned seq;      /*  card order; where two reps overlap the later wins  */
+} planrep_t;
+
+typedef struct {
+    char      *fn;
+    int       fd;
+    planrep_t *reps;
+    size_t    nreps, cap;
+    planrep_t *vers;   /*  --compile keeps the vers too  */
+    size_t    nvers, vcap;
+} plantarget_t;
+
+typedef struct {       /*  a 'dump' of a file with planned reps waits for them  */
+    char     *fn;
+    uint64_t len, skip;
+} plandump_t;
+
+plantarget_t *plan_target(char *fn, int fd, int create);
+void plan_rep(plantarget_t *t, off64_t off, char *data, size_t len);
+void plan_overlay(plantarget_t *t, char *buf, size_t len, off64_t off);
+void plan_dump(char *fn, uint64_t len, uint64_t skip);
+void plan_commit(void);
+void plan_ver(plantarget_t *t, off64_t off, char *data, size_t len);
+void patch_write(char *out);
+void patch_apply(char *fn);
+ssize_t pwritev_full(int fd, const struct iovec *iov, int cnt, off64_t off);
+void find_range(int fd, plantarget_t *t, unsigned char *pat, size_t patlen, uint64_t start, uint64_t len);
+int  pool_size(uint64_t npieces);
+int  sum_range(int fd, plantarget_t *t, int algo, uint64_t skip, uint64_t len, int haveexp, uint64_t expected);
+uint32_t crc32c(uint32_t crc, const void *p, size_t n);
+uint32_t crc32c_combine(uint32_t crca, uint32_t crcb, uint64_t lenb);
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed);
+void diff_files(char *fna, int fda, char *fnb, int fdb, uint64_t start, uint64_t len);
+int  pool_run(void *(*fn)(void *), void *args, size_t size, int nt);
+void journal_open(char *fn);
+void journal_range(int fd, off64_t off, size_t len);
+int  journal_commit(void);
+int  journal_big(int fd, off64_t off, uint64_t len, int zeros);
+void journal_close(void);
+void journal_undo(char *fn);
+void serve(char *path);
+void fleet(char *targets);
+/*  the block cache that 'ver' and short 'dump's read through  */
+typedef struct {
+    uint64_t hits, misses;      /*  blocks                                  */
+    uint64_t reads;             /*  preads issued for misses                */
+    uint64_t evictions, updates, forgotten;
+} cachestat_t;
+extern cachestat_t cachestat;
+
+void    cache_init(uint64_t mb);
+ssize_t cache_pread(int fd, void *buf, size_t len, off64_t off);
+int     cache_covers(int fd, off64_t off, size_t len);
+void    cache_write(int fd, const void *data, size_t len, off64_t off);
+void    cache_forget(int fd, off64_t off, uint64_t len);
+int64_t copy_range(int in, off64_t inoff, int out, off64_t outoff, uint64_t len, plantarget_t *t, const char **how);
+
+/*  a .gz image: read through an index of access points, written at the end  */
+typedef struct gzimage gzimage_t;
+gzimage_t *gz_image(int fd);
+int       gz_named(char *fn);
+void      gz_open(char *fn, int fd);
+uint64_t  gz_size(gzimage_t *g);
+ssize_t   gz_pread(gzimage_t *g, void *buf, size_t len, off64_t off);
+ssize_t   gz_pwrite(gzimage_t *g, const void *buf, size_t len, off64_t off);
+int       ztruncate(int fd, off64_t size);
+void      gz_commitall(void);
+void extract_range(int fd, plantarget_t *t, uint64_t skip, uint64_t len, char *outfn);
+void inject_file(int fd, char *fn, char *infn, uint64_t skip, arena_t *data, int hold);
+void fill_range(int fd, char *fn, uint64_t skip, uint64_t len, char *pat, size_t patlen, int hold);
+void copy_within(int fd, char *fn, uint64_t src, uint64_t dst, uint64_t len, int hold);
+
+/*  the reads for 'ver' cards and the writes for 'rep' cards go through a batch;  */
+/*  with the blocking backend it is flushed after every card, with --uring a run  */
+/*  of like cards is submitted together and flushed when something else comes     */
+#define IO_READ  0
+#define IO_WRITE 1
+
+typedef struct {
+    int          op;    /*  IO_READ for a 'ver', IO_WRITE for a 'rep'          */
+    int          fd;
+    off64_t      off;
+    size_t       len;
+    arena_t      data;  /*  the card's data                                   */
+    arena_t      disk;  /*  what a 'ver' read                                 */
+    plantarget_t *t;    /*  --plan: reps to lay over what a 'ver' read        */
+    ssize_t      res;
+    struct iovec iov;
+} ioreq_t;
+
+void io_queue(int op, int fd, off64_t off, char *data, size_t len, plantarget_t *t);
+void io_flush(void);
+void io_expect(int op);
+int  zlib_for(int fd);
+void zlib_open(char *fn, int rw);
+void ver_lib(off64_t off, char *data, size_t len);
+void rep_lib(int fd, off64_t off, char *data, size_t len);
+int  uring_init(unsigned entries);
+int  uring_submit(int op, int fd, struct iovec *iov, off64_t off, uint64_t tag);
+int  uring_reap(uint64_t *tag, int *res);
+void dump_uring(int fd, off64_t pos, off64_t end);
 
 int  debug=DEBUG_FLAG;  /*  'debug' is a global value, it's here so    */
                         /*  we don't have to pass it to each function  */
 int  ok_to_write=OK_TO_WRITE;  /*  ditto                               */
+int  squeeze=0;         /*  '1' folds duplicate hexDump lines into '*'  */
+int  plan=0;            /*  '1' holds every 'rep' until the deck is read  */
+int  uring=0;           /*  '1' once an io_uring is set up and in use      */
+int  direct=0;          /*  '1' opens with O_DIRECT; I/O is sector aligned  */
+int  readback=0;        /*  '1' rereads (O_DIRECT) writes to check them     */
+int  nthreads=0;        /*  'find'/'sum'/'diff' threads; 0 is one per CPU   */
+int  journal=0;         /*  '1' keeps an undo journal of every write        */
+int  echo=1;            /*  '1' echoes each control card as it is read      */
+int  stats=0;           /*  '1' prints statistics at the end, '2' as JSON   */
+szap_ctx *zlib=NULL;    /*  set when 'name', 'ver', 'rep' and 'dump' run in libszap  */
 
 /*  --------------  */
 /*    ----------    */
@@ -141,17 +592,31 @@ int  ok_to_write=OK_TO_WRITE;  /*  ditto                               */
 /*    ----------    */
 /*  --------------  */
 int main(int argc, char *argv[]) {
-int  fd;  /*  file descriptor of file being 'zap'ped  */
-char fn[128] = "";
-int  ret, i, c;
-int  datalen = 0;
-int  errno, errsv;
-uint len  = 0;
-uint skip = 0;
-uint ui;
-char *p;
-char buf[SRCSIZE];
-char data[DESTSIZE];
+int  fd = -1;  /*  file descriptor of file being 'zap'ped  */
+char *fn = "";  /*  and its name (owned by the handle table)  */
+handle_t *h;
+int  c;
+size_t  datalen = 0;
+int  errsv;
+uint64_t len  = 0;
+uint64_t skip = 0;
+char *p, *q;
+card_t  card;           /*  the control cards, and the current one's tokens  */
+int     verb = V_NONE;
+uint64_t cardt0 = 0;    /*  --stats: when the current card started  */
+int     want_uring = 0;
+arena_t data = { NULL, 0 };  /*  decoded 'ver'/'rep' data                  */
+uint64_t start = 0;
+uint64_t expected = 0;
+int      algo, haveexp;
+int      fda;           /*  'diff': the old file (the new one is 'h')  */
+char     *fna;
+char     *compileto = NULL;  /*  --compile: the patch file to write  */
+char     *applyfrom = NULL;  /*  --apply: the patch file to run      */
+char     *serveon = NULL;    /*  --serve: the socket to listen on    */
+char     *fleeton = NULL;    /*  --fleet: the targets ('@file' or a glob)  */
+char     *journalto = NULL;  /*  --journal: opened once the options are all in  */
+long long cachemb = -1;     /*  --cache: MB, or -1 for the default  */
 
     if (geteuid() != 0) {  //  this can be to 'stderr' or via 'printf', if you wish...
         fprintf(stdout, "EUID not 0; you may have to run as root, or sudo, to access a disk device or file\n");
@@ -165,12 +630,26 @@ char data[DESTSIZE];
         static struct option long_options[] = {
             {"debug",      no_argument,       0, 'x'},
             {"dryrun",     no_argument,       0, 'd'},
+            {"squeeze",    no_argument,       0, 's'},
+            {"plan",       no_argument,       0, 'p'},
+            {"uring",      no_argument,       0, 'u'},
+            {"direct",     no_argument,       0, 'D'},
+            {"readback",   no_argument,       0, 'r'},
+            {"threads",    required_argument, 0, 't'},
+            {"journal",    required_argument, 0, 'j'},
+            {"quiet",      no_argument,       0, 'q'},
+            {"stats",      optional_argument, 0, 'S'},
+            {"cache",      required_argument, 0, 'C'},
+            {"compile",    required_argument, 0, 'c'},
+            {"apply",      required_argument, 0, 'a'},
+            {"serve",      required_argument, 0, 'l'},
+            {"fleet",      required_argument, 0, 'F'},
             {"help",       no_argument,       0, 'h'},
             {"version",    no_argument,       0, 'v'},
             {0,            0,                 0,  0}
         };  /* end of 'struct'  */
 
-        c = getopt_long(argc, argv, "xdhvonp:", long_options, &option_index);
+        c = getopt_long(argc, argv, "xdspuDrt:j:c:a:l:F:qS::C:hvon", long_options, &option_index);
         if (c == -1) break;
 
         switch (c) {
@@ -184,13 +663,105 @@ char data[DESTSIZE];
                 ok_to_write=0;  /*  just set the dryrun mode flag  */
                 break;
 
+            case 's':
+                squeeze=1;  /*  fold runs of identical dump lines  */
+                break;
+
+            case 'p':
+                printf("**  plan mode set  **\n");
+                plan=1;  /*  verify everything first, then write  */
+                break;
+
+            case 'u':
+                want_uring=1;  /*  set up below, once the options are all in  */
+                break;
+
+            case 'D':
+                printf("**  direct I/O mode set  **\n");
+                direct=1;  /*  bypass the page cache  */
+                break;
+
+            case 'r':
+                readback=1;  /*  check every direct write  */
+                break;
+
+            case 't':
+                nthreads = atoi(optarg);  /*  0 (or nonsense) is one per CPU  */
+                if (nthreads < 0) nthreads = 0;
+                break;
+
+            case 'q':
+                echo=0;  /*  don't echo the control cards  */
+                break;
+
+            case 'S':
+                if (optarg == NULL || strcmp(optarg, "table") == 0) stats=1;
+                else if (strcmp(optarg, "json") == 0) stats=2;
+                else {
+                    printf("--stats is 'table' (the default) or 'json', not '%s'; exiting\n", optarg);
+                    exit(4);
+                }
+                break;
+
+            case 'C':
+                cachemb = strtoll(optarg, &q, 0);
+                if (*q != '\0' || cachemb < 0) {
+                    printf("--cache needs a size in MB (0 for none), not '%s'; exiting\n", optarg);
+                    exit(4);
+                }
+                break;
+
+            case 'c':
+                printf("**  compiling to %s; nothing will be read or written  **\n", optarg);
+                compileto = optarg;
+                break;
+
+            case 'a':
+                applyfrom = optarg;  /*  run that instead of reading cards  */
+                break;
+
+            case 'l':
+                serveon = optarg;  /*  listen there instead of reading cards  */
+                break;
+
+            case 'F':
+                fleeton = optarg;  /*  run the deck against every one of these  */
+                break;
+
+            case 'j':
+                journalto = optarg;  /*  old bytes go there before they are overwritten  */
+                break;
+
             case 'h':
-                printf("  %s [-x] [-d] [-h] [-v] \n\n", argv[0]);
+                printf("  %s [-x] [-d] [-s] [-p] [-u] [-D] [-r] [-t <n>] [-j <journal>] [-c <patch>] [-a <patch>] [-l <socket>] [-F <targets>] [-q] [-S[json]] [-C <MB>] [-h] [-v] \n\n", argv[0]);
                 printf("This is a C program that \"zap's\" the contents of a file, similar, but not identical\n");
                 printf("to, the IBM utility SPZAP, Superzap, IMASPZAP or AMASPZAP on the mainframe.  It is\n");
-                printf("not nearly as sophisticated.  It has four command line flags:\n");
+                printf("not nearly as sophisticated.  It has eighteen command line flags:\n");
                 printf(" --debug (-x) - set debug mode. output some debug info.\n");
                 printf(" --dryrun (-d) - set dryrun mode. no writes will be performed.\n");
+                printf(" --squeeze (-s) - print a '*' in place of repeated dump lines.\n");
+                printf(" --plan (-p) - hold every rep until all the cards are read and all the vers pass,\n");
+                printf("               then write them, merged, with as few writes as possible.\n");
+                printf(" --uring (-u) - keep the reads of a run of vers (or the writes of a run of reps,\n");
+                printf("                or a dump's reads) in flight together with io_uring, if there is one.\n");
+                printf(" --direct (-D) - open with O_DIRECT: reads and writes skip the page cache and are\n");
+                printf("                 whole sectors (a rep that isn't is a read-modify-write of them).\n");
+                printf(" --readback (-r) - with --direct, read every write back and check it.\n");
+                printf(" --journal (-j) <file> - before each batch of writes, save the bytes it will\n");
+                printf("               overwrite in <file> (one fsync per batch); 'undo <file>' puts them back.\n");
+                printf(" --compile (-c) <patch> - turn the name/ver/rep cards into a binary patch file.\n");
+                printf(" --apply (-a) <patch> - run a compiled patch (all its vers, then its reps).\n");
+                printf(" --serve (-l) <socket> - stay up and run the cards sent to a unix socket, a session\n");
+                printf("               per connection, each with its own dryrun state; no cards are read from stdin.\n");
+                printf(" --fleet (-F) <targets> - run the deck against every file of a glob (or, as @<file>,\n");
+                printf("               listed one a line) in parallel; 'name {}' and 'dump {}' stand for each.\n");
+                printf(" --threads (-t) <n> - search with <n> threads in 'find', 'sum' and 'diff' (default: one per CPU).\n");
+                printf(" --quiet (-q) - don't echo each control card as it is read.\n");
+                printf(" --stats[=json] (-S[json]) - at the end, print cards and time per verb, bytes and\n");
+                printf("               time lexing, decoding and printing, and each kind of system call's\n");
+                printf("               count, bytes, short transfers, errors and latency histogram.\n");
+                printf(" --cache (-C) <MB> - keep up to <MB> of what 'ver' and short 'dump's read, for the\n");
+                printf("               cards after them (default %i; 0 for none; none under --direct).\n", CACHEMB);
                 printf(" -h - output this text and exit.\n");
                 printf(" -v - display the version information and exit.\n");
                 printf("Primary input is via stdin (i.e. the console) or '<<' redirection in a shell script.\n\n");
@@ -199,6 +770,18 @@ char data[DESTSIZE];
                 printf("    ver  <offset> <data>\n");
                 printf("    rep  <offset> <data>\n");
                 printf("    dump <filename> <length> <skip>\n");
+                printf("    alias <alias> <filename> - let 'name'/'dump' use <alias> for <filename>\n");
+                printf("    find <data> [<start> [<length>]] - list every offset of <data> in the file\n");
+                printf("    sum  <offset> <length> [crc32c|fast64] [<expected>] - checksum a range; if it\n");
+                printf("         isn't <expected>, no writes will be performed, as with a failed ver\n");
+                printf("    diff <old> <new> [<offset> [<length>]] - print the ver/rep cards that make\n");
+                printf("         <old> into <new>\n");
+                printf("    undo <journal> - put back the bytes a --journal run overwrote\n");
+                printf("    extract <offset> <length> <outfile> - copy a range of the file, raw, to <outfile>\n");
+                printf("    inject <infile> <offset> - copy all of <infile>, raw, into the file at <offset>\n");
+                printf("    zero <offset> <length> - write <length> zeros (BLKZEROOUT or fallocate where they work)\n");
+                printf("    fill <offset> <length> <pattern> - write <pattern> over and over for <length> bytes\n");
+                printf("    copy <from> <to> <length> - copy <length> bytes of the file to <to> (copy_file_range)\n");
                 printf("    reset - turn the 'dryrun' flag off\n");
                 printf(" (anything unrecognised is ignored)\n");
                 printf("It would make sense to place the name(s) and ver(s) before the (name(s) and) rep(s),\n");
@@ -222,205 +805,583 @@ char data[DESTSIZE];
         }  /*  end of 'switch'  */
     }  /*  end of 'while'  */
 
+    /*  ------------------------------------------------  */
+    /*  --serve and --fleet run their cards through       */
+    /*  libszap, which writes straight to the file:       */
+    /*  nothing to journal, plan or align them            */
+    /*  ------------------------------------------------  */
+    if ((serveon != NULL || fleeton != NULL) && (journalto != NULL || plan || direct)) {
+        printf("--%s can't be used with --journal, --plan or --direct; exiting\n", serveon != NULL ? "serve" : "fleet");
+        exit(4);
+    }
+    if (serveon != NULL && (stats || cachemb >= 0)) {  /*  (its reads are libszap's: nothing counted or cached)  */
+        printf("--serve can't be used with --stats or --cache; exiting\n");
+        exit(4);
+    }
+    if (journalto != NULL) {
+        journal_open(journalto);
+        printf("**  journal %s  **\n", journalto);
+    }
+
     printf("***  Superuser ZAP, '%s', version %s  ***\n", argv[0], VERS);
 
-    while (fgets(buf, sizeof(buf), stdin) != NULL) {
-        printf("> %s", buf); // (each control cards ialready has a nl at the end...)
-        p = buf;
+    if (want_uring) {
+        if (uring_init(URINGDEPTH) == 0) {
+            uring = 1;
+            printf("**  io_uring in use  **\n");
+        } else {
+            errsv = errno;
+            printf("**  io_uring not available (%s); using blocking I/O  **\n", strerror(errsv));
+        }
+    }
+
+    if (stats) stat_start();
+    cache_init(cachemb >= 0 ? (uint64_t) cachemb : direct ? 0 : CACHEMB);
+    if (!plan && !uring && !journal && !direct && !stats && cachemb < 0
+        && compileto == NULL && applyfrom == NULL && serveon == NULL && fleeton == NULL) {
+        if ((zlib = szap_new()) == NULL) {
+            printf("unable to allocate a libszap context; exiting\n");
+            exit(4);
+        }
+    }
+    if (serveon != NULL) serve(serveon);  /*  doesn't come back  */
+    if (fleeton != NULL) fleet(fleeton);  /*  nor does this  */
+    if (applyfrom != NULL) {
+        patch_apply(applyfrom);
+        gz_commitall();
+        journal_close();
+        if (stats) stat_report();
+        handle_closeall();
+        exit(EXIT_SUCCESS);
+    }
+
+    memset(&card, 0, sizeof(card));
+    while (card_read(&card)) {  /*  (each card is echoed as it is read, unless --quiet)  */
+        if (stats && cardt0) stat_card(verb, cardt0);  /*  the card before this one has ended  */
+        cardt0 = 0;
+        if ((p = card_tok(&card)) == NULL) continue;
+        strtolower(p); // tranlate verb to lc so the lookup below is accurate
+        verb = verb_lookup(p);
+        if (stats) cardt0 = stat_now();
 
-        if ((p = strtok(p, " \t\n")) == NULL) continue;
-        // todo: tranlate verb to lc. strtolower is just a stub.
-        strtolower(p); // tranlate verb to lc so strcmp's below are accurate
+        /*  ------------------------------------------------  */
+        /*  --compile: a card that changes what gets written  */
+        /*  (a 'sum' with an <expected> is a gate, like a     */
+        /*  'ver') would be lost from the patch: that ends    */
+        /*  it; a card that only reads or prints is skipped   */
+        /*  ------------------------------------------------  */
+        if (compileto != NULL && verb == V_SUM) {
+            card_tok(&card);
+            card_tok(&card);
+            if ((q = card_tok(&card)) != NULL && (strcasecmp(q, "crc32c") == 0 || strcasecmp(q, "fast64") == 0))
+                q = card_tok(&card);
+            if (q != NULL && try_offset(q, &expected)) {
+                printf("'sum' with an <expected> value can't be compiled (the patch would write without it); exiting\n");
+                exit(4);
+            }
+        }
+        if (compileto != NULL && (verb == V_UNDO || verb == V_RESET)) {
+            printf("'%s' can't be compiled (the patch would write without it); exiting\n", p);
+            exit(4);
+        }
+        if (compileto != NULL && (verb == V_DUMP || verb == V_FIND || verb == V_SUM || verb == V_DIFF || verb == V_EXTRACT)) {
+            printf("*** '%s' can't be compiled; ignored ***\n", p);
+            continue;
+        }
+        /*  a 'ver' can join a batch of reads, a 'rep' one of writes; anything  */
+        /*  else (and a 'rep' that must know how the 'ver's went) flushes it   */
+        if (verb == V_VER) io_expect(IO_READ);
+        else if (verb == V_REP) io_expect(IO_WRITE);
+        else io_flush();
 
-        if (strcmp(p, "verify") == 0 || strcmp(p, "ver") == 0) {
+        if (verb == V_VER) {
             /*  ----------------------------------------  */
             /*  we have a 'verify' or 'ver' control card  */
             /*  ----------------------------------------  */
             /*  get next token (offset)                   */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("missing offset; exiting\n");
                 exit(4);
             }
             /*  ----------------------------------------  */
             /*  convert offset                            */
             /*  ----------------------------------------  */
-            skip = do_offset(p);
-            if(debug) printf("(debug) offset in hex: %x\n", skip);
+            skip = do_address(p, fd);
+            if(debug) printf("(debug) offset in hex: %" PRIx64 "\n", skip);
 
             /*  ----------------------------------------  */
             /*  get next token (data)                     */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("missing data; exiting\n");
                 exit(4);
             }
             /*  ----------------------------------------  */
             /*  convert data                              */
             /*  ----------------------------------------  */
-            datalen = do_data(data, p);
-            if(debug) printf("(debug) datalen in hex = %x\n", datalen);
-            /*  ----------------------------------------  */
-            /*  position the file to the offset           */
-            /*  ----------------------------------------  */
-            if (skip != 0) lseek64(fd, skip, SEEK_SET);
-            /*  ----------------------------------------  */
-            /*  then read datalen bytes into buf          */
-            /*  ----------------------------------------  */
-            read(fd, buf, datalen);
-            /*  ----------------------------------------  */
-            /*  compare what's on disk to data in ver     */
-            /*  cmd and display if they don't agree       */
-            /*  ----------------------------------------  */
-            if (!memcmp(data, buf, datalen) == 0) {
-                printf("*** 'data' discompares; no writes will be performed ***\n");
-                if(debug) hexDump("(debug) hexDump of data in ver", data, datalen, skip);
-                hexDump("hexDump of data in named file", buf, datalen, skip);
-                ok_to_write = 0;
-            } else {
+            datalen = do_data(&data, p);
+            if(debug) printf("(debug) datalen in hex = %zx\n", datalen);
+            if (compileto != NULL) {
+                if (*fn == '\0') {
+                    printf("'ver' before any 'name' card; exiting\n");
+                    exit(4);
+                }
+                plan_ver(plan_target(fn, -1, 1), skip, data.base, datalen);
+                continue;
+            }
             /*  ----------------------------------------  */
-            /*  else, they agree; display if debug        */
+            /*  read datalen bytes at the offset and      */
+            /*  compare them with data (io_flush does     */
+            /*  it, now or with the rest of the batch)    */
             /*  ----------------------------------------  */
-                if(debug) hexDump("(debug) hexDump of data in ver", data, datalen, skip);
-	    }
+            if (zlib_for(fd)) ver_lib(skip, data.base, datalen);
+            else {
+                io_queue(IO_READ, fd, skip, data.base, datalen, plan ? plan_target(fn, fd, 0) : NULL);
+                if (!uring) io_flush();
+            }
 
             continue;
 
-        } else if (strcmp(p, "rep") == 0) {
+        } else if (verb == V_REP) {
             /*  ----------------------------------------  */
             /*  we have a 'rep' control card              */
             /*  ----------------------------------------  */
             /*  get next token (offset)                   */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("missing offset; exiting\n");
                 exit(4);
             }
             /*  ----------------------------------------  */
             /*  convert offset                            */
             /*  ----------------------------------------  */
-            skip = do_offset(p);
-            if(debug) printf("(debug) offset in hex: %x\n", skip);
+            skip = do_address(p, fd);
+            if(debug) printf("(debug) offset in hex: %" PRIx64 "\n", skip);
 
             /*  ----------------------------------------  */
             /*  get next token (data)                     */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("missing offset; exiting\n");
                 exit(4);
             }
             /*  ----------------------------------------  */
             /*  convert data                              */
             /*  ----------------------------------------  */
-            datalen = do_data(data, p);
+            datalen = do_data(&data, p);
             if(debug) {
-                printf("(debug) datalen in hex = %x\n", datalen);
-                hexDump("(debug) hexDump of data: ", data, datalen, skip);
+                printf("(debug) datalen in hex = %zx\n", datalen);
+                hexDump("(debug) hexDump of data: ", data.base, datalen, skip);
             }
             /*  ----------------------------------------  */
-            /*  position the file to the offset           */
+            /*  in plan mode, just remember it            */
             /*  ----------------------------------------  */
-            if (skip != 0) lseek64(fd, skip, SEEK_SET);
+            if (compileto != NULL) {
+                if (*fn == '\0') {
+                    printf("'rep' before any 'name' card; exiting\n");
+                    exit(4);
+                }
+                plan_rep(plan_target(fn, -1, 1), skip, data.base, datalen);
+                continue;
+            }
+            if (plan) {
+                plan_rep(plan_target(fn, fd, 1), skip, data.base, datalen);
+                printf("write planned\n");
+                continue;
+            }
             /*  ----------------------------------------  */
-            /*  write the data to the file                */
+            /*  write the data to the file at the offset  */
             /*  ----------------------------------------  */
             if(ok_to_write) printf("write will be done\n");
             else            printf("write will NOT be done\n");
-            if(ok_to_write) write(fd, data, datalen);
+            if (ok_to_write && zlib_for(fd)) rep_lib(fd, skip, data.base, datalen);
+            else if (ok_to_write) {
+                io_queue(IO_WRITE, fd, skip, data.base, datalen, NULL);
+                if (!uring && !journal) io_flush();  /*  a journal is synced once per batch  */
+            }
 
             continue;
 
-        } else if (strcmp(p, "name") == 0) {
+        } else if (verb == V_NAME) {
             /*  ----------------------------------------  */
             /*  we have a 'name' control card             */
             /*  ----------------------------------------  */
             /*  get next token (file name)                */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("<fn> missing; exiting.\n");
                 exit(4);
             } else {
-                if ((strcmp(fn, "")) != 0) {
-                    if(debug) printf("(debug) closing prior <fn>, %s\n", fn);
-                    close(fd);
+                // don't tr fn as linux is case sensitive and fn may be mixed case
+                if(debug) printf("(debug) switching to <fn>, %s\n", p);
+                if (compileto != NULL) {  /*  the file may not even be here; it's opened by --apply  */
+                    fn = plan_target(handle_resolve(p), -1, 1)->fn;
+                    continue;
                 }
-                strcpy(fn, p); // don't tr fn as linux is case sensitive and fn may be mixed case
-                if(debug) printf("(debug) opening new <fn>, %s\n", fn);
-                if ((fd = open(fn, O_RDWR | O_LARGEFILE)) == -1) {
+                if ((h = handle_open(p, 1)) == NULL) {
                     errsv = errno;
-                    fprintf(stderr, "The input file '%s' could not be opened\n", fn);
+                    fprintf(stderr, "The input file '%s' could not be opened\n", p);
                     fprintf(stderr, " errno is '%i - %s'\n", errsv, strerror(errsv));
                     exit(4);
                 }
-                if(debug) printf("(debug) new <fn>, %s, opened\n", fn);
+                fd = h->fd;
+                fn = h->fn;
+                if (zlib_for(fd)) zlib_open(fn, 1);
+                if(debug) printf("(debug) <fn>, %s, is fd %i\n", fn, fd);
             }
             continue;
 
-        } else if (strcmp(p, "dump") == 0) {
+        } else if (verb == V_DUMP) {
             /*  ----------------------------------------  */
             /*  we have a dump control card               */
             /*  ----------------------------------------  */
             /*  get next token (file name)                */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if ((p = card_tok(&card)) == NULL) {
                 printf("<fn> missing; exiting.\n");
                 exit(4);
             } else {
-                if (strcmp(fn, "")) {
-                    if(debug) printf("(debug) closing prior <fn>, %s\n", fn);
-                    close(fd);
-                }
-                strcpy(fn, p); // don't tr fn as linux is case sensitive and fn may be mixed case
-                if(debug) printf("(debug) opening new <fn>, %s\n", fn);
-                if ((fd = open(fn, O_RDONLY | O_LARGEFILE)) == -1) {
+                if(debug) printf("(debug) switching to <fn>, %s\n", p);
+                if ((h = handle_open(p, 0)) == NULL) {
                     perror("open");
-                    printf("(filename=%s)\n", fn);
+                    printf("(filename=%s)\n", p);
                     exit(4);
                 }
-                if(debug) printf("(debug) new <fn>, %s, opened\n", fn);
+                fd = h->fd;
+                fn = h->fn;
+                if (zlib_for(fd)) zlib_open(fn, 0);
+                if(debug) printf("(debug) <fn>, %s, is fd %i\n", fn, fd);
             }
 
             /*  ----------------------------------------  */
             /*  get next token (length)                   */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            /*  (anything that isn't hex starts a comment) */
+            /*  ----------------------------------------  */
+            if ((p = card_tok(&card)) == NULL || !try_offset(p, &len)) {
                 len = LENTODUMP;
+                p = NULL;
                 if(debug) printf("(debug) length missing; default to %x hex (%i decimal)\n", LENTODUMP, LENTODUMP);
             } else {
-                len = do_offset(p); //  get length
-                if(debug) printf("(debug) length is specified and equals %x hex (%i decimal)\n", len, len );
-		//  todo: validate length...
+                if(debug) printf("(debug) length is specified and equals %" PRIx64 " hex (%" PRIu64 " decimal)\n", len, len);
             }
             /*  ----------------------------------------  */
             /*  get next token (skip)                     */
             /*  ----------------------------------------  */
-            if ((p = strtok(NULL, " \t\n")) == NULL) {
+            if (p == NULL || (p = card_tok(&card)) == NULL || !try_address(p, fd, &skip)) {
                 skip = SKIP;
                 if(debug) printf("(debug) skip missing; default to %x hex (%i decimal)\n", SKIP, SKIP);
             } else {
-                skip = do_offset(p); //  get skip
-                if(debug) printf("(debug) skip is specified and equals %x hex (%i decimal)\n", skip, skip);
+                if(debug) printf("(debug) skip is specified and equals %" PRIx64 " hex (%" PRIu64 " decimal)\n", skip, skip);
+            }
+
+            /*  ----------------------------------------  */
+            /*  stream the range through hexDump (unless  */
+            /*  it has to wait for planned reps)          */
+            /*  ----------------------------------------  */
+            if (plan && plan_target(fn, fd, 0) != NULL) {
+                plan_dump(fn, len, skip);
+                printf("dump deferred until the planned writes are done\n");
+                continue;
+            }
+            if (zlib_for(fd) && !squeeze && dump_short(fd, len, skip)) {
+                if (szap_dump(zlib, NULL, len, skip) != SZAP_OK) printf("pread: %s\n", strerror(szap_errno(zlib)));
+                continue;
+            }
+            dump_range(fd, len, skip);
+
+            continue;
+
+        } else if (verb == V_FIND) {
+            /*  ----------------------------------------  */
+            /*  we have a 'find' control card             */
+            /*  ----------------------------------------  */
+            /*  get next token (pattern)                  */
+            /*  ----------------------------------------  */
+            if (fd == -1) {
+                printf("'find' needs a 'name' or 'dump' card before it; exiting\n");
+                exit(4);
+            }
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing data; exiting\n");
+                exit(4);
+            }
+            if ((datalen = do_data(&data, p)) == 0) {
+                printf("'find' needs at least one byte of data; exiting\n");
+                exit(4);
+            }
+            /*  ----------------------------------------  */
+            /*  get the optional start and length         */
+            /*  (anything that isn't hex starts a comment) */
+            /*  ----------------------------------------  */
+            start = 0;
+            len = UINT64_MAX;  /* to the end of the file */
+            if ((p = card_tok(&card)) != NULL && try_address(p, fd, &start)
+                && (p = card_tok(&card)) != NULL) try_offset(p, &len);
+            if(debug) printf("(debug) find start %" PRIx64 ", length %" PRIx64 "\n", start, len);
+
+            find_range(fd, plan ? plan_target(fn, fd, 0) : NULL, (unsigned char *) data.base, datalen, start, len);
+
+            continue;
+
+        } else if (verb == V_SUM) {
+            /*  ----------------------------------------  */
+            /*  we have a 'sum' control card              */
+            /*  ----------------------------------------  */
+            /*  get the next two tokens (offset, length)  */
+            /*  ----------------------------------------  */
+            if (fd == -1) {
+                printf("'sum' needs a 'name' or 'dump' card before it; exiting\n");
+                exit(4);
+            }
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            skip = do_address(p, fd);
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing length; exiting\n");
+                exit(4);
+            }
+            len = do_offset(p);
+            /*  ----------------------------------------  */
+            /*  then, optionally, the algorithm and the   */
+            /*  value expected (anything else starts a    */
+            /*  comment)                                  */
+            /*  ----------------------------------------  */
+            algo = SUM_CRC32C;
+            haveexp = 0;
+            if ((p = card_tok(&card)) != NULL) {
+                if (strcasecmp(p, "crc32c") == 0) p = card_tok(&card);
+                else if (strcasecmp(p, "fast64") == 0) {
+                    algo = SUM_FAST64;
+                    p = card_tok(&card);
+                }
+                if (p != NULL && try_offset(p, &expected)) haveexp = 1;
+            }
+            if(debug) printf("(debug) sum %" PRIx64 " for %" PRIx64 ", algorithm %i, expected %s\n",
+                             skip, len, algo, haveexp ? "given" : "not given");
+
+            sum_range(fd, plan ? plan_target(fn, fd, 0) : NULL, algo, skip, len, haveexp, expected);
+
+            continue;
+
+        } else if (verb == V_EXTRACT) {
+            /*  ----------------------------------------  */
+            /*  we have an 'extract' control card         */
+            /*  ----------------------------------------  */
+            /*  get the next three tokens (offset,        */
+            /*  length, file name)                        */
+            /*  ----------------------------------------  */
+            if (fd == -1) {
+                printf("'extract' needs a 'name' or 'dump' card before it; exiting\n");
+                exit(4);
+            }
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            skip = do_address(p, fd);
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing length; exiting\n");
+                exit(4);
+            }
+            len = do_offset(p);
+            if ((p = card_tok(&card)) == NULL) {
+                printf("<outfile> missing; exiting.\n");
+                exit(4);
+            }
+            if(debug) printf("(debug) extract %" PRIx64 " for %" PRIx64 " to %s\n", skip, len, p);
+
+            extract_range(fd, plan ? plan_target(fn, fd, 0) : NULL, skip, len, p);
+
+            continue;
+
+        } else if (verb == V_INJECT) {
+            /*  ----------------------------------------  */
+            /*  we have an 'inject' control card          */
+            /*  ----------------------------------------  */
+            /*  get the next two tokens (file name,       */
+            /*  offset)                                   */
+            /*  ----------------------------------------  */
+            if (*fn == '\0') {
+                printf("'inject' before any 'name' card; exiting\n");
+                exit(4);
+            }
+            if ((p = card_tok(&card)) == NULL) {
+                printf("<infile> missing; exiting.\n");
+                exit(4);
+            }
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            skip = do_address(q, fd);
+            if(debug) printf("(debug) inject %s at %" PRIx64 "\n", p, skip);
+            if (compileto == NULL && (h = handle_open(fn, 1)) == NULL) {  /*  (a 'dump' may have opened it read only)  */
+                errsv = errno;
+                fprintf(stderr, "The input file '%s' could not be opened\n", fn);
+                fprintf(stderr, " errno is '%i - %s'\n", errsv, strerror(errsv));
+                exit(4);
+            }
+
+            inject_file(fd, fn, p, skip, &data, plan || compileto != NULL);
+
+            continue;
+
+        } else if (verb == V_ZERO || verb == V_FILL) {
+            /*  ----------------------------------------  */
+            /*  we have a 'zero' or 'fill' control card   */
+            /*  ----------------------------------------  */
+            /*  get the next two tokens (offset, length)  */
+            /*  and, for 'fill', the pattern              */
+            /*  ----------------------------------------  */
+            if (*fn == '\0') {
+                printf("'%s' before any 'name' card; exiting\n", p);
+                exit(4);
+            }
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            skip = do_address(q, fd);
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing length; exiting\n");
+                exit(4);
+            }
+            len = do_offset(q);
+            if (verb == V_FILL) {
+                if ((q = card_tok(&card)) == NULL) {
+                    printf("missing pattern; exiting\n");
+                    exit(4);
+                }
+                datalen = do_data(&data, q);
+            } else {
+                memset(arena_reserve(&data, 1), 0, 1);
+                datalen = 1;
+            }
+            if (datalen == 0) {
+                printf("'fill' needs a pattern of at least one byte; exiting\n");
+                exit(4);
+            }
+            if(debug) printf("(debug) %s %" PRIx64 " for %" PRIx64 " with %zx byte(s)\n", p, skip, len, datalen);
+            if (compileto == NULL && (h = handle_open(fn, 1)) == NULL) {
+                errsv = errno;
+                fprintf(stderr, "The input file '%s' could not be opened\n", fn);
+                fprintf(stderr, " errno is '%i - %s'\n", errsv, strerror(errsv));
+                exit(4);
+            }
+
+            fill_range(fd, fn, skip, len, data.base, datalen, plan || compileto != NULL);
+
+            continue;
+
+        } else if (verb == V_COPY) {
+            /*  ----------------------------------------  */
+            /*  we have a 'copy' control card             */
+            /*  ----------------------------------------  */
+            /*  get the next three tokens (from, to,      */
+            /*  length)                                   */
+            /*  ----------------------------------------  */
+            if (compileto != NULL) {
+                printf("'copy' can't be compiled (it reads the file); exiting\n");
+                exit(4);
+            }
+            if (*fn == '\0') {
+                printf("'copy' before any 'name' card; exiting\n");
+                exit(4);
+            }
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            start = do_address(q, fd);
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            skip = do_address(q, fd);
+            if ((q = card_tok(&card)) == NULL) {
+                printf("missing length; exiting\n");
+                exit(4);
             }
+            len = do_offset(q);
+            if(debug) printf("(debug) copy %" PRIx64 " to %" PRIx64 " for %" PRIx64 "\n", start, skip, len);
+            if ((h = handle_open(fn, 1)) == NULL) {
+                errsv = errno;
+                fprintf(stderr, "The input file '%s' could not be opened\n", fn);
+                fprintf(stderr, " errno is '%i - %s'\n", errsv, strerror(errsv));
+                exit(4);
+            }
+
+            copy_within(fd, fn, start, skip, len, plan);
+
+            continue;
+
+        } else if (verb == V_DIFF) {
+            /*  ----------------------------------------  */
+            /*  we have a 'diff' control card             */
+            /*  ----------------------------------------  */
+            /*  get the next two tokens (old, new file)   */
+            /*  ----------------------------------------  */
+            if ((p = card_tok(&card)) == NULL || (q = card_tok(&card)) == NULL) {
+                printf("diff <fn> <fn> needs both; exiting.\n");
+                exit(4);
+            }
+            if ((h = handle_open(p, 0)) == NULL) {
+                perror("open");
+                printf("(filename=%s)\n", p);
+                exit(4);
+            }
+            fda = h->fd;
+            fna = h->fn;
+            if ((h = handle_open(q, 0)) == NULL) {
+                perror("open");
+                printf("(filename=%s)\n", q);
+                exit(4);
+            }
+            /*  ----------------------------------------  */
+            /*  the optional offset and length            */
+            /*  (anything that isn't hex starts a comment) */
+            /*  ----------------------------------------  */
+            start = 0;
+            len = UINT64_MAX;  /* to the end of the shorter file */
+            if ((p = card_tok(&card)) != NULL && try_offset(p, &start)
+                && (p = card_tok(&card)) != NULL) try_offset(p, &len);
+
+            diff_files(fna, fda, h->fn, h->fd, start, len);
 
-            /*  -------  */
-            /*  lseek64  */
-            /*  -------  */
-            if (skip != 0) lseek64(fd, skip, SEEK_SET);
+            continue;
 
-	    /*  ----  */
-            /*  read  */
-	    /*  ----  */
+        } else if (verb == V_UNDO) {
+            /*  ----------------------------------------  */
+            /*  we have an 'undo' control card            */
+            /*  ----------------------------------------  */
+            if ((p = card_tok(&card)) == NULL) {
+                printf("<journal> missing; exiting.\n");
+                exit(4);
+            }
+            journal_undo(p);
 
-	    read(fd, data, len);
+            continue;
 
-            /*  ---------  */
-            /*  then dump  */
-            /*  ---------  */
-	    hexDump("dump", data, len, skip);
+        } else if (verb == V_ALIAS) {
+            /*  ----------------------------------------  */
+            /*  we have an 'alias' control card           */
+            /*  ----------------------------------------  */
+            /*  get the next two tokens (alias, file)     */
+            /*  ----------------------------------------  */
+            if ((p = card_tok(&card)) == NULL || (q = card_tok(&card)) == NULL) {
+                printf("alias <alias> <fn> needs both; exiting.\n");
+                exit(4);
+            }
+            handle_alias(p, q);
+            if(debug) printf("(debug) '%s' now names %s\n", p, q);
 
             continue;
 
-        } else if (strcmp(p, "reset") == 0) {
+        } else if (verb == V_RESET) {
             /*  ----------------------------------------  */
             /*  we have a 'reset' control card            */
             /*  ----------------------------------------  */
@@ -436,13 +1397,18 @@ char data[DESTSIZE];
             printf("*** unknown statement (the above assumed to be a comment) ***\n");
         }
 
-    } // end of 'while (fgets(buf,'
+    } // end of 'while (card_read(&card))'
+    if (stats && cardt0) stat_card(verb, cardt0);
 
+    io_flush();
     printf("*** end of control cards ***\n");
-    if (!strcmp(fn, "")) {
-        if(debug) printf("(debug) closing %s\n", fn);
-        close(fd);
-    }
+    if (compileto != NULL) patch_write(compileto);
+    else if (plan) plan_commit();
+    gz_commitall();
+    journal_close();
+    if (stats) stat_report();
+    szap_free(zlib);
+    handle_closeall();
     exit(EXIT_SUCCESS);
 } // end of 'main()'
 
@@ -453,17 +1419,1040 @@ char data[DESTSIZE];
 /*                                                       */
 /*  ---------------------------------------------------  */
 /*  ---------------------------------------------------  */
-uint do_offset(char *p) {
-uint ui;
-int  ret;
-    if ((ret = sscanf(p, "%x", &ui)) != 1) {
-        perror("sscanf offset");
-        ret = EOF;
-    }
-    if (ret == EOF) ui = 0;
+/*  Offsets are 64 bits wide all the way through; anything past 4 GiB  */
+/*  is addressable.  A required offset that isn't hex ends the run.    */
+uint64_t do_offset(char *p) {
+uint64_t ui;
+    if (!try_offset(p, &ui)) {
+        printf("offset or length '%s' is not hex; exiting\n", p);
+        exit(4);
+    }
     return ui;
 }
 
+/*  the same, for optional fields: returns 0 (and leaves *v alone) if 'p' isn't hex  */
+int try_offset(char *p, uint64_t *v) {
+    return szap_parse_offset(p, v) == SZAP_OK;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  positioned I/O that doesn't give up on a short read or write    */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  Both return the number of bytes moved (less than 'len' only at end  */
+/*  of file), or -1 with errno set.  No lseek is needed, or done.  A    */
+/*  file opened with O_DIRECT (--direct) goes by way of dio_pread and   */
+/*  dio_pwrite, which take care of the sector alignment it needs.       */
+static ssize_t pread_all(int fd, void *buf, size_t len, off64_t off) {
+size_t  done = 0;
+ssize_t n;
+uint64_t t0 = 0;
+    while (done < len) {
+        if (stats) t0 = stat_now();
+        n = pread64(fd, (char *) buf + done, len - done, off + done);
+        if (stats) stat_io(ST_READ, t0, n, len - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static ssize_t pwrite_all(int fd, const void *buf, size_t len, off64_t off) {
+size_t  done = 0;
+ssize_t n;
+uint64_t t0 = 0;
+    while (done < len) {
+        if (stats) t0 = stat_now();
+        n = pwrite64(fd, (const char *) buf + done, len - done, off + done);
+        if (stats) stat_io(ST_WRITE, t0, n, len - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  --direct: O_DIRECT opens, and sector aligned I/O to go with it   */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The sector size of each O_DIRECT descriptor is kept (by fd) in    */
+/*  'diobs'; 0 means the descriptor goes through the page cache.  I/O */
+/*  that isn't already aligned is staged in one of two pooled,        */
+/*  aligned buffers that only ever grow: a read reads the covering    */
+/*  sectors and copies out the part wanted; a write reads the first   */
+/*  and last covering sectors (if they are partly outside the data),  */
+/*  lays the data over them and writes the lot.  --readback reads the */
+/*  sectors again, into the second buffer, and compares.              */
+static unsigned *diobs = NULL;
+static int      ndiobs = 0;
+static __thread char   *diopool[2] = { NULL, NULL };  /*  per thread: 'find' reads in parallel  */
+static __thread size_t diopoolcap[2] = { 0, 0 };
+
+unsigned dio_blocksize(int fd) {
+    return (fd >= 0 && fd < ndiobs) ? diobs[fd] : 0;
+}
+
+static void dio_set(int fd, unsigned bs) {
+int n;
+    if (fd >= ndiobs) {
+        if (bs == 0) return;
+        n = fd + 16;
+        if ((diobs = realloc(diobs, n * sizeof(*diobs))) == NULL) {
+            printf("unable to allocate the O_DIRECT table; exiting\n");
+            exit(4);
+        }
+        memset(diobs + ndiobs, 0, (n - ndiobs) * sizeof(*diobs));
+        ndiobs = n;
+    }
+    diobs[fd] = bs;
+}
+
+/*  the logical sector size of a device, or a safe alignment for a file  */
+static unsigned dio_probe(int fd) {
+struct stat st;
+int ss;
+    if (fstat(fd, &st) == -1) return 4096;
+    if (S_ISBLK(st.st_mode) && ioctl(fd, BLKSSZGET, &ss) == 0 && ss >= 512) return ss;
+    if (st.st_blksize >= 512 && st.st_blksize <= 65536 && (st.st_blksize & (st.st_blksize - 1)) == 0)
+        return st.st_blksize;
+    return 4096;
+}
+
+/*  pooled buffer 'slot', at least 'n' bytes, aligned for O_DIRECT  */
+static char *dio_buf(int slot, size_t n) {
+    if (n > diopoolcap[slot]) {
+        free(diopool[slot]);
+        if (posix_memalign((void **) &diopool[slot], 4096, n) != 0) {
+            printf("unable to allocate a %zu byte O_DIRECT buffer; exiting\n", n);
+            exit(4);
+        }
+        diopoolcap[slot] = n;
+    }
+    return diopool[slot];
+}
+
+#define DIO_ALIGNED(p, n, o, bs) ((((uintptr_t) (p) | (n) | (o)) & ((bs) - 1)) == 0 && ((uintptr_t) (p) & 4095) == 0)
+
+static ssize_t dio_pread(int fd, unsigned bs, void *buf, size_t len, off64_t off) {
+off64_t start = off & ~((off64_t) bs - 1);
+off64_t end = (off + len + bs - 1) & ~((off64_t) bs - 1);
+ssize_t got;
+char    *b;
+    if (DIO_ALIGNED(buf, len, off, bs)) return pread_all(fd, buf, len, off);
+    b = dio_buf(0, end - start);
+    if ((got = pread_all(fd, b, end - start, start)) == -1) return -1;
+    if (got <= off - start) return 0;
+    got -= off - start;
+    if ((size_t) got > len) got = len;
+    memcpy(buf, b + (off - start), got);
+    return got;
+}
+
+static ssize_t dio_pwrite(int fd, unsigned bs, const void *buf, size_t len, off64_t off) {
+off64_t start = off & ~((off64_t) bs - 1);
+off64_t end = (off + len + bs - 1) & ~((off64_t) bs - 1);
+size_t  n = end - start;
+struct stat st;
+const char *p = buf;
+char    *b;
+ssize_t w;
+int     grows = 0;
+
+    if (len == 0) return 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && end > st.st_size && (off64_t) (off + len) < end)
+        grows = 1;  /*  the padding would make the file longer; trimmed below  */
+    if (!DIO_ALIGNED(buf, len, off, bs)) {
+        /*  --------------------------------------------  */
+        /*  read-modify-write of the covering sectors     */
+        /*  --------------------------------------------  */
+        b = dio_buf(0, n);
+        if (off != start) {
+            memset(b, 0, bs);
+            if (pread_all(fd, b, bs, start) == -1) return -1;
+        }
+        if ((off64_t) (off + len) != end && !(off != start && n == bs)) {
+            memset(b + n - bs, 0, bs);
+            if (pread_all(fd, b + n - bs, bs, end - bs) == -1) return -1;
+        }
+        memcpy(b + (off - start), buf, len);
+        p = b;
+        if(debug) printf("(debug) O_DIRECT read-modify-write of %zu byte(s) at %" PRIx64 "\n", n, (uint64_t) start);
+    } else n = len;
+    if ((w = pwrite_all(fd, p, n, start)) != (ssize_t) n) {
+        if (w >= 0) errno = EIO;  /* short */
+        return -1;
+    }
+    if (grows && ftruncate(fd, (off64_t) (off + len) > st.st_size ? (off64_t) (off + len) : st.st_size) == -1) return -1;
+    if (readback) {
+        b = dio_buf(1, n);
+        if (pread_all(fd, b, n, start) < (off - start) + (ssize_t) len
+            || memcmp(b + (off - start), buf, len) != 0) {
+            printf("*** readback of the write at offset %" PRIx64 " does not match ***\n", (uint64_t) off);
+            errno = EIO;
+            return -1;
+        }
+    }
+    return len;
+}
+
+/*  the bytes of the file itself (a .gz image's compressed bytes)  */
+static ssize_t pread_raw(int fd, void *buf, size_t len, off64_t off) {
+unsigned bs = dio_blocksize(fd);
+    if (bs) return dio_pread(fd, bs, buf, len, off);
+    return pread_all(fd, buf, len, off);
+}
+
+ssize_t pread_full(int fd, void *buf, size_t len, off64_t off) {
+gzimage_t *g = gz_image(fd);
+    if (g) return gz_pread(g, buf, len, off);
+    return pread_raw(fd, buf, len, off);
+}
+
+ssize_t pwrite_full(int fd, const void *buf, size_t len, off64_t off) {
+unsigned bs = dio_blocksize(fd);
+gzimage_t *g = gz_image(fd);
+ssize_t  n;
+    if (g) n = gz_pwrite(g, buf, len, off);
+    else   n = bs ? dio_pwrite(fd, bs, buf, len, off) : pwrite_all(fd, buf, len, off);
+    if (n > 0) cache_write(fd, buf, n, off);  /*  write through  */
+    return n;
+}
+
+/*  open(), with O_DIRECT added under --direct (where the file allows it)  */
+int zopen(char *fn, int flags) {
+int fd;
+    if (!direct) return open(fn, flags);
+    if ((fd = open(fn, flags | O_DIRECT)) == -1 && errno == EINVAL) {
+        printf("**  O_DIRECT is not supported for '%s'; it will go through the page cache  **\n", fn);
+        return open(fn, flags);
+    }
+    if (fd != -1) {
+        dio_set(fd, dio_probe(fd));
+        if(debug) printf("(debug) %s opened O_DIRECT, %u byte sectors\n", fn, dio_blocksize(fd));
+    }
+    return fd;
+}
+
+void zclose(int fd) {
+    dio_set(fd, 0);
+    close(fd);
+}
+
+/*  fdatasync(), timed under --stats  */
+int zsync(int fd) {
+uint64_t t0 = stats ? stat_now() : 0;
+int      r = fdatasync(fd);
+    if (stats) stat_io(ST_SYNC, t0, r, 0);
+    return r;
+}
+
+/*  the vectored version: all of 'iov' lands contiguously at 'off'  */
+ssize_t pwritev_full(int fd, const struct iovec *iov, int cnt, off64_t off) {
+struct iovec *copy = NULL, *v;
+size_t  done = 0, left = 0;
+ssize_t n;
+char    *flat;
+int     k;
+uint64_t t0 = 0;
+    if (dio_blocksize(fd) || gz_image(fd)) {
+        /*  O_DIRECT (or a .gz image): gather it all into one buffer for one write  */
+        for (k = 0; k < cnt; k++) done += iov[k].iov_len;
+        if ((flat = malloc(done ? done : 1)) == NULL) return -1;
+        for (k = 0, done = 0; k < cnt; k++) {
+            memcpy(flat + done, iov[k].iov_base, iov[k].iov_len);
+            done += iov[k].iov_len;
+        }
+        n = pwrite_full(fd, flat, done, off);
+        free(flat);
+        return n;
+    }
+    if (stats) for (k = 0; k < cnt; k++) left += iov[k].iov_len;
+    while (cnt > 0) {
+        if (stats) t0 = stat_now();
+        n = pwritev64(fd, iov, cnt, off + done);
+        if (stats) {
+            stat_io(ST_WRITEV, t0, n, left);
+            if (n > 0) left -= n;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            free(copy);
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+        /*  a short write: step past the iovecs that made it  */
+        while (cnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            /*  the rest, trimmed, in a copy: the caller's iovecs are left as they were  */
+            if (copy == NULL) {
+                if ((copy = malloc(cnt * sizeof(*copy))) == NULL) return -1;
+                memcpy(copy, iov, cnt * sizeof(*copy));
+                iov = copy;
+            }
+            v = (struct iovec *) iov;  /*  (somewhere in the copy)  */
+            v->iov_base = (char *) v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    free(copy);
+    return done;
+}
+
+/*  ----------------------------------------------------------------  */
+/*  ----------------------------------------------------------------  */
+/*  find the next run of data, at or after 'pos', in a sparse file   */
+/*  ----------------------------------------------------------------  */
+/*  ----------------------------------------------------------------  */
+/*  Sets [*dstart, *dend) to the next extent that holds data, clipped to  */
+/*  'end', and returns 1; returns 0 if there's nothing but hole from      */
+/*  'pos' to 'end'.  Anything that can't answer SEEK_DATA/SEEK_HOLE (a    */
+/*  device, an old filesystem) is reported as all data.                   */
+int next_data(int fd, off64_t pos, off64_t end, off64_t *dstart, off64_t *dend) {
+off64_t d, h;
+    if (pos >= end) return 0;
+    if (gz_image(fd)) {  /*  (a .gz image's holes were squeezed out by gzip)  */
+        *dstart = pos;
+        *dend = end;
+        return 1;
+    }
+    if ((d = lseek64(fd, pos, SEEK_DATA)) == -1) {
+        if (errno == ENXIO) return 0;  /* only hole from here to end of file */
+        *dstart = pos;
+        *dend = end;
+        return 1;
+    }
+    if (d >= end) return 0;
+    if ((h = lseek64(fd, d, SEEK_HOLE)) == -1 || h > end) h = end;
+    *dstart = d;
+    *dend = h;
+    return 1;
+}
+
+/*  the size of a file or a device, or -1 if it can't be told  */
+off64_t target_size(int fd) {
+struct stat st;
+uint64_t    sz;
+gzimage_t   *g = gz_image(fd);
+    if (g) return gz_size(g);
+    if (fstat(fd, &st) == -1) return -1;
+    if (S_ISREG(st.st_mode)) return st.st_size;
+    if (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &sz) == 0) return sz;
+    return -1;  /*  a character device or a pipe: read until it stops  */
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  .gz images: zapped as the image inside, through a seek index     */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  A file whose name ends in '.gz' and that starts with gzip's magic  */
+/*  is read as the image it holds.  The first open inflates it once,   */
+/*  end to end, and notes an access point every GZSPAN bytes of the    */
+/*  image: where a deflate block starts in the .gz file (to the bit),  */
+/*  the 32 KB of image before it (deflate's window, kept deflated)     */
+/*  and the CRC of its gzip member so far.  The start of a member is   */
+/*  an access point that needs no window.  The points are saved in     */
+/*  '<image>.szi', with the size and mtime of the .gz file they go     */
+/*  with, so later runs just load them.  A read inflates from the last */
+/*  point at or before it, so it costs at most GZSPAN of inflating     */
+/*  however far in it is, and the stream is kept where it stopped, so  */
+/*  a read that carries on from there costs no more than its length.   */
+/*  Writes are held, as --plan holds reps, and laid over what is read. */
+/*  After the last card the .gz file is rewritten from the last point  */
+/*  before the first byte written: up to there it is copied as it is   */
+/*  (by the kernel), the member it is in is ended there (an empty      */
+/*  final stored block and the member's trailer), and the rest of the  */
+/*  image goes out as new members of GZSPAN bytes, each an access      */
+/*  point of its own.  The new file is renamed over the old one.       */
+typedef struct {
+    uint64_t out;       /*  where it is in the image                          */
+    uint64_t in;        /*  where its block starts in the .gz file (the byte  */
+    uint8_t  bits;      /*  after, if it starts 'bits' bits before that)      */
+    uint8_t  pad[3];
+    uint32_t crc;       /*  CRC-32 of its member's data up to here            */
+    uint64_t mstart;    /*  where its member's data starts in the image       */
+    uint64_t winoff;    /*  its window, deflated, in 'wins'                   */
+    uint64_t winlen;    /*  (0: a member starts here; no window is wanted)    */
+} gzpoint_t;
+
+typedef struct {        /*  an inflate part way through the image  */
+    z_stream      strm;
+    uint64_t      inpos;  /*  the next byte of the .gz file to read      */
+    uint64_t      out;    /*  how far into the image it has got          */
+    int           raw;    /*  inflating bare deflate (it began at a window)  */
+    unsigned      skip;   /*  member trailer bytes still to pass over    */
+    unsigned char in[GZINCHUNK];
+} gzcur_t;
+
+struct gzimage {
+    char            *fn;
+    int             fd;
+    gzpoint_t       *pts;
+    size_t          npts, ptcap;
+    char            *wins;    /*  the points' windows, deflated             */
+    size_t          winlen, wincap;
+    uint64_t        size;     /*  the image, with what has been written     */
+    uint64_t        have;     /*  how much of that the .gz file holds       */
+    uint64_t        lo;       /*  the first byte written (or cut off)       */
+    int             dirty;
+    plantarget_t    over;     /*  what has been written, as planned reps    */
+    gzcur_t         *cur;     /*  where the last read stopped, or NULL      */
+    pthread_mutex_t mu;       /*  ('find', 'sum' and 'diff' read in parallel)  */
+};
+
+typedef struct {        /*  '<image>.szi': this, the points, then the windows  */
+    char     magic[8];
+    uint64_t csize;     /*  the .gz file it goes with  */
+    int64_t  mtime, mtimens;
+    uint64_t size;
+    uint64_t npts, winlen;
+} gzhdr_t;
+
+#define GZI_MAGIC "SZAPGZI1"
+
+static gzimage_t **gztab = NULL;  /*  by descriptor, like 'diobs'  */
+static int       ngztab = 0;
+
+gzimage_t *gz_image(int fd) {
+    return (fd >= 0 && fd < ngztab) ? gztab[fd] : NULL;
+}
+
+/*  1 if 'fn' is named as a compressed image  */
+int gz_named(char *fn) {
+size_t n = strlen(fn);
+    return (n > 3 && strcasecmp(fn + n - 3, ".gz") == 0) || (n > 4 && strcasecmp(fn + n - 4, ".zst") == 0);
+}
+
+uint64_t gz_size(gzimage_t *g) {
+    return g->size;
+}
+
+/*  'fn' with 'ext' on the end  */
+static char *gz_path(char *fn, char *ext) {
+char *p;
+    if ((p = malloc(strlen(fn) + strlen(ext) + 1)) == NULL) {
+        printf("unable to allocate a file name; exiting\n");
+        exit(4);
+    }
+    return strcat(strcpy(p, fn), ext);
+}
+
+/*  note an access point; 'win' (NULL at the start of a member) is the circular window, oldest byte at 'pos'  */
+static void gz_addpoint(gzimage_t *g, uint64_t out, uint64_t in, int bits, uint64_t mstart, uint32_t crc,
+                        unsigned char *win, size_t pos) {
+gzpoint_t     *p;
+unsigned char flat[GZWINDOW];
+uLongf        n;
+    if (g->npts == g->ptcap) {
+        g->ptcap = g->ptcap ? 2 * g->ptcap : 256;
+        if ((g->pts = realloc(g->pts, g->ptcap * sizeof(*g->pts))) == NULL) {
+            printf("unable to allocate the .gz index; exiting\n");
+            exit(4);
+        }
+    }
+    p = &g->pts[g->npts++];
+    memset(p, 0, sizeof(*p));
+    p->out = out;
+    p->in = in;
+    p->bits = bits;
+    p->mstart = mstart;
+    p->crc = crc;
+    if (win == NULL) return;
+    memcpy(flat, win + pos, GZWINDOW - pos);
+    memcpy(flat + GZWINDOW - pos, win, pos);
+    n = compressBound(GZWINDOW);
+    if (g->winlen + n > g->wincap) {
+        g->wincap = (2 * g->wincap > g->winlen + n) ? 2 * g->wincap : g->winlen + n + 1024 * 1024;
+        if ((g->wins = realloc(g->wins, g->wincap)) == NULL) {
+            printf("unable to allocate the .gz index; exiting\n");
+            exit(4);
+        }
+    }
+    if (compress2((Bytef *) g->wins + g->winlen, &n, flat, GZWINDOW, Z_BEST_SPEED) != Z_OK) {
+        printf("unable to deflate a .gz window; exiting\n");
+        exit(4);
+    }
+    p->winoff = g->winlen;
+    p->winlen = n;
+    g->winlen += n;
+}
+
+/*  inflate all of the .gz file once, noting the access points; NULL, or why it can't be read  */
+static const char *gz_build(gzimage_t *g) {
+z_stream      strm;
+unsigned char *in, *win, *o;
+uint64_t      totin = 0, totout = 0, last = 0, mstart = 0, pos = 0;
+uint32_t      crc;
+ssize_t       got;
+const char    *why = NULL;
+int           ret;
+    memset(&strm, 0, sizeof(strm));
+    in = malloc(GZINCHUNK);
+    win = calloc(1, GZWINDOW);
+    if (in == NULL || win == NULL || inflateInit2(&strm, 31) != Z_OK) {
+        printf("unable to allocate a .gz stream; exiting\n");
+        exit(4);
+    }
+    crc = crc32(0, Z_NULL, 0);
+    gz_addpoint(g, 0, 0, 0, 0, crc, NULL, 0);
+    for (;;) {
+        if (strm.avail_in == 0) {
+            if ((got = pread_raw(g->fd, in, GZINCHUNK, pos)) <= 0) {
+                why = (got == 0) ? "it ends part way through" : strerror(errno);
+                break;
+            }
+            pos += got;
+            strm.next_in = in;
+            strm.avail_in = got;
+        }
+        if (strm.avail_out == 0) {
+            strm.next_out = win;
+            strm.avail_out = GZWINDOW;
+        }
+        o = strm.next_out;
+        totin += strm.avail_in;
+        totout += strm.avail_out;
+        ret = inflate(&strm, Z_BLOCK);
+        totin -= strm.avail_in;
+        totout -= strm.avail_out;
+        crc = crc32(crc, o, strm.next_out - o);
+        if (ret == Z_STREAM_END) {
+            /*  ----------------------------------------  */
+            /*  another member, or the end (anything      */
+            /*  else after it is ignored, as gzip does)   */
+            /*  ----------------------------------------  */
+            if (strm.avail_in < 2) {
+                memmove(in, strm.next_in, strm.avail_in);
+                if ((got = pread_raw(g->fd, in + strm.avail_in, GZINCHUNK - strm.avail_in, pos)) == -1) {
+                    why = strerror(errno);
+                    break;
+                }
+                pos += got;
+                strm.next_in = in;
+                strm.avail_in += got;
+            }
+            if (strm.avail_in < 2 || strm.next_in[0] != 0x1f || strm.next_in[1] != 0x8b) break;
+            inflateReset(&strm);
+            crc = crc32(0, Z_NULL, 0);
+            mstart = totout;
+            if (totout - last >= GZSPAN) {
+                gz_addpoint(g, totout, totin, 0, totout, crc, NULL, 0);
+                last = totout;
+            }
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            why = strm.msg ? strm.msg : "it isn't gzip";
+            break;
+        }
+        /*  the end of a block that isn't the last: a place to start from  */
+        if ((strm.data_type & 128) && !(strm.data_type & 64) && totout - last >= GZSPAN) {
+            gz_addpoint(g, totout, totin, strm.data_type & 7, mstart, crc, win, GZWINDOW - strm.avail_out);
+            last = totout;
+        }
+    }
+    inflateEnd(&strm);
+    free(in);
+    free(win);
+    g->size = g->have = totout;
+    return why;
+}
+
+/*  the saved index, if it is for the .gz file as it is now; 1 if it was loaded  */
+static int gz_load(gzimage_t *g, struct stat *st, char *idx) {
+gzhdr_t h;
+size_t  n;
+int     fd, ok = 0;
+    if ((fd = open(idx, O_RDONLY)) == -1) return 0;
+    if (pread_all(fd, &h, sizeof(h), 0) == sizeof(h) && memcmp(h.magic, GZI_MAGIC, 8) == 0
+        && h.csize == (uint64_t) st->st_size && h.mtime == st->st_mtim.tv_sec && h.mtimens == st->st_mtim.tv_nsec
+        && h.npts > 0 && h.npts < SIZE_MAX / sizeof(gzpoint_t) && h.winlen < SIZE_MAX) {
+        n = h.npts * sizeof(gzpoint_t);
+        if ((g->pts = malloc(n)) != NULL && (g->wins = malloc(h.winlen ? h.winlen : 1)) != NULL
+            && pread_all(fd, g->pts, n, sizeof(h)) == (ssize_t) n
+            && pread_all(fd, g->wins, h.winlen, sizeof(h) + n) == (ssize_t) h.winlen) {
+            g->npts = g->ptcap = h.npts;
+            g->winlen = g->wincap = h.winlen;
+            g->size = g->have = h.size;
+            ok = 1;
+        } else {
+            free(g->pts);
+            free(g->wins);
+            g->pts = NULL;
+            g->wins = NULL;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/*  save the index beside the image (written whole, then renamed over any old one)  */
+static void gz_save(gzimage_t *g) {
+gzhdr_t     h;
+gzpoint_t   *p;
+struct stat st;
+char        *idx, *tmp;
+uint64_t    at = 0;
+size_t      i, n;
+int         fd = -1, bad, errsv;
+    if (fstat(g->fd, &st) == -1) return;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, GZI_MAGIC, 8);
+    h.csize = st.st_size;
+    h.mtime = st.st_mtim.tv_sec;
+    h.mtimens = st.st_mtim.tv_nsec;
+    h.size = g->have;
+    h.npts = g->npts;
+    n = g->npts * sizeof(*p);
+    /*  only the windows still in use go, one after another  */
+    if ((p = malloc(n)) == NULL) return;
+    memcpy(p, g->pts, n);
+    for (i = 0; i < g->npts; i++)
+        if (p[i].winlen) {
+            p[i].winoff = at;
+            at += p[i].winlen;
+        }
+    h.winlen = at;
+    idx = gz_path(g->fn, ".szi");
+    tmp = gz_path(g->fn, ".szi.tmp");
+    bad = (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1
+          || pwrite_all(fd, &h, sizeof(h), 0) != sizeof(h)
+          || pwrite_all(fd, p, n, sizeof(h)) != (ssize_t) n;
+    for (i = 0; !bad && i < g->npts; i++)
+        if (p[i].winlen && pwrite_all(fd, g->wins + g->pts[i].winoff, p[i].winlen, sizeof(h) + n + p[i].winoff) != (ssize_t) p[i].winlen)
+            bad = 1;
+    if (!bad) bad = fdatasync(fd) == -1 || rename(tmp, idx) == -1;
+    if (bad) {
+        errsv = errno;
+        printf("**  the index of %s could not be saved in %s (%s); it will be made again next time  **\n", g->fn, idx, strerror(errsv));
+        if (fd != -1) unlink(tmp);
+    } else if(debug) printf("(debug) %s: %zu access point(s) saved in %s\n", g->fn, g->npts, idx);
+    if (fd != -1) close(fd);
+    free(p);
+    free(idx);
+    free(tmp);
+}
+
+/*  on the first open of every target: if 'fn' is a .gz image, 'fd' reads and writes the image in it  */
+void gz_open(char *fn, int fd) {
+gzimage_t     *g;
+struct stat   st;
+unsigned char magic[4];
+const char    *why;
+char          *idx;
+uint64_t      t0;
+int           n;
+    if (!gz_named(fn) || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || pread_raw(fd, magic, 4, 0) != 4) return;
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        printf("*** %s is zstd compressed, which this szap can't read; no writes will be performed ***\n", fn);
+        ok_to_write = 0;
+        return;
+    }
+    if (magic[0] != 0x1f || magic[1] != 0x8b) return;
+
+    if ((g = calloc(1, sizeof(*g))) == NULL) {
+        printf("unable to allocate a .gz image; exiting\n");
+        exit(4);
+    }
+    g->fn = fn;
+    g->fd = fd;
+    g->lo = UINT64_MAX;
+    g->over.fn = fn;
+    g->over.fd = fd;
+    pthread_mutex_init(&g->mu, NULL);
+    idx = gz_path(fn, ".szi");
+    if (gz_load(g, &st, idx)) {
+        if(debug) printf("(debug) %s: %zu access point(s) loaded from %s\n", fn, g->npts, idx);
+    } else {
+        printf("**  indexing %s (%" PRIu64 " MB of gzip)  **\n", fn, (uint64_t) st.st_size >> 20);
+        fflush(stdout);
+        t0 = stat_now();
+        if ((why = gz_build(g)) != NULL) {
+            printf("%s can't be read as gzip (%s); exiting\n", fn, why);
+            exit(4);
+        }
+        printf("**  %s: a %" PRIx64 " byte image, %zu access point(s), indexed in %.3f s  **\n",
+               fn, g->size, g->npts, (stat_now() - t0) / 1e9);
+        gz_save(g);
+    }
+    free(idx);
+    if (fd >= ngztab) {
+        n = fd + 16;
+        if ((gztab = realloc(gztab, n * sizeof(*gztab))) == NULL) {
+            printf("unable to allocate the .gz table; exiting\n");
+            exit(4);
+        }
+        memset(gztab + ngztab, 0, (n - ngztab) * sizeof(*gztab));
+        ngztab = n;
+    }
+    gztab[fd] = g;
+}
+
+static void gz_end(gzcur_t *c) {
+    inflateEnd(&c->strm);
+    free(c);
+}
+
+/*  a stream ready to inflate from access point 'p'; NULL (errno set) if it can't be  */
+static gzcur_t *gz_start(gzimage_t *g, gzpoint_t *p) {
+gzcur_t       *c;
+unsigned char win[GZWINDOW], b;
+uLongf        n = GZWINDOW;
+    if ((c = malloc(sizeof(*c))) == NULL) return NULL;
+    memset(&c->strm, 0, sizeof(c->strm));
+    c->inpos = p->in;
+    c->out = p->out;
+    c->raw = (p->winlen != 0);
+    c->skip = 0;
+    if (inflateInit2(&c->strm, c->raw ? -15 : 31) != Z_OK) {
+        free(c);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!c->raw) return c;
+    if ((p->bits && (pread_raw(g->fd, &b, 1, p->in - 1) != 1 || inflatePrime(&c->strm, p->bits, b >> (8 - p->bits)) != Z_OK))
+        || p->winoff + p->winlen > g->winlen
+        || uncompress(win, &n, (Bytef *) g->wins + p->winoff, p->winlen) != Z_OK || n != GZWINDOW
+        || inflateSetDictionary(&c->strm, win, GZWINDOW) != Z_OK) {
+        gz_end(c);
+        errno = EIO;
+        return NULL;
+    }
+    return c;
+}
+
+/*  inflate on from where 'c' is to fill 'buf' with [off, off+len); 0, or -1 (errno set)  */
+static int gz_run(gzimage_t *g, gzcur_t *c, char *buf, size_t len, uint64_t off) {
+unsigned char junk[GZWINDOW];
+uint64_t      want;
+unsigned      before, k;
+ssize_t       got;
+int           ret;
+    while (c->out < off + len) {
+        if (c->strm.avail_in == 0) {
+            if ((got = pread_raw(g->fd, c->in, GZINCHUNK, c->inpos)) <= 0) {
+                if (got == 0) errno = EIO;  /*  the .gz file is shorter than it was  */
+                return -1;
+            }
+            c->inpos += got;
+            c->strm.next_in = c->in;
+            c->strm.avail_in = got;
+        }
+        if (c->skip) {
+            /*  the trailer of a member begun raw; a gzip header follows  */
+            k = (c->skip < c->strm.avail_in) ? c->skip : c->strm.avail_in;
+            c->strm.next_in += k;
+            c->strm.avail_in -= k;
+            if ((c->skip -= k) == 0 && inflateReset2(&c->strm, 31) != Z_OK) {
+                errno = EIO;
+                return -1;
+            }
+            continue;
+        }
+        if (c->out < off) {
+            want = off - c->out;  /*  up to 'off' is inflated and dropped  */
+            c->strm.next_out = junk;
+            c->strm.avail_out = (want < GZWINDOW) ? want : GZWINDOW;
+        } else {
+            want = off + len - c->out;
+            c->strm.next_out = (unsigned char *) buf + (c->out - off);
+            c->strm.avail_out = (want < (1u << 30)) ? want : (1u << 30);
+        }
+        before = c->strm.avail_out;
+        ret = inflate(&c->strm, Z_NO_FLUSH);
+        c->out += before - c->strm.avail_out;
+        if (ret == Z_STREAM_END) {
+            if (c->raw) {
+                c->raw = 0;
+                c->skip = 8;
+            } else if (inflateReset(&c->strm) != Z_OK) {
+                errno = EIO;
+                return -1;
+            }
+            continue;
+        }
+        if (ret != Z_OK && !(ret == Z_BUF_ERROR && c->strm.avail_in == 0)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*  [off, off+len) of the image as the .gz file holds it; 0, or -1 (errno set)  */
+static int gz_inflate(gzimage_t *g, char *buf, size_t len, uint64_t off) {
+gzcur_t *c = NULL;
+size_t  lo, hi, mid;
+int     r;
+    pthread_mutex_lock(&g->mu);
+    if (g->cur != NULL && g->cur->out <= off && off - g->cur->out <= GZSPAN) {
+        c = g->cur;  /*  carry on from the last read  */
+        g->cur = NULL;
+    }
+    pthread_mutex_unlock(&g->mu);
+    if (c == NULL) {
+        /*  the last access point at or before 'off'  */
+        for (lo = 0, hi = g->npts; hi - lo > 1; ) {
+            mid = (lo + hi) / 2;
+            if (g->pts[mid].out <= off) lo = mid;
+            else hi = mid;
+        }
+        if(debug) printf("(debug) %s: inflating from access point %zu (%" PRIx64 ") for %" PRIx64 "\n", g->fn, lo, g->pts[lo].out, off);
+        if ((c = gz_start(g, &g->pts[lo])) == NULL) return -1;
+    }
+    if ((r = gz_run(g, c, buf, len, off)) == 0) {
+        pthread_mutex_lock(&g->mu);
+        if (g->cur == NULL) {
+            g->cur = c;
+            c = NULL;
+        }
+        pthread_mutex_unlock(&g->mu);
+    }
+    if (c != NULL) gz_end(c);
+    return r;
+}
+
+ssize_t gz_pread(gzimage_t *g, void *buf, size_t len, off64_t off) {
+size_t n = 0;
+    if ((uint64_t) off >= g->size) return 0;
+    if (len > g->size - off) len = g->size - off;
+    if ((uint64_t) off < g->have) {
+        n = (len < g->have - off) ? len : g->have - off;
+        if (gz_inflate(g, buf, n, off) == -1) return -1;
+    }
+    memset((char *) buf + n, 0, len - n);  /*  past the end of the .gz file's image: zeros  */
+    pthread_mutex_lock(&g->mu);
+    plan_overlay(&g->over, buf, len, off);
+    pthread_mutex_unlock(&g->mu);
+    return len;
+}
+
+ssize_t gz_pwrite(gzimage_t *g, const void *buf, size_t len, off64_t off) {
+    if (len == 0) return 0;
+    pthread_mutex_lock(&g->mu);
+    plan_rep(&g->over, off, (char *) buf, len);
+    if ((uint64_t) off + len > g->size) g->size = off + len;
+    if ((uint64_t) off < g->lo) g->lo = off;
+    g->dirty = 1;
+    pthread_mutex_unlock(&g->mu);
+    return len;
+}
+
+/*  ftruncate(), or for a .gz image, the same to the image in it  */
+int ztruncate(int fd, off64_t size) {
+gzimage_t *g = gz_image(fd);
+planrep_t *r;
+size_t    i;
+    if (g == NULL) return ftruncate(fd, size);
+    pthread_mutex_lock(&g->mu);
+    for (i = 0; i < g->over.nreps; i++) {
+        r = &g->over.reps[i];
+        if (r->off >= size) r->len = 0;
+        else if (r->off + (off64_t) r->len > size) r->len = size - r->off;
+    }
+    if (g->have > (uint64_t) size) g->have = size;
+    g->size = size;
+    if ((uint64_t) size < g->lo) g->lo = size;
+    g->dirty = 1;
+    pthread_mutex_unlock(&g->mu);
+    return 0;
+}
+
+static void gz_put32(unsigned char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*  rewrite the .gz file with what has been written to its image; 0, or -1 (after saying why)  */
+static int gz_commit(gzimage_t *g) {
+gzimage_t     made;  /*  (only its points: the new members)  */
+gzpoint_t     *p;
+z_stream      strm;
+struct stat   st;
+unsigned char tail[16], b, *zout = NULL;
+char          *path, *tmp, *buf = NULL, *dir, *slash;
+const char    *how = "", *why = NULL;
+uint64_t      keep, pos, at, n;
+size_t        lo, hi, mid, nt = 0, bound;
+int           rfd, tfd = -1, nfd, dfd, q, errsv = 0;
+
+    memset(&made, 0, sizeof(made));
+    memset(&strm, 0, sizeof(strm));
+    if ((path = realpath(g->fn, NULL)) == NULL) path = strdup(g->fn);
+    tmp = gz_path(path, ".szaptmp");
+    /*  ----------------------------------------------  */
+    /*  the last access point before the first change   */
+    /*  ----------------------------------------------  */
+    for (lo = 0, hi = g->npts; hi - lo > 1; ) {
+        mid = (lo + hi) / 2;
+        if (g->pts[mid].out <= g->lo) lo = mid;
+        else hi = mid;
+    }
+    p = &g->pts[lo];
+    keep = (p->winlen && p->bits) ? p->in - 1 : p->in;
+    if(debug) printf("(debug) %s: rewriting from access point %zu (%" PRIx64 "), keeping %" PRIx64 " compressed byte(s)\n",
+                     g->fn, lo, p->out, keep);
+
+    /*  ----------------------------------------------  */
+    /*  the .gz file up to it, as it is                 */
+    /*  ----------------------------------------------  */
+    if ((rfd = open(path, O_RDONLY | O_LARGEFILE)) == -1 || fstat(rfd, &st) == -1
+        || (tfd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0600)) == -1
+        || copy_range(rfd, 0, tfd, 0, keep, NULL, &how) != (int64_t) keep) {
+        errsv = errno;
+        goto fail;
+    }
+    at = keep;
+    if (p->winlen) {
+        /*  ----------------------------------------  */
+        /*  end its member: an empty, final, stored   */
+        /*  block where the next one would start,     */
+        /*  then the CRC and length of the member     */
+        /*  ----------------------------------------  */
+        if (p->bits) {
+            if (pread_all(rfd, &b, 1, p->in - 1) != 1) {
+                errsv = errno ? errno : EIO;
+                goto fail;
+            }
+            q = 8 - p->bits;  /*  the bit in that byte where the next block starts  */
+            tail[nt++] = (b & ((1 << q) - 1)) | (1 << q);
+            if (q > 5) tail[nt++] = 0;  /*  the block type spills into the next byte  */
+        } else tail[nt++] = 1;
+        tail[nt++] = 0x00;  /*  LEN 0, NLEN ffff  */
+        tail[nt++] = 0x00;
+        tail[nt++] = 0xff;
+        tail[nt++] = 0xff;
+        gz_put32(tail + nt, p->crc);
+        gz_put32(tail + nt + 4, p->out - p->mstart);
+        nt += 8;
+        if (pwrite_all(tfd, tail, nt, at) != (ssize_t) nt) {
+            errsv = errno ? errno : EIO;
+            goto fail;
+        }
+        at += nt;
+    }
+
+    /*  ----------------------------------------------  */
+    /*  then the rest of the image, GZSPAN a member     */
+    /*  ----------------------------------------------  */
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        why = "no deflate stream";
+        goto fail;
+    }
+    bound = deflateBound(&strm, GZSPAN);
+    if ((buf = malloc(GZSPAN)) == NULL || (zout = malloc(bound)) == NULL) {
+        why = "no buffers";
+        goto fail;
+    }
+    for (pos = p->out; pos < g->size || at == 0; pos += n) {  /*  (an empty image is still one member)  */
+        n = (g->size - pos > GZSPAN) ? GZSPAN : g->size - pos;
+        if (gz_pread(g, buf, n, pos) != (ssize_t) n) {
+            errsv = errno ? errno : EIO;
+            goto fail;
+        }
+        deflateReset(&strm);
+        strm.next_in = (unsigned char *) buf;
+        strm.avail_in = n;
+        strm.next_out = zout;
+        strm.avail_out = bound;
+        if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+            why = "deflate did not finish";
+            goto fail;
+        }
+        if (pwrite_all(tfd, zout, bound - strm.avail_out, at) != (ssize_t) (bound - strm.avail_out)) {
+            errsv = errno ? errno : EIO;
+            goto fail;
+        }
+        gz_addpoint(&made, pos, at, 0, pos, 0, NULL, 0);
+        at += bound - strm.avail_out;
+    }
+
+    /*  ----------------------------------------------  */
+    /*  and in place of the old one                     */
+    /*  ----------------------------------------------  */
+    if (fchmod(tfd, st.st_mode & 07777) == -1 || zsync(tfd) == -1 || rename(tmp, path) == -1) {
+        errsv = errno;
+        goto fail;
+    }
+    if (fchown(tfd, st.st_uid, st.st_gid) == -1 && debug) printf("(debug) %s: owner not kept (%s)\n", g->fn, strerror(errno));
+    dir = strdup(path);
+    if ((slash = strrchr(dir, '/')) != NULL) slash[slash == dir] = '\0';
+    if ((dfd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY)) != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+    free(dir);
+    if ((nfd = open(path, (fcntl(g->fd, F_GETFL) & (O_ACCMODE | O_DIRECT)) | O_LARGEFILE)) != -1) {
+        dup2(nfd, g->fd);  /*  the handle's descriptor is the new file now  */
+        close(nfd);
+    } else printf("*** %s could not be opened again (%s) ***\n", g->fn, strerror(errno));
+    printf("**  %s rewritten from offset %" PRIx64 ": %" PRIx64 " compressed byte(s) kept (%s), %" PRIx64 " new  **\n",
+           g->fn, p->out, keep, how, at - keep);
+
+    /*  ----------------------------------------------  */
+    /*  the index follows suit                          */
+    /*  ----------------------------------------------  */
+    if (g->cur != NULL) gz_end(g->cur);
+    g->cur = NULL;
+    g->npts = lo;
+    for (mid = 0; mid < made.npts; mid++) gz_addpoint(g, made.pts[mid].out, made.pts[mid].in, 0, made.pts[mid].mstart, 0, NULL, 0);
+    for (mid = 0; mid < g->over.nreps; mid++) free(g->over.reps[mid].data);
+    g->over.nreps = 0;
+    g->have = g->size;
+    g->lo = UINT64_MAX;
+    g->dirty = 0;
+    gz_save(g);
+    deflateEnd(&strm);
+    close(rfd);
+    close(tfd);
+    free(made.pts);
+    free(buf);
+    free(zout);
+    free(path);
+    free(tmp);
+    return 0;
+
+fail:
+    printf("*** %s could not be rewritten (%s); what was written to its image is lost ***\n",
+           g->fn, why ? why : strerror(errsv));
+    deflateEnd(&strm);
+    if (tfd != -1) {
+        close(tfd);
+        unlink(tmp);
+    }
+    if (rfd != -1) close(rfd);
+    free(made.pts);
+    free(buf);
+    free(zout);
+    free(path);
+    free(tmp);
+    return -1;
+}
+
+/*  after the last card: every .gz image written to is rewritten  */
+void gz_commitall(void) {
+int fd;
+    for (fd = 0; fd < ngztab; fd++)
+        if (gztab[fd] != NULL && gztab[fd]->dirty) gz_commit(gztab[fd]);
+}
+
 /*  ------------------------------------------------------------  */
 /*  ------------------------------------------------------------  */
 /*                                                                */
@@ -471,19 +2460,16 @@ int  ret;
 /*                                                                */
 /*  ------------------------------------------------------------  */
 /*  ------------------------------------------------------------  */
-uint do_data(char *destP, char *srcP) {
+size_t do_data(arena_t *destA, char *srcP) {
 // must be "pairs" and 0-9, A-F, or a-f
-int    ret, i;
+long   bad;
 size_t destlen;
 size_t srclen;
+uint64_t t0 = stats ? stat_now() : 0;
     /*  ----------------------------------------------------------------  */
     /*  initial size of src data; may be reduced if prefixed by 0x or 0X  */
     /*  ----------------------------------------------------------------  */
     srclen = strlen(srcP);
-    /*  -------------------------------------  */
-    /*  not necessary, but we'll do it anyway  */
-    /*  -------------------------------------  */
-    memset(destP, 0, DESTSIZE);
     /*  --------------------------------  */
     /*  remove 0x or 0X, if it exists     */
     /*  --------------------------------  */
@@ -491,39 +2477,3779 @@ size_t srclen;
         srcP += 2;
         srclen -= 2;
     }
-    /*  ------------------------------------------  */
-    /*  is it pairs of ascii hex characters         */
-    /*  ------------------------------------------  */
-        if ((srclen % 2) == 1) {
-        printf("'data' must be pairs of hex bytes; srclen is %i; exiting\n", (int) srclen);
-        hexDump("srcP: ", srcP, srclen, 0);
+    /*  ------------------------------------------  */
+    /*  is it pairs of ascii hex characters         */
+    /*  ------------------------------------------  */
+        if ((srclen % 2) == 1) {
+        printf("'data' must be pairs of hex bytes; srclen is %zi; exiting\n", srclen);
+        hexDump("srcP: ", srcP, srclen, 0);
+        exit(4);
+    }
+    /*  ------------------------------------------  */
+    /*  now that we know srclen we can set destlen  */
+    /*  ------------------------------------------  */
+    destlen = srclen / 2;
+    /*  ----------------------  */
+    /*  now process the source  */
+    /*  ----------------------  */
+    bad = szap_hexdecode((unsigned char *) arena_reserve(destA, destlen), srcP, destlen);
+    if (bad >= 0) {
+        printf("'data' has a non-hex character, '%c', at position %li; exiting\n", srcP[bad], bad);
+        exit(4);
+    }
+    if (stats) stat_phase(SP_DECODE, t0, destlen);
+    /*  --------------  */
+    /*  return destlen  */
+    /*  --------------  */
+    return destlen;
+}
+
+/*  ------------------------------------------------------------  */
+/*  ------------------------------------------------------------  */
+/*  make sure an arena holds at least 'n' bytes; return its base  */
+/*  ------------------------------------------------------------  */
+/*  ------------------------------------------------------------  */
+char *arena_reserve(arena_t *a, size_t n) {
+size_t cap;
+char   *p;
+    if (n <= a->cap) return a->base;
+    cap = a->cap ? a->cap : ARENAMIN;
+    while (cap < n) cap *= 2;
+    if ((p = realloc(a->base, cap)) == NULL) {
+        printf("unable to allocate %zu bytes for 'data'; exiting\n", cap);
+        exit(4);
+    }
+    a->base = p;
+    a->cap = cap;
+    return p;
+}
+
+/*  1 if 'len' bytes of the regular file 'fd' at 'skip' are few and have no  */
+/*  holes (or start at or past its end): read in one go, not mapped          */
+int dump_short(int fd, uint64_t len, uint64_t skip) {
+struct stat st;
+off64_t end, dstart, dend;
+    if (len > CACHEDUMP || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return 0;
+    if (skip >= (uint64_t) st.st_size) return 1;
+    end = skip + len;
+    return next_data(fd, skip, end, &dstart, &dend) && dstart == (off64_t) skip
+           && dend >= (end < st.st_size ? end : st.st_size);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  dump 'len' bytes of 'fd', starting at 'skip', a chunk at a time  */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  Regular files are mapped DUMPCHUNK bytes at a time; anything else  */
+/*  (block and character devices, .gz images) is pread into one page   */
+/*  aligned buffer of the same size.  A pipe can't be pread (ESPIPE),  */
+/*  so it gets the pread error rather than a dump.  Either way memory  */
+/*  use is fixed no matter how large 'len' is, and each chunk is       */
+/*  handed to hexDump as soon as it is available.  Every chunk but the */
+/*  last is a multiple of 16, so the hexDump lines stay on 16 byte     */
+/*  boundaries.  Holes in a sparse file are never read: hexDumpZeros  */
+/*  stands in.                                                         */
+void dump_range(int fd, uint64_t len, uint64_t skip) {
+struct stat st;
+off64_t pos, end, base, dstart, dend;
+size_t  n, delta;
+ssize_t got;
+long    pagesize;
+uint64_t t0 = 0;
+char    *map;
+char    *chunk = NULL;
+char    *desc = "dump";
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return;
+    }
+    pos = skip;
+    end = (len > (uint64_t) INT64_MAX - skip) ? INT64_MAX : (off64_t) (skip + len);
+
+    if (len <= CACHEDUMP && (gz_image(fd) || !S_ISREG(st.st_mode) || dump_short(fd, len, skip))) {
+        /*  -----------------------------------------------  */
+        /*  a short range with no holes: through the cache,  */
+        /*  where the 'ver's and 'dump's around it find it   */
+        /*  -----------------------------------------------  */
+        if ((chunk = malloc(len ? len : 1)) == NULL) {
+            printf("unable to allocate a %" PRIu64 " byte dump buffer; exiting\n", len);
+            exit(4);
+        }
+        if ((got = cache_pread(fd, chunk, len, pos)) == -1) perror("pread");
+        else if (got == 0 && S_ISREG(st.st_mode) && !dio_blocksize(fd))
+            printf("dump\n  (offset %" PRIx64 " is at or beyond the end of the file; nothing to dump)\n", skip);
+        else if (got == 0) printf("dump\n  (nothing read at offset %" PRIx64 ")\n", skip);
+        else {
+            hexDump(desc, chunk, got, pos);
+            hexDumpEnd();
+        }
+        free(chunk);
+        return;
+    }
+    if (S_ISREG(st.st_mode) && !dio_blocksize(fd) && !gz_image(fd)) {
+        /*  -----------------------------------------------  */
+        /*  a regular file: never map beyond the end of it   */
+        /*  (touching such a page would raise SIGBUS)        */
+        /*  -----------------------------------------------  */
+        if (end > st.st_size) end = st.st_size;
+        if (pos >= end) {
+            printf("dump\n  (offset %" PRIx64 " is at or beyond the end of the file; nothing to dump)\n", skip);
+            return;
+        }
+        hexDump(desc, NULL, 0, pos);  /* just prints 'dump' and starts a fresh dump */
+        pagesize = sysconf(_SC_PAGESIZE);
+        while (pos < end) {
+            /*  -------------------------------------------  */
+            /*  skip any hole, keeping to whole dump lines   */
+            /*  -------------------------------------------  */
+            if (!next_data(fd, pos, end, &dstart, &dend)) dstart = dend = end;
+            dstart = pos + ((dstart - pos) & ~(off64_t) 15);
+            if (dstart > pos) {
+                hexDumpZeros(pos, dstart - pos);
+                pos = dstart;
+                if (pos >= end) break;
+            }
+            if (dend < pos + 16) dend = pos + 16;
+            if (dend > end) dend = end;
+            n = (dend - pos > DUMPCHUNK) ? DUMPCHUNK : dend - pos;
+            if (n < (size_t) (end - pos)) n &= ~(size_t) 15;  /* stay on a line boundary */
+            base = pos & ~((off64_t) pagesize - 1);
+            delta = pos - base;
+            if (stats) t0 = stat_now();
+            map = mmap64(NULL, n + delta, PROT_READ, MAP_SHARED, fd, base);
+            if (stats) stat_io(ST_MMAP, t0, map == MAP_FAILED ? -1 : (ssize_t) n, n);
+            if (map == MAP_FAILED) {
+                perror("mmap");
+                break;
+            }
+            madvise(map, n + delta, MADV_SEQUENTIAL);
+            hexDump(NULL, map + delta, n, pos);
+            munmap(map, n + delta);
+            pos += n;
+        }
+        hexDumpEnd();
+        return;
+    }
+
+    /*  -----------------------------------------------  */
+    /*  a device (or a .gz image): large preads into an  */
+    /*  aligned buffer (or, with --uring, several of     */
+    /*  them in flight)                                  */
+    /*  -----------------------------------------------  */
+    if (uring && !dio_blocksize(fd) && !gz_image(fd)) {
+        dump_uring(fd, pos, end);
+        return;
+    }
+    if (posix_memalign((void **) &chunk, 4096, DUMPCHUNK) != 0) {
+        printf("unable to allocate a %i byte dump buffer; exiting\n", DUMPCHUNK);
+        exit(4);
+    }
+    while (pos < end) {
+        n = (end - pos > DUMPCHUNK) ? DUMPCHUNK : end - pos;
+        got = pread_full(fd, chunk, n, pos);
+        if (got == -1) {
+            perror("pread");
+            break;
+        }
+        if (got == 0) break; /* end of device */
+        hexDump(desc, chunk, got, pos);
+        desc = NULL;
+        pos += got;
+        if (got % 16) break; /* a short, unaligned read only happens at the end */
+    }
+    hexDumpEnd();
+    if (desc != NULL) printf("dump\n  (nothing read at offset %" PRIx64 ")\n", skip);
+    free(chunk);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  the block cache: what 'ver' and 'dump' have read, kept for reuse */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  Whole CACHEBLOCK blocks, keyed by descriptor and block number,    */
+/*  in a hash table and an LRU list; at most --cache MB of them.  A   */
+/*  miss reads the run of missing blocks around it with one pread.    */
+/*  The cache is write through: pwrite_full lays what it wrote over   */
+/*  any cached blocks it touched, and anything else that changes a    */
+/*  file (pwritev, a kernel copy, a truncate, an io_uring write)      */
+/*  forgets the blocks it covered.  The part block at the end of a    */
+/*  file is never kept, so a file that grows can't leave a stale      */
+/*  end of file behind.  Only the main thread uses it.  Every target  */
+/*  is opened once, by the handle table, so a descriptor is a file.   */
+typedef struct cblock {
+    struct cblock *hnext;           /*  the hash chain                  */
+    struct cblock *prev, *next;     /*  the LRU list, newest first      */
+    int           fd;
+    uint64_t      blk;
+    char          data[CACHEBLOCK];
+} cblock_t;
+
+static cblock_t **chash = NULL;
+static size_t   chashmask = 0;
+static cblock_t *cnewest = NULL, *coldest = NULL;
+static size_t   cused = 0, cmax = 0;
+static char     *cbuf = NULL;       /*  where a run of misses is read   */
+static size_t   cbufcap = 0;
+cachestat_t     cachestat;
+
+/*  a cache of 'mb' MB (0: none)  */
+void cache_init(uint64_t mb) {
+size_t n = 1;
+    cmax = mb * (1024 * 1024 / CACHEBLOCK);
+    if (cmax == 0) return;
+    while (n < cmax) n <<= 1;
+    if ((chash = calloc(n, sizeof(*chash))) == NULL) {
+        printf("unable to allocate the block cache; exiting\n");
+        exit(4);
+    }
+    chashmask = n - 1;
+}
+
+static size_t cache_slot(int fd, uint64_t blk) {
+    return ((blk * 0x9E3779B97F4A7C15ULL) ^ (uint64_t) fd * 0xC2B2AE3D27D4EB4FULL) >> 20 & chashmask;
+}
+
+static cblock_t *cache_find(int fd, uint64_t blk) {
+cblock_t *c;
+    for (c = chash[cache_slot(fd, blk)]; c != NULL; c = c->hnext)
+        if (c->blk == blk && c->fd == fd) return c;
+    return NULL;
+}
+
+static void cache_unlink(cblock_t *c) {
+cblock_t **pp;
+    for (pp = &chash[cache_slot(c->fd, c->blk)]; *pp != c; pp = &(*pp)->hnext) ;
+    *pp = c->hnext;
+    if (c->prev) c->prev->next = c->next;
+    else cnewest = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else coldest = c->prev;
+}
+
+static void cache_link(cblock_t *c) {
+size_t s = cache_slot(c->fd, c->blk);
+    c->hnext = chash[s];
+    chash[s] = c;
+    c->prev = NULL;
+    c->next = cnewest;
+    if (cnewest) cnewest->prev = c;
+    cnewest = c;
+    if (coldest == NULL) coldest = c;
+}
+
+/*  block 'blk' of 'fd' is 'data': keep it, in place of the oldest if the cache is full  */
+static void cache_put(int fd, uint64_t blk, const char *data) {
+cblock_t *c;
+    if ((c = cache_find(fd, blk)) != NULL) cache_unlink(c);
+    else if (cused < cmax) {
+        if ((c = malloc(sizeof(*c))) == NULL) {
+            printf("unable to allocate a cache block; exiting\n");
+            exit(4);
+        }
+        cused++;
+    } else {
+        c = coldest;
+        cache_unlink(c);
+        cachestat.evictions++;
+    }
+    c->fd = fd;
+    c->blk = blk;
+    memcpy(c->data, data, CACHEBLOCK);
+    cache_link(c);
+}
+
+/*  pread_full, by way of the cache  */
+ssize_t cache_pread(int fd, void *buf, size_t len, off64_t off) {
+cblock_t *c;
+uint64_t b, e, k, i;
+size_t   done = 0, from, n;
+ssize_t  got;
+    if (cmax == 0) return pread_full(fd, buf, len, off);
+    while (done < len) {
+        b = (off + done) / CACHEBLOCK;
+        from = (off + done) % CACHEBLOCK;
+        if ((c = cache_find(fd, b)) != NULL) {
+            /*  a hit: it's the newest now  */
+            cachestat.hits++;
+            cache_unlink(c);
+            cache_link(c);
+            n = (CACHEBLOCK - from < len - done) ? CACHEBLOCK - from : len - done;
+            memcpy((char *) buf + done, c->data + from, n);
+            done += n;
+            continue;
+        }
+        /*  ----------------------------------------  */
+        /*  a miss: read it, and the blocks after it  */
+        /*  that the range needs and the cache lacks  */
+        /*  ----------------------------------------  */
+        e = (off + len - 1) / CACHEBLOCK + 1;
+        for (k = b + 1; k < e && k - b < CACHERUN && k - b < cmax && cache_find(fd, k) == NULL; k++) ;
+        if ((k - b) * CACHEBLOCK > cbufcap) {
+            free(cbuf);
+            cbufcap = (k - b) * CACHEBLOCK;
+            if (posix_memalign((void **) &cbuf, 4096, cbufcap) != 0) {
+                printf("unable to allocate a %zu byte cache buffer; exiting\n", cbufcap);
+                exit(4);
+            }
+        }
+        cachestat.misses += k - b;
+        cachestat.reads++;
+        if ((got = pread_full(fd, cbuf, (k - b) * CACHEBLOCK, b * CACHEBLOCK)) == -1) return -1;
+        for (i = 0; (i + 1) * CACHEBLOCK <= (uint64_t) got; i++) cache_put(fd, b + i, cbuf + i * CACHEBLOCK);
+        if ((size_t) got <= from) break;  /* the end of the file */
+        n = (got - from < len - done) ? got - from : len - done;
+        memcpy((char *) buf + done, cbuf + from, n);
+        done += n;
+        if ((uint64_t) got < (k - b) * CACHEBLOCK) break;
+    }
+    return done;
+}
+
+/*  1 if every block of [off, off+len) is cached (so cache_pread won't read)  */
+int cache_covers(int fd, off64_t off, size_t len) {
+uint64_t b, e;
+    if (cused == 0 || len == 0) return 0;
+    for (b = off / CACHEBLOCK, e = (off + len - 1) / CACHEBLOCK; b <= e; b++)
+        if (cache_find(fd, b) == NULL) return 0;
+    return 1;
+}
+
+/*  'len' bytes at 'off' were written to 'fd': bring any cached blocks up to date  */
+void cache_write(int fd, const void *data, size_t len, off64_t off) {
+cblock_t *c;
+uint64_t b;
+size_t   done = 0, from, n;
+    layout_forget(fd, off, len);
+    if (cused == 0) return;
+    while (done < len) {
+        b = (off + done) / CACHEBLOCK;
+        from = (off + done) % CACHEBLOCK;
+        n = (CACHEBLOCK - from < len - done) ? CACHEBLOCK - from : len - done;
+        if ((c = cache_find(fd, b)) != NULL) {
+            memcpy(c->data + from, (const char *) data + done, n);
+            cachestat.updates++;
+        }
+        done += n;
+    }
+}
+
+/*  the bytes at [off, off+len) of 'fd' changed some other way: drop their blocks  */
+void cache_forget(int fd, off64_t off, uint64_t len) {
+cblock_t *c, *next;
+uint64_t b, e;
+    layout_forget(fd, off, len);
+    if (cused == 0 || len == 0) return;
+    b = off / CACHEBLOCK;
+    e = (len > (uint64_t) INT64_MAX - off) ? UINT64_MAX : (off + len - 1) / CACHEBLOCK + 1;
+    if (e - b > cused) {
+        /*  a big range: look at what's cached instead  */
+        for (c = cnewest; c != NULL; c = next) {
+            next = c->next;
+            if (c->fd == fd && c->blk >= b && c->blk < e) {
+                cache_unlink(c);
+                free(c);
+                cused--;
+                cachestat.forgotten++;
+            }
+        }
+        return;
+    }
+    for (; b < e; b++)
+        if ((c = cache_find(fd, b)) != NULL) {
+            cache_unlink(c);
+            free(c);
+            cused--;
+            cachestat.forgotten++;
+        }
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  a pool of threads for the cards that read a range in pieces      */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  'find', 'sum' and 'diff' cut their range into pieces that the       */
+/*  workers take in turn (with an atomic counter in the job), so a      */
+/*  worker held up by a slow read just takes fewer of them.             */
+
+/*  one worker per CPU (or --threads), no more than there are pieces  */
+int pool_size(uint64_t npieces) {
+int nt = nthreads > 0 ? nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nt < 1) nt = 1;
+    if ((uint64_t) nt > npieces) nt = npieces ? npieces : 1;
+    return nt;
+}
+
+/*  run fn on each of 'nt' args ('size' bytes apart), one of them in this thread; returns how many ran  */
+int pool_run(void *(*fn)(void *), void *args, size_t size, int nt) {
+pthread_t *tid;
+int i, e;
+    if ((tid = calloc(nt, sizeof(*tid))) == NULL) {
+        printf("unable to allocate the thread table; exiting\n");
+        exit(4);
+    }
+    for (i = 1; i < nt; i++) {
+        if ((e = pthread_create(&tid[i], NULL, fn, (char *) args + i * size)) != 0) {
+            printf("**  could only start %i thread(s) (%s)  **\n", i, strerror(e));
+            nt = i;
+        }
+    }
+    fn(args);  /*  this thread is a worker too  */
+    for (i = 1; i < nt; i++) pthread_join(tid[i], NULL);
+    free(tid);
+    return nt;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  'find': every offset in a range where a byte string occurs       */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The range is cut into FINDCHUNK pieces (on FINDCHUNK boundaries of  */
+/*  the file, so O_DIRECT reads of them stay aligned) and a pool of     */
+/*  threads takes them in turn.  Each piece is read together with the   */
+/*  patlen-1 bytes after it, so a match that starts in one piece and    */
+/*  ends in the next is seen, and counted only by the piece it starts   */
+/*  in.  A piece that is all hole is not read unless the pattern is all */
+/*  zeros.  Under --plan the planned reps are laid over what is read.   */
+typedef struct {
+    int           fd;
+    const unsigned char *pat;
+    size_t        patlen;
+    off64_t       start, end;  /*  the range searched                      */
+    uint64_t      nchunks;
+    uint64_t      next;        /*  the next chunk to take (atomically)     */
+    int           holes;       /*  '1' if an all-hole chunk can be skipped */
+    plantarget_t  *t;
+    int           err;         /*  errno of the first failed read, or 0    */
+    off64_t       erroff;
+} findjob_t;
+
+typedef struct {
+    findjob_t *job;
+    uint64_t  *hits;
+    size_t    nhits, cap;
+} findwork_t;
+
+static void find_hit(findwork_t *w, uint64_t off) {
+    if (w->nhits == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 64;
+        if ((w->hits = realloc(w->hits, w->cap * sizeof(*w->hits))) == NULL) {
+            printf("unable to allocate the 'find' results; exiting\n");
+            exit(4);
+        }
+    }
+    w->hits[w->nhits++] = off;
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*  the matches in 'h' (n bytes, read at 'base') that start before 'limit'  */
+static void find_scan(findwork_t *w, const unsigned char *h, size_t n, size_t limit, off64_t base) {
+const unsigned char *pat = w->job->pat;
+const unsigned char *q;
+size_t m = w->job->patlen;
+size_t i = 0;
+    if (n < m) return;
+    if (limit > n - m + 1) limit = n - m + 1;
+#ifdef __SSE2__
+    /*  ----------------------------------------------  */
+    /*  16 candidate positions at a time: the first and  */
+    /*  last bytes of the pattern must both be there     */
+    /*  ----------------------------------------------  */
+    if (m >= 2) {
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last  = _mm_set1_epi8(pat[m - 1]);
+    unsigned mask, b;
+    for (; i < limit && i + m - 1 + 16 <= n; i += 16) {
+        mask = _mm_movemask_epi8(_mm_and_si128(
+                   _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *) (h + i))),
+                   _mm_cmpeq_epi8(last,  _mm_loadu_si128((const __m128i *) (h + i + m - 1)))));
+        while (mask) {
+            b = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (i + b < limit && memcmp(h + i + b + 1, pat + 1, m - 2) == 0)
+                find_hit(w, base + i + b);
+        }
+    }
+    }
+#endif
+    while (i < limit) {
+        if ((q = memchr(h + i, pat[0], limit - i)) == NULL) break;
+        i = q - h;
+        if (memcmp(h + i, pat, m) == 0) find_hit(w, base + i);
+        i++;
+    }
+}
+
+static void *find_worker(void *arg) {
+findwork_t *w = arg;
+findjob_t  *j = w->job;
+uint64_t   k;
+off64_t    cs, ce, we, ds, de;
+size_t     tail = (j->patlen - 1 + 4095) & ~(size_t) 4095;
+ssize_t    got;
+char       *buf;
+    if (posix_memalign((void **) &buf, 4096, FINDCHUNK + tail) != 0) {
+        printf("unable to allocate a 'find' buffer; exiting\n");
+        exit(4);
+    }
+    while ((k = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->nchunks) {
+        if (__atomic_load_n(&j->err, __ATOMIC_RELAXED)) break;
+        /*  -------------------------------------------  */
+        /*  chunk k, and the window read for it          */
+        /*  -------------------------------------------  */
+        cs = (j->start / FINDCHUNK + k) * (off64_t) FINDCHUNK;
+        ce = cs + FINDCHUNK;
+        if (cs < j->start) cs = j->start;
+        if (ce > j->end) ce = j->end;
+        we = ce + (off64_t) j->patlen - 1;
+        if (we > j->end) we = j->end;
+        if (j->holes && !next_data(j->fd, cs, we, &ds, &de)) continue;
+        got = pread_full(j->fd, buf, (k + 1 < j->nchunks) ? (size_t) (ce - cs) + tail : (size_t) (we - cs), cs);
+        if (got == -1) {
+            if (__atomic_exchange_n(&j->err, errno, __ATOMIC_RELAXED) == 0) j->erroff = cs;
+            break;
+        }
+        if (got > we - cs) got = we - cs;
+        if (j->t) plan_overlay(j->t, buf, got, cs);
+        find_scan(w, (unsigned char *) buf, got, ce - cs, cs);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int find_byoff(const void *a, const void *b) {
+uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+void find_range(int fd, plantarget_t *t, unsigned char *pat, size_t patlen, uint64_t start, uint64_t len) {
+findjob_t  job;
+findwork_t *work;
+uint64_t   *all;
+size_t     i, n, total;
+off64_t    size;
+int        nt;
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.pat = pat;
+    job.patlen = patlen;
+    job.t = t;
+    if ((size = target_size(fd)) == -1) size = INT64_MAX;
+    job.start = (start > (uint64_t) size) ? size : (off64_t) start;
+    job.end = (len > (uint64_t) (size - job.start)) ? size : job.start + (off64_t) len;
+    if (job.end - job.start < (off64_t) patlen) {
+        printf("find\n  (the range %" PRIx64 "-%" PRIx64 " is shorter than the pattern; nothing to search)\n",
+               (uint64_t) job.start, (uint64_t) job.end);
+        return;
+    }
+    job.nchunks = (job.end - 1) / FINDCHUNK - job.start / FINDCHUNK + 1;
+    for (i = 0; i < patlen && pat[i] == 0; i++) ;
+    job.holes = (i < patlen) && (t == NULL);  /*  a zero pattern matches in holes; planned reps can land in one  */
+
+    nt = pool_size(job.nchunks);
+    if ((work = calloc(nt, sizeof(*work))) == NULL) {
+        printf("unable to allocate the 'find' threads; exiting\n");
+        exit(4);
+    }
+    for (i = 0; i < (size_t) nt; i++) work[i].job = &job;
+    if(debug) printf("(debug) find: %zu byte pattern, %" PRIx64 "-%" PRIx64 ", %" PRIu64 " chunk(s), %i thread(s)\n",
+                     patlen, (uint64_t) job.start, (uint64_t) job.end, job.nchunks, nt);
+    nt = pool_run(find_worker, work, sizeof(*work), nt);
+
+    /*  ----------------------------------------------  */
+    /*  gather, sort and report                         */
+    /*  ----------------------------------------------  */
+    for (total = 0, i = 0; i < (size_t) nt; i++) total += work[i].nhits;
+    if ((all = malloc((total ? total : 1) * sizeof(*all))) == NULL) {
+        printf("unable to allocate the 'find' results; exiting\n");
+        exit(4);
+    }
+    for (n = 0, i = 0; i < (size_t) nt; i++) {
+        if (work[i].nhits) memcpy(all + n, work[i].hits, work[i].nhits * sizeof(*all));
+        n += work[i].nhits;
+        free(work[i].hits);
+    }
+    qsort(all, total, sizeof(*all), find_byoff);
+    printf("find\n");
+    for (i = 0; i < total; i++) printf("  found at offset %" PRIx64 "\n", all[i]);
+    if (job.err)
+        printf("*** read error at offset %" PRIx64 " (%s); the search stopped short ***\n",
+               (uint64_t) job.erroff, strerror(job.err));
+    printf("*** %zu match(es) of the %zu byte pattern in %" PRIx64 "-%" PRIx64 " ***\n",
+           total, patlen, (uint64_t) job.start, (uint64_t) job.end);
+    free(all);
+    free(work);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  'sum': a CRC32C, or a 64 bit hash, of a range, for gating a zap  */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The range is cut into SUMCHUNK pieces (counted from the start of    */
+/*  the range) that the pool sums in parallel.  crc32c pieces are put   */
+/*  together with crc32c_combine; fast64 is a hash tree: XXH64 of every */
+/*  1 MiB leaf, then XXH64 of the leaf hashes (seeded with the length), */
+/*  so the answer depends only on the bytes, never on the threads.  An  */
+/*  all-hole piece is not read: its CRC is worked out from its length   */
+/*  and its leaves are the hash of a zeroed leaf.  CRC32C is done with  */
+/*  the SSE4.2 crc32 instruction (or ARMv8 CRC) where the CPU has it,   */
+/*  else eight bytes at a time through tables.                          */
+#define CRC32C_POLY 0x82f63b78    /* reflected Castagnoli polynomial */
+#define SUMLEAF   (1024 * 1024)   /* fast64 leaf size; SUMCHUNK is a multiple of it */
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_x2n[32];  /*  x^(2^n) mod P, for crc32c_combine  */
+static uint32_t (*crc32c_update)(uint32_t crc, const unsigned char *p, size_t n);
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+uint64_t w;
+    while (n && ((uintptr_t) p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xff]         ^ crc32c_table[6][(w >> 8) & 0xff]  ^
+              crc32c_table[5][(w >> 16) & 0xff] ^ crc32c_table[4][(w >> 24) & 0xff] ^
+              crc32c_table[3][(w >> 32) & 0xff] ^ crc32c_table[2][(w >> 40) & 0xff] ^
+              crc32c_table[1][(w >> 48) & 0xff] ^ crc32c_table[0][w >> 56];
+    }
+    while (n--) crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+uint64_t c = crc, w;
+    while (n && ((uintptr_t) p & 7)) {
+        c = _mm_crc32_u8(c, *p++);
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    while (n--) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+uint64_t w;
+    while (n && ((uintptr_t) p & 7)) {
+        crc = __crc32cb(crc, *p++);
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&w, p, 8);
+        crc = __crc32cd(crc, w);
+    }
+    while (n--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+/*  a * b mod P, both polynomials bit reflected (as zlib's multmodp)  */
+static uint32_t crc32c_mult(uint32_t a, uint32_t b) {
+uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/*  x^(8n) mod P: what running n zero bytes through the register multiplies it by  */
+static uint32_t crc32c_zeros_op(uint64_t n) {
+uint32_t p = 1u << 31;  /* x^0 */
+int k = 3;
+    for (; n; n >>= 1, k++)
+        if (n & 1) p = crc32c_mult(crc32c_x2n[k & 31], p);
+    return p;
+}
+
+static void crc32c_init(void) {
+uint32_t c;
+int i, j;
+    if (crc32c_update != NULL) return;
+    for (i = 0; i < 256; i++) {
+        for (c = i, j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xff] ^ (crc32c_table[j - 1][i] >> 8);
+    crc32c_x2n[0] = 1u << 30;  /* x^1 */
+    for (i = 1; i < 32; i++) crc32c_x2n[i] = crc32c_mult(crc32c_x2n[i - 1], crc32c_x2n[i - 1]);
+    crc32c_update = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c_update = crc32c_hw;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc32c_update = crc32c_hw;
+#endif
+    if(debug) printf("(debug) crc32c by %s\n", crc32c_update == crc32c_sw ? "table" : "CRC instruction");
+}
+
+uint32_t crc32c(uint32_t crc, const void *p, size_t n) {
+    crc32c_init();
+    return ~crc32c_update(~crc, p, n);
+}
+
+/*  the CRC of A followed by B, from the CRCs of each and the length of B  */
+uint32_t crc32c_combine(uint32_t crca, uint32_t crcb, uint64_t lenb) {
+    crc32c_init();
+    return crc32c_mult(crc32c_zeros_op(lenb), crca) ^ crcb;
+}
+
+/*  the CRC of n zero bytes, without reading them  */
+static uint32_t crc32c_zeros(uint64_t n) {
+    return crc32c_combine(0xffffffff, 0, n) ^ 0xffffffff;  /* ~0 through n zeros, then inverted */
+}
+
+#define XXH_P1 0x9e3779b185ebca87ULL
+#define XXH_P2 0xc2b2ae3d27d4eb4fULL
+#define XXH_P3 0x165667b19e3779f9ULL
+#define XXH_P4 0x85ebca77c2b2ae63ULL
+#define XXH_P5 0x27d4eb2f165667c5ULL
+#define XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t xxh_round(uint64_t acc, uint64_t in) {
+    acc += in * XXH_P2;
+    acc = XXH_ROTL(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+/*  XXH64, as published; little endian loads  */
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed) {
+const unsigned char *p = buf, *end = p + len;
+uint64_t v[4], h, w;
+uint32_t w32;
+    if (len >= 32) {
+        v[0] = seed + XXH_P1 + XXH_P2;
+        v[1] = seed + XXH_P2;
+        v[2] = seed;
+        v[3] = seed - XXH_P1;
+        for (; p + 32 <= end; p += 32) {
+            memcpy(&w, p, 8);      v[0] = xxh_round(v[0], w);
+            memcpy(&w, p + 8, 8);  v[1] = xxh_round(v[1], w);
+            memcpy(&w, p + 16, 8); v[2] = xxh_round(v[2], w);
+            memcpy(&w, p + 24, 8); v[3] = xxh_round(v[3], w);
+        }
+        h = XXH_ROTL(v[0], 1) + XXH_ROTL(v[1], 7) + XXH_ROTL(v[2], 12) + XXH_ROTL(v[3], 18);
+        h = xxh_merge(xxh_merge(xxh_merge(xxh_merge(h, v[0]), v[1]), v[2]), v[3]);
+    } else h = seed + XXH_P5;
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        memcpy(&w, p, 8);
+        h ^= xxh_round(0, w);
+        h = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end) {
+        memcpy(&w32, p, 4);
+        h ^= (uint64_t) w32 * XXH_P1;
+        h = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * XXH_P5;
+        h = XXH_ROTL(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+typedef struct {
+    int          fd;
+    int          algo;
+    off64_t      start, end;
+    uint64_t     nchunks;
+    uint64_t     next;       /*  the next piece to take (atomically)     */
+    plantarget_t *t;
+    uint32_t     *crc;       /*  crc32c: one per piece                   */
+    uint64_t     *leaf;      /*  fast64: one per leaf                    */
+    uint64_t     zeroleaf;   /*  fast64 of a whole leaf of zeros         */
+    int          err;        /*  errno of the first failed read, or 0    */
+    off64_t      erroff;
+} sumjob_t;
+
+static void sum_piece(sumjob_t *j, uint64_t k, const unsigned char *buf, size_t n) {
+uint64_t l = k * (SUMCHUNK / SUMLEAF);
+size_t   i;
+    if (j->algo == SUM_CRC32C) {
+        j->crc[k] = crc32c(0, buf, n);
+        return;
+    }
+    for (i = 0; i < n; i += SUMLEAF, l++)
+        j->leaf[l] = xxh64(buf + i, (n - i < SUMLEAF) ? n - i : SUMLEAF, 0);
+}
+
+static void *sum_worker(void *arg) {
+sumjob_t *j = *(sumjob_t **) arg;
+uint64_t k, l;
+off64_t  cs, ce, ds, de;
+ssize_t  got;
+char     *buf;
+    if (posix_memalign((void **) &buf, 4096, SUMCHUNK) != 0) {
+        printf("unable to allocate a 'sum' buffer; exiting\n");
+        exit(4);
+    }
+    while ((k = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->nchunks) {
+        if (__atomic_load_n(&j->err, __ATOMIC_RELAXED)) break;
+        cs = j->start + (off64_t) k * SUMCHUNK;
+        ce = (j->end - cs > SUMCHUNK) ? cs + SUMCHUNK : j->end;
+        if (j->t == NULL && !next_data(j->fd, cs, ce, &ds, &de)) {
+            /*  ---------------------------------------  */
+            /*  all hole: no need to read it             */
+            /*  ---------------------------------------  */
+            if (j->algo == SUM_CRC32C) {
+                j->crc[k] = crc32c_zeros(ce - cs);
+                continue;
+            }
+            if (ce - cs == SUMCHUNK) {
+                for (l = 0; l < SUMCHUNK / SUMLEAF; l++) j->leaf[k * (SUMCHUNK / SUMLEAF) + l] = j->zeroleaf;
+                continue;
+            }
+            memset(buf, 0, ce - cs);
+            got = ce - cs;
+        } else got = pread_full(j->fd, buf, ce - cs, cs);
+        if (got != ce - cs) {
+            if (got != -1) errno = EIO;  /*  short: the range runs past the end  */
+            if (__atomic_exchange_n(&j->err, errno, __ATOMIC_RELAXED) == 0) j->erroff = cs + (got > 0 ? got : 0);
+            break;
+        }
+        if (j->t) plan_overlay(j->t, buf, got, cs);
+        sum_piece(j, k, (unsigned char *) buf, got);
+    }
+    free(buf);
+    return NULL;
+}
+
+/*  sum [skip, skip+len) of fd; returns 0 (after saying why) if 'expected' was given and isn't it  */
+int sum_range(int fd, plantarget_t *t, int algo, uint64_t skip, uint64_t len, int haveexp, uint64_t expected) {
+sumjob_t job, **work;
+uint64_t result = 0, k, nleaves = 0;
+off64_t  size, n;
+char     *zero;
+int      i, nt;
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.algo = algo;
+    job.t = t;
+    job.start = skip;
+    job.end = (len > (uint64_t) INT64_MAX - skip) ? INT64_MAX : (off64_t) (skip + len);
+    if ((size = target_size(fd)) != -1 && job.end > size) {
+        printf("*** the range %" PRIx64 "-%" PRIx64 " runs past the end of the file (%" PRIx64 ") ***\n",
+               (uint64_t) job.start, (uint64_t) job.end, (uint64_t) size);
+        if (haveexp) {
+            printf("*** 'sum' cannot be checked; no writes will be performed ***\n");
+            ok_to_write = 0;
+        }
+        return 0;
+    }
+    job.nchunks = (job.end - job.start + SUMCHUNK - 1) / SUMCHUNK;
+    crc32c_init();
+    if (algo == SUM_CRC32C) job.crc = calloc(job.nchunks + 1, sizeof(*job.crc));
+    else {
+        nleaves = (job.end - job.start + SUMLEAF - 1) / SUMLEAF;
+        job.leaf = calloc(nleaves + 1, sizeof(*job.leaf));
+        if ((zero = calloc(1, SUMLEAF)) != NULL) {
+            job.zeroleaf = xxh64(zero, SUMLEAF, 0);
+            free(zero);
+        }
+    }
+    nt = pool_size(job.nchunks);
+    work = calloc(nt, sizeof(*work));
+    if ((job.crc == NULL && job.leaf == NULL) || work == NULL) {
+        printf("unable to allocate the 'sum' tables; exiting\n");
+        exit(4);
+    }
+    for (i = 0; i < nt; i++) work[i] = &job;
+    if(debug) printf("(debug) sum: %" PRIx64 "-%" PRIx64 ", %" PRIu64 " piece(s), %i thread(s)\n",
+                     (uint64_t) job.start, (uint64_t) job.end, job.nchunks, nt);
+    pool_run(sum_worker, work, sizeof(*work), nt);
+    free(work);
+
+    if (job.err) {
+        printf("*** read error at offset %" PRIx64 " (%s); no sum ***\n", (uint64_t) job.erroff, strerror(job.err));
+        if (haveexp) {
+            printf("*** 'sum' cannot be checked; no writes will be performed ***\n");
+            ok_to_write = 0;
+        }
+        free(job.crc);
+        free(job.leaf);
+        return 0;
+    }
+    /*  ----------------------------------------------  */
+    /*  put the pieces together, in order               */
+    /*  ----------------------------------------------  */
+    if (algo == SUM_CRC32C) {
+        for (k = 0; k < job.nchunks; k++) {
+            n = (job.end - job.start - (off64_t) k * SUMCHUNK > SUMCHUNK) ? SUMCHUNK : job.end - job.start - (off64_t) k * SUMCHUNK;
+            result = crc32c_combine(result, job.crc[k], n);
+        }
+        printf("sum crc32c %" PRIx64 "-%" PRIx64 " = %08" PRIx64 "\n", (uint64_t) job.start, (uint64_t) job.end, result);
+    } else {
+        result = xxh64(job.leaf, nleaves * sizeof(*job.leaf), job.end - job.start);
+        printf("sum fast64 %" PRIx64 "-%" PRIx64 " = %016" PRIx64 "\n", (uint64_t) job.start, (uint64_t) job.end, result);
+    }
+    free(job.crc);
+    free(job.leaf);
+    if (haveexp && result != expected) {
+        printf("*** 'sum' discompares (expected %" PRIx64 "); no writes will be performed ***\n", expected);
+        ok_to_write = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  'diff': the ver/rep cards that turn one file into another        */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  Both files are read DIFFCHUNK at a time, at the same offsets, by   */
+/*  the thread pool.  A piece that memcmp finds equal (or that is hole */
+/*  in both) is done with; otherwise it is compared 16 bytes at a time */
+/*  and its differing runs kept, with runs less than DIFFGAP apart     */
+/*  joined.  After the last piece the runs are joined across pieces    */
+/*  and printed as cards, at most DIFFCARD bytes each: every 'ver'     */
+/*  (the old bytes) first, then every 'rep' (the new ones), with a     */
+/*  'name' for the old file ahead of them.  The rest of the output is  */
+/*  comments to szap, so what is printed can be fed straight back in.  */
+typedef struct {
+    off64_t off, end;
+} diffrun_t;
+
+typedef struct {
+    diffrun_t *runs;
+    size_t    nruns, cap;
+} diffpiece_t;
+
+typedef struct {
+    int         fda, fdb;
+    off64_t     start, end;
+    uint64_t    nchunks;
+    uint64_t    next;      /*  the next piece to take (atomically)     */
+    diffpiece_t *piece;    /*  the runs found in each piece            */
+    int         err;       /*  errno of the first failed read, or 0    */
+    off64_t     erroff;
+} diffjob_t;
+
+static void diff_run(diffpiece_t *d, off64_t off, off64_t end) {
+    if (d->nruns && off - d->runs[d->nruns - 1].end < DIFFGAP) {
+        d->runs[d->nruns - 1].end = end;
+        return;
+    }
+    if (d->nruns == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        if ((d->runs = realloc(d->runs, d->cap * sizeof(*d->runs))) == NULL) {
+            printf("unable to allocate the 'diff' results; exiting\n");
+            exit(4);
+        }
+    }
+    d->runs[d->nruns].off = off;
+    d->runs[d->nruns].end = end;
+    d->nruns++;
+}
+
+/*  the differing runs of a and b (n bytes, read at 'base')  */
+static void diff_scan(diffpiece_t *d, const unsigned char *a, const unsigned char *b, size_t n, off64_t base) {
+size_t i = 0, r;
+    while (i < n) {
+        /*  ----------------------------------------------  */
+        /*  skip what is the same, 16 bytes at a time        */
+        /*  ----------------------------------------------  */
+#ifdef __SSE2__
+        for (; i + 16 <= n; i += 16)
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                                 _mm_loadu_si128((const __m128i *) (b + i)))) != 0xffff) break;
+#endif
+        while (i < n && a[i] == b[i]) i++;
+        if (i == n) break;
+        /*  ----------------------------------------------  */
+        /*  and then what isn't                              */
+        /*  ----------------------------------------------  */
+        for (r = i; i < n && a[i] != b[i]; i++) ;
+        diff_run(d, base + r, base + i);
+    }
+}
+
+static void *diff_worker(void *arg) {
+diffjob_t *j = *(diffjob_t **) arg;
+uint64_t  k;
+off64_t   cs, ce, ds, de;
+ssize_t   ga, gb;
+char      *a, *b;
+    if (posix_memalign((void **) &a, 4096, DIFFCHUNK) != 0 || posix_memalign((void **) &b, 4096, DIFFCHUNK) != 0) {
+        printf("unable to allocate a 'diff' buffer; exiting\n");
+        exit(4);
+    }
+    while ((k = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->nchunks) {
+        if (__atomic_load_n(&j->err, __ATOMIC_RELAXED)) break;
+        cs = (j->start / DIFFCHUNK + k) * (off64_t) DIFFCHUNK;
+        ce = cs + DIFFCHUNK;
+        if (cs < j->start) cs = j->start;
+        if (ce > j->end) ce = j->end;
+        if (!next_data(j->fda, cs, ce, &ds, &de) && !next_data(j->fdb, cs, ce, &ds, &de)) continue;
+        ga = pread_full(j->fda, a, ce - cs, cs);
+        gb = (ga == ce - cs) ? pread_full(j->fdb, b, ce - cs, cs) : ga;
+        if (ga != ce - cs || gb != ce - cs) {
+            if (ga != -1 && gb != -1) errno = EIO;  /*  short: one of them got smaller  */
+            if (__atomic_exchange_n(&j->err, errno, __ATOMIC_RELAXED) == 0) j->erroff = cs;
+            break;
+        }
+        if (memcmp(a, b, ce - cs) == 0) continue;
+        diff_scan(&j->piece[k], (unsigned char *) a, (unsigned char *) b, ce - cs, cs);
+    }
+    free(a);
+    free(b);
+    return NULL;
+}
+
+/*  print 'verb' cards for runs[0..n) of fd, DIFFCARD bytes at most each  */
+static void diff_cards(char *verb, int fd, diffrun_t *runs, size_t n) {
+static const char digits[] = "0123456789abcdef";
+unsigned char data[DIFFCARD];
+char    line[2 * DIFFCARD + 64];
+char    *o;
+size_t  i, c, len;
+off64_t off;
+    for (i = 0; i < n; i++) {
+        for (off = runs[i].off; off < runs[i].end; off += len) {
+            len = (runs[i].end - off > DIFFCARD) ? DIFFCARD : runs[i].end - off;
+            if (pread_full(fd, data, len, off) != (ssize_t) len) {
+                printf("*** read error at offset %" PRIx64 "; the cards are incomplete ***\n", (uint64_t) off);
+                return;
+            }
+            o = line + sprintf(line, "%s %" PRIx64 " ", verb, (uint64_t) off);
+            for (c = 0; c < len; c++) {
+                *o++ = digits[data[c] >> 4];
+                *o++ = digits[data[c] & 15];
+            }
+            *o++ = '\n';
+            fwrite(line, 1, o - line, stdout);
+        }
+    }
+}
+
+void diff_files(char *fna, int fda, char *fnb, int fdb, uint64_t start, uint64_t len) {
+diffjob_t job, **work;
+diffrun_t *runs = NULL;
+size_t    nruns = 0, cap = 0, i;
+uint64_t  k, bytes = 0;
+off64_t   sa, sb, size;
+int       nt;
+    memset(&job, 0, sizeof(job));
+    job.fda = fda;
+    job.fdb = fdb;
+    /*  ----------------------------------------------  */
+    /*  only what both files have is compared           */
+    /*  ----------------------------------------------  */
+    sa = target_size(fda);
+    sb = target_size(fdb);
+    if (sa == -1 || sb == -1) {
+        printf("'diff' needs two files or block devices (their sizes must be known); exiting\n");
+        exit(4);
+    }
+    if (sa != sb) printf("*** %s is %" PRIx64 " bytes, %s is %" PRIx64 "; only the first %" PRIx64 " are compared ***\n",
+                         fna, (uint64_t) sa, fnb, (uint64_t) sb, (uint64_t) (sa < sb ? sa : sb));
+    size = sa < sb ? sa : sb;
+    job.start = (start > (uint64_t) size) ? size : (off64_t) start;
+    job.end = (len > (uint64_t) (size - job.start)) ? size : job.start + (off64_t) len;
+    job.nchunks = (job.end > job.start) ? (job.end - 1) / DIFFCHUNK - job.start / DIFFCHUNK + 1 : 0;
+    if ((job.piece = calloc(job.nchunks + 1, sizeof(*job.piece))) == NULL) {
+        printf("unable to allocate the 'diff' tables; exiting\n");
+        exit(4);
+    }
+    nt = pool_size(job.nchunks);
+    if ((work = calloc(nt, sizeof(*work))) == NULL) {
+        printf("unable to allocate the 'diff' threads; exiting\n");
+        exit(4);
+    }
+    for (i = 0; i < (size_t) nt; i++) work[i] = &job;
+    if(debug) printf("(debug) diff: %" PRIx64 "-%" PRIx64 ", %" PRIu64 " piece(s), %i thread(s)\n",
+                     (uint64_t) job.start, (uint64_t) job.end, job.nchunks, nt);
+    if (job.nchunks) pool_run(diff_worker, work, sizeof(*work), nt);
+    free(work);
+    if (job.err) {
+        printf("*** read error at offset %" PRIx64 " (%s); no cards ***\n", (uint64_t) job.erroff, strerror(job.err));
+        for (k = 0; k < job.nchunks; k++) free(job.piece[k].runs);
+        free(job.piece);
+        return;
+    }
+
+    /*  ----------------------------------------------  */
+    /*  join the runs, across pieces too                */
+    /*  ----------------------------------------------  */
+    for (k = 0; k < job.nchunks; k++) {
+        for (i = 0; i < job.piece[k].nruns; i++) {
+            if (nruns && job.piece[k].runs[i].off - runs[nruns - 1].end < DIFFGAP) {
+                runs[nruns - 1].end = job.piece[k].runs[i].end;
+                continue;
+            }
+            if (nruns == cap) {
+                cap = cap ? cap * 2 : 64;
+                if ((runs = realloc(runs, cap * sizeof(*runs))) == NULL) {
+                    printf("unable to allocate the 'diff' results; exiting\n");
+                    exit(4);
+                }
+            }
+            runs[nruns++] = job.piece[k].runs[i];
+        }
+        free(job.piece[k].runs);
+    }
+    free(job.piece);
+    for (i = 0; i < nruns; i++) bytes += runs[i].end - runs[i].off;
+
+    printf("* cards to make %s (%" PRIx64 "-%" PRIx64 ") into %s: %zu range(s), %" PRIu64 " byte(s)\n",
+           fna, (uint64_t) job.start, (uint64_t) job.end, fnb, nruns, bytes);
+    if (nruns) {
+        printf("name %s\n", fna);
+        diff_cards("ver", fda, runs, nruns);
+        diff_cards("rep", fdb, runs, nruns);
+    }
+    printf("* end of diff\n");
+    free(runs);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  'extract' and 'inject': raw bytes between the target and a file  */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  copy_range moves the bytes in the kernel if it can: first with    */
+/*  copy_file_range (a reflink or server side copy where the file     */
+/*  system has one), then sendfile (a device, or across file systems) */
+/*  then splice through a pipe.  Each picks up where the last gave    */
+/*  up.  Only if none of them will do, or the bytes have to be seen   */
+/*  (--direct, or planned reps to lay over them), are they read and   */
+/*  written COPYCHUNK at a time through a buffer.                     */
+static int copy_fallback(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF || err == ESPIPE;
+}
+
+int64_t copy_range(int in, off64_t inoff, int out, off64_t outoff, uint64_t len, plantarget_t *t, const char **how) {
+uint64_t done = 0, want, got;
+loff_t   io, oo;
+ssize_t  n, m;
+uint64_t t0 = 0;
+char     *buf;
+int      pfd[2];
+    n = 0;
+
+    cache_forget(out, outoff, len);
+    if ((t == NULL || t->nreps == 0) && !dio_blocksize(in) && !dio_blocksize(out) && !gz_image(in) && !gz_image(out)) {
+        /*  ----------------------------------------  */
+        /*  copy_file_range                           */
+        /*  ----------------------------------------  */
+        *how = "copy_file_range";
+        while (done < len) {
+            want = (len - done > COPYMAX) ? COPYMAX : len - done;
+            io = inoff + done;
+            oo = outoff + done;
+            if (stats) t0 = stat_now();
+            n = copy_file_range(in, &io, out, &oo, want, 0);
+            if (stats) stat_io(ST_COPY, t0, n, want);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && !copy_fallback(errno)) return -1;
+            if (n == -1) break;
+            if (n == 0) return done;  /* the end of 'in' */
+            done += n;
+        }
+        if (done == len) return done;
+        if(debug) printf("(debug) copy_file_range: %s; trying sendfile\n", strerror(errno));
+        /*  ----------------------------------------  */
+        /*  sendfile, to the output's file position   */
+        /*  ----------------------------------------  */
+        *how = "sendfile";
+        if (lseek64(out, outoff + done, SEEK_SET) != -1) {
+            while (done < len) {
+                want = (len - done > COPYMAX) ? COPYMAX : len - done;
+                io = inoff + done;
+                if (stats) t0 = stat_now();
+                n = sendfile64(out, in, &io, want);
+                if (stats) stat_io(ST_COPY, t0, n, want);
+                if (n == -1 && errno == EINTR) continue;
+                if (n == -1 && !copy_fallback(errno)) return -1;
+                if (n == -1) break;
+                if (n == 0) return done;
+                done += n;
+            }
+            if (done == len) return done;
+        }
+        if(debug) printf("(debug) sendfile: %s; trying splice\n", strerror(errno));
+        /*  ----------------------------------------  */
+        /*  splice, in to a pipe and out again        */
+        /*  ----------------------------------------  */
+        *how = "splice";
+        if (pipe(pfd) == 0) {
+            while (done < len) {
+                want = (len - done > COPYCHUNK) ? COPYCHUNK : len - done;
+                io = inoff + done;
+                if (stats) t0 = stat_now();
+                n = splice(in, &io, pfd[1], NULL, want, SPLICE_F_MOVE);
+                if (stats) stat_io(ST_COPY, t0, n, 0);  /*  (a pipe's worth is not short)  */
+                if (n == -1 && errno == EINTR) continue;
+                if (n <= 0) break;
+                for (got = 0; got < (uint64_t) n; got += m) {
+                    oo = outoff + done + got;
+                    if (stats) t0 = stat_now();
+                    m = splice(pfd[0], NULL, out, &oo, n - got, SPLICE_F_MOVE);
+                    if (stats) stat_io(ST_COPY, t0, m, 0);
+                    if (m == -1 && errno == EINTR) m = 0;
+                    else if (m <= 0) {  /*  what is left in the pipe is lost; start over from the last byte out  */
+                        done += got;
+                        close(pfd[0]);
+                        close(pfd[1]);
+                        if (m == -1 && !copy_fallback(errno)) return -1;
+                        goto buffered;
+                    }
+                }
+                done += n;
+            }
+            close(pfd[0]);
+            close(pfd[1]);
+            if (n == 0 || done == len) return done;
+            if (n == -1 && !copy_fallback(errno)) return -1;
+        }
+        if(debug) printf("(debug) splice: %s; copying through a buffer\n", strerror(errno));
+    }
+buffered:
+    /*  ----------------------------------------  */
+    /*  read and write, COPYCHUNK at a time       */
+    /*  ----------------------------------------  */
+    *how = "pread/pwrite";
+    if (posix_memalign((void **) &buf, 4096, COPYCHUNK) != 0) {
+        printf("unable to allocate a %i byte copy buffer; exiting\n", COPYCHUNK);
+        exit(4);
+    }
+    while (done < len) {
+        want = (len - done > COPYCHUNK) ? COPYCHUNK : len - done;
+        if ((n = pread_full(in, buf, want, inoff + done)) == -1) break;
+        if (t) plan_overlay(t, buf, n, inoff + done);
+        if (n == 0) break;
+        if ((m = pwrite_full(out, buf, n, outoff + done)) != n) {
+            if (m >= 0) errno = EIO;  /* short */
+            n = -1;
+            break;
+        }
+        done += n;
+        if ((uint64_t) n < want) break;
+    }
+    free(buf);
+    return (n == -1) ? -1 : (int64_t) done;
+}
+
+/*  'extract <offset> <length> <outfile>': the bytes, as they are (or, under --plan, will be), into a new file  */
+void extract_range(int fd, plantarget_t *t, uint64_t skip, uint64_t len, char *outfn) {
+const char *how = "";
+int64_t    n;
+int        out, errsv;
+    printf("extract\n");
+    if ((out = open(outfn, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644)) == -1) {
+        errsv = errno;
+        printf("*** '%s' could not be created (%s); no writes will be performed ***\n", outfn, strerror(errsv));
+        ok_to_write = 0;
+        return;
+    }
+    n = copy_range(fd, skip, out, 0, len, t, &how);
+    if (n == -1 || zsync(out) == -1) {
+        errsv = errno;
+        printf("*** extract to '%s' failed (%s); no writes will be performed ***\n", outfn, strerror(errsv));
+        ok_to_write = 0;
+        close(out);
+        return;
+    }
+    close(out);
+    printf("  %" PRIx64 " byte(s) at offset %" PRIx64 " to '%s' (%s)\n", (uint64_t) n, skip, outfn, how);
+    if ((uint64_t) n < len && len != UINT64_MAX)
+        printf("  (the end of the file came first; %" PRIx64 " byte(s) were asked for)\n", len);
+}
+
+/*  'inject <infile> <offset>': all of 'infn' into the target at 'skip' (or, if 'hold', into its plan)  */
+void inject_file(int fd, char *fn, char *infn, uint64_t skip, arena_t *data, int hold) {
+const char *how = "";
+off64_t    size;
+int64_t    n;
+int        in, errsv;
+    if ((in = open(infn, O_RDONLY | O_LARGEFILE)) == -1 || (size = target_size(in)) == -1) {
+        errsv = errno;
+        fprintf(stderr, "The input file '%s' could not be opened\n", infn);
+        fprintf(stderr, " errno is '%i - %s'\n", errsv, strerror(errsv));
+        exit(4);
+    }
+    /*  ----------------------------------------  */
+    /*  --plan and --compile hold it as a 'rep'   */
+    /*  ----------------------------------------  */
+    if (hold) {
+        if (pread_full(in, arena_reserve(data, size), size, 0) != size) {
+            errsv = errno;
+            printf("'%s' could not be read (%s); exiting\n", infn, strerror(errsv));
+            exit(4);
+        }
+        plan_rep(plan_target(fn, fd, 1), skip, data->base, size);
+        close(in);
+        printf("write planned\n");
+        return;
+    }
+    if(ok_to_write) printf("write will be done\n");
+    else            printf("write will NOT be done\n");
+    if (ok_to_write) journal_big(fd, skip, size, 0);
+    if (ok_to_write) {
+        if ((n = copy_range(in, 0, fd, skip, size, NULL, &how)) != size) {
+            errsv = (n == -1) ? errno : EIO;
+            printf("*** inject of '%s' at offset %" PRIx64 " failed (%s) ***\n", infn, skip, strerror(errsv));
+            ok_to_write = 0;
+        } else printf("inject\n  %" PRIx64 " byte(s) from '%s' at offset %" PRIx64 " (%s)\n", (uint64_t) size, infn, skip, how);
+    }
+    close(in);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  'zero', 'fill' and 'copy': big writes with no hex to decode      */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  A range of zeros is left to the kernel where it can: BLKZEROOUT on  */
+/*  a block device (which uses the device's own write-zeroes or unmap   */
+/*  if it has one; BLKDISCARD is not used, as not every device reads    */
+/*  zeros back after it), and on a file, fallocate: PUNCH_HOLE inside   */
+/*  the file (the range becomes a hole), ZERO_RANGE where it runs past  */
+/*  the end.  Anything else, and the unaligned ends of a BLKZEROOUT,    */
+/*  is written from a COPYCHUNK buffer of the pattern, laid out so that */
+/*  every chunk starts with the pattern's first byte.  'copy' moves     */
+/*  bytes within the file with copy_range; ranges that overlap are      */
+/*  copied through a buffer, from the end first if they move up, as     */
+/*  memmove would.  All three are writes like 'rep' (dryrun, --journal)  */
+/*  and under --plan are held as a 'rep', up to HOLDMAX bytes.          */
+static int zero_kernel(int fd, uint64_t off, uint64_t len, uint64_t *head, uint64_t *tail, const char **how) {
+struct stat st;
+uint64_t    range[2];
+uint64_t    t0 = 0;
+int         r;
+    *head = 0;
+    *tail = 0;
+    if (gz_image(fd) || fstat(fd, &st) == -1) return 0;
+    if (S_ISBLK(st.st_mode)) {
+        *head = (512 - (off & 511)) & 511;  /*  BLKZEROOUT wants 512 byte units  */
+        if (*head > len) *head = len;
+        *tail = (len - *head) & 511;
+        range[0] = off + *head;
+        range[1] = len - *head - *tail;
+        if (range[1] == 0) return 0;
+        *how = "BLKZEROOUT";
+        if (stats) t0 = stat_now();
+        r = ioctl(fd, BLKZEROOUT, range);
+        if (stats) stat_io(ST_ZERO, t0, r == -1 ? -1 : (ssize_t) range[1], range[1]);
+        if (r == 0) return 1;
+        *head = *tail = 0;
+        return (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL) ? 0 : -1;
+    }
+    if (!S_ISREG(st.st_mode)) return 0;
+    if (off + len <= (uint64_t) st.st_size) {
+        *how = "fallocate PUNCH_HOLE";
+        if (stats) t0 = stat_now();
+        r = fallocate64(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+        if (stats) stat_io(ST_ZERO, t0, r == -1 ? -1 : (ssize_t) len, len);
+        if (r == 0) return 1;
+        if (errno != EOPNOTSUPP && errno != ENOSYS) return -1;
+    }
+    *how = "fallocate ZERO_RANGE";
+    if (stats) t0 = stat_now();
+    r = fallocate64(fd, FALLOC_FL_ZERO_RANGE, off, len);
+    if (stats) stat_io(ST_ZERO, t0, r == -1 ? -1 : (ssize_t) len, len);
+    if (r == 0) return 1;
+    return (errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL) ? 0 : -1;
+}
+
+/*  'n' bytes of 'pat' repeated, from its first byte  */
+static void fill_pattern(char *buf, size_t n, const char *pat, size_t patlen) {
+size_t k;
+    if (patlen == 1) {
+        memset(buf, pat[0], n);
+        return;
+    }
+    for (k = 0; k < n; k += patlen) memcpy(buf + k, pat, (n - k < patlen) ? n - k : patlen);
+}
+
+/*  the pattern over [off, off+len), through a buffer; 'off' is where the pattern starts  */
+static int fill_buffered(int fd, uint64_t off, uint64_t len, const char *pat, size_t patlen) {
+uint64_t done = 0;
+size_t   chunk, want;
+char     *buf;
+ssize_t  n = 0;
+    chunk = (patlen >= COPYCHUNK) ? patlen : (COPYCHUNK / patlen) * patlen;  /*  whole patterns  */
+    if (chunk > len) chunk = len;
+    if (posix_memalign((void **) &buf, 4096, chunk ? chunk : 1) != 0) {
+        printf("unable to allocate a %zu byte fill buffer; exiting\n", chunk);
+        exit(4);
+    }
+    fill_pattern(buf, chunk, pat, patlen);
+    while (done < len) {
+        want = (len - done > chunk) ? chunk : len - done;
+        if ((n = pwrite_full(fd, buf, want, off + done)) != (ssize_t) want) {
+            if (n >= 0) errno = EIO;  /* short */
+            n = -1;
+            break;
+        }
+        done += want;
+    }
+    free(buf);
+    return (n == -1) ? -1 : 0;
+}
+
+/*  a buffer for --plan to hold 'len' bytes of a big write in (the plan takes a copy, so it's held twice for a moment)  */
+static char *hold_buf(uint64_t len) {
+char *buf;
+    if (len > HOLDMAX || (buf = malloc(len ? len : 1)) == NULL) {
+        printf("%" PRIx64 " bytes are too many to hold under --plan or --compile (at most %x); exiting\n", len, HOLDMAX);
+        exit(4);
+    }
+    return buf;
+}
+
+/*  'zero <offset> <length>' and 'fill <offset> <length> <pattern>'  */
+void fill_range(int fd, char *fn, uint64_t skip, uint64_t len, char *pat, size_t patlen, int hold) {
+const char *how = "pwrite";
+const char *verb;
+uint64_t   head = 0, tail = 0;
+size_t     i;
+char       *buf;
+int        r = 0, errsv, zeros;
+
+    for (i = 0; i < patlen && pat[i] == 0; i++) ;
+    zeros = (i == patlen);
+    verb = (zeros && patlen == 1) ? "zero" : "fill";
+    /*  ----------------------------------------  */
+    /*  --plan and --compile hold it as a 'rep'   */
+    /*  ----------------------------------------  */
+    if (hold) {
+        buf = hold_buf(len);
+        fill_pattern(buf, len, pat, patlen);
+        plan_rep(plan_target(fn, fd, 1), skip, buf, len);
+        free(buf);
+        printf("write planned\n");
+        return;
+    }
+    if(ok_to_write) printf("write will be done\n");
+    else            printf("write will NOT be done\n");
+    if (!ok_to_write || len == 0) return;
+    if (journal_big(fd, skip, len, zeros) == -1) return;
+    cache_forget(fd, skip, len);
+    if (zeros && (r = zero_kernel(fd, skip, len, &head, &tail, &how)) == 1) {
+        /*  just the unaligned ends, if any, by hand  */
+        if (head) r = (fill_buffered(fd, skip, head, pat, 1) == 0) ? 1 : -1;
+        if (r == 1 && tail) r = (fill_buffered(fd, skip + len - tail, tail, pat, 1) == 0) ? 1 : -1;
+    } else if (r == 0) {
+        how = "pwrite";
+        r = (fill_buffered(fd, skip, len, pat, patlen) == 0) ? 1 : -1;
+    }
+    if (r == -1) {
+        errsv = errno;
+        printf("*** %s at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n", verb, skip, strerror(errsv));
+        ok_to_write = 0;
+        return;
+    }
+    printf("%s\n  %" PRIx64 " byte(s) at offset %" PRIx64 " (%s)\n", verb, len, skip, how);
+}
+
+/*  overlapping ranges of one file: COPYCHUNK at a time, in the order that reads every byte before it is written over  */
+static int64_t copy_overlap(int fd, uint64_t src, uint64_t dst, uint64_t len) {
+off64_t  size = target_size(fd);
+uint64_t done, want, pos;
+ssize_t  n;
+char     *buf;
+    if (size != -1) len = (src >= (uint64_t) size) ? 0 : (len > (uint64_t) size - src) ? (uint64_t) size - src : len;
+    if (posix_memalign((void **) &buf, 4096, COPYCHUNK) != 0) {
+        printf("unable to allocate a %i byte copy buffer; exiting\n", COPYCHUNK);
+        exit(4);
+    }
+    for (done = 0; done < len; done += want) {
+        want = (len - done > COPYCHUNK) ? COPYCHUNK : len - done;
+        pos = (dst > src) ? len - done - want : done;  /*  moving up: from the end  */
+        if ((n = pread_full(fd, buf, want, src + pos)) == (ssize_t) want)
+            n = pwrite_full(fd, buf, want, dst + pos);
+        if (n != (ssize_t) want) {
+            if (n >= 0) errno = EIO;  /* short */
+            free(buf);
+            return -1;
+        }
+    }
+    free(buf);
+    return len;
+}
+
+/*  'copy <from> <to> <length>': bytes of the file to another place in it  */
+void copy_within(int fd, char *fn, uint64_t src, uint64_t dst, uint64_t len, int hold) {
+const char   *how = "pread/pwrite";
+plantarget_t *t;
+off64_t      end;
+ssize_t      n;
+size_t       i;
+int64_t      done;
+char         *buf;
+int          errsv;
+    /*  ----------------------------------------  */
+    /*  --plan reads it (as it will be) now and   */
+    /*  holds it as a 'rep'                       */
+    /*  ----------------------------------------  */
+    if (hold) {
+        t = plan_target(fn, fd, 1);
+        if ((end = target_size(fd)) == -1) end = 0;
+        for (i = 0; i < t->nreps; i++)  /*  the end of the file as it will be  */
+            if (t->reps[i].off + (off64_t) t->reps[i].len > end) end = t->reps[i].off + t->reps[i].len;
+        if (src >= (uint64_t) end) len = 0;
+        else if (len > (uint64_t) end - src) len = end - src;
+        buf = hold_buf(len);
+        if ((n = pread_full(fd, buf, len, src)) == -1) {
+            errsv = errno;
+            printf("'copy' could not read offset %" PRIx64 " (%s); exiting\n", src, strerror(errsv));
+            exit(4);
+        }
+        memset(buf + n, 0, len - n);  /*  past the end now; planned reps may fill it  */
+        plan_overlay(t, buf, len, src);
+        plan_rep(t, dst, buf, len);
+        free(buf);
+        printf("write planned\n");
+        return;
+    }
+    if(ok_to_write) printf("write will be done\n");
+    else            printf("write will NOT be done\n");
+    if (!ok_to_write || len == 0 || src == dst) return;
+    if (journal_big(fd, dst, len, 0) == -1) return;
+    if (src < dst + len && dst < src + len) {
+        cache_forget(fd, dst, len);
+        done = copy_overlap(fd, src, dst, len);
+    } else done = copy_range(fd, src, fd, dst, len, NULL, &how);
+    if (done == -1) {
+        errsv = errno;
+        printf("*** copy to offset %" PRIx64 " failed (%s); no further writes will be performed ***\n", dst, strerror(errsv));
+        ok_to_write = 0;
+        return;
+    }
+    printf("copy\n  %" PRIx64 " byte(s) from offset %" PRIx64 " to %" PRIx64 " (%s)\n", (uint64_t) done, src, dst, how);
+    if ((uint64_t) done < len)
+        printf("  (the end of the file came first; %" PRIx64 " byte(s) were asked for)\n", len);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  the open file table: 'name' and 'dump' switch, they don't close  */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  A file is opened the first time a card names it and then left    */
+/*  open, so going back to it costs nothing.  It is found again by    */
+/*  alias, by the path it was opened by, or (one stat, no open) as    */
+/*  the same device or inode under another path.  A file first        */
+/*  opened read only by 'dump' is reopened read/write when a 'name'   */
+/*  card wants it, with dup2 onto the same descriptor, so anything    */
+/*  already holding the descriptor (a plan, an I/O batch) still works. */
+static handle_t *handles = NULL;
+static size_t   nhandles = 0;
+
+static handle_t *handle_find(char *name, struct stat *st, int havest) {
+handle_t *h;
+    for (h = handles; h < handles + nhandles; h++)
+        if (h->alias != NULL && strcmp(h->alias, name) == 0) return h;
+    for (h = handles; h < handles + nhandles; h++)
+        if (strcmp(h->fn, name) == 0) return h;
+    if (!havest) return NULL;
+    for (h = handles; h < handles + nhandles; h++) {
+        if (S_ISBLK(st->st_mode) || S_ISCHR(st->st_mode)) {
+            if (h->rdev == st->st_rdev && h->rdev != 0) return h;
+        } else if (h->dev == st->st_dev && h->ino == st->st_ino) return h;
+    }
+    return NULL;
+}
+
+static handle_t *handle_new(char *fn) {
+handle_t *h;
+    if ((handles = realloc(handles, (nhandles + 1) * sizeof(*handles))) == NULL) {
+        printf("unable to allocate the open file table; exiting\n");
+        exit(4);
+    }
+    h = &handles[nhandles++];
+    memset(h, 0, sizeof(*h));
+    h->fn = strdup(fn);
+    h->fd = -1;
+    return h;
+}
+
+/*  the open handle for 'name' (an alias or a path), read/write if 'rw'; NULL (errno set) if it can't be opened  */
+handle_t *handle_open(char *name, int rw) {
+handle_t    *h;
+struct stat st;
+int         fd, havest;
+
+    havest = (stat(name, &st) == 0);
+    if ((h = handle_find(name, &st, havest)) == NULL) {
+        h = handle_new(name);
+        if (havest) {
+            h->dev = st.st_dev;
+            h->ino = st.st_ino;
+            h->rdev = (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) ? st.st_rdev : 0;
+        }
+    }
+    if (h->fd != -1 && (h->rw || !rw)) return h;
+
+    /*  ------------------------------------------------  */
+    /*  not open yet, or open read only and wanted r/w    */
+    /*  ------------------------------------------------  */
+    if (h->fd != -1) io_flush();  /* nothing in flight on the old descriptor */
+    if ((fd = zopen(h->fn, (rw ? O_RDWR : O_RDONLY) | O_LARGEFILE)) == -1) return NULL;
+    if (h->fd == -1) {
+        h->fd = fd;
+        gz_open(h->fn, fd);  /*  a .gz image is zapped as the image inside it  */
+    } else {
+        if(debug) printf("(debug) reopening %s read/write\n", h->fn);
+        dup2(fd, h->fd);                    /* the r/w open takes over the old number */
+        dio_set(h->fd, dio_blocksize(fd));
+        zclose(fd);
+    }
+    h->rw = rw;
+    if (!havest && fstat(h->fd, &st) == 0) {
+        h->dev = st.st_dev;
+        h->ino = st.st_ino;
+    }
+    return h;
+}
+
+/*  'alias' names 'fn' from now on (opening nothing yet)  */
+void handle_alias(char *alias, char *fn) {
+handle_t    *h;
+struct stat st;
+int         havest;
+    havest = (stat(fn, &st) == 0);
+    if ((h = handle_find(fn, &st, havest)) == NULL) {
+        h = handle_new(fn);
+        if (havest) {
+            h->dev = st.st_dev;
+            h->ino = st.st_ino;
+            h->rdev = (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)) ? st.st_rdev : 0;
+        }
+    }
+    free(h->alias);
+    h->alias = strdup(alias);
+}
+
+/*  the path an alias stands for (or 'name' itself), opening nothing  */
+char *handle_resolve(char *name) {
+handle_t *h = handle_find(name, NULL, 0);
+    return h ? h->fn : name;
+}
+
+/*  the path 'fd' was opened by  */
+char *handle_name(int fd) {
+handle_t *h;
+    for (h = handles; h < handles + nhandles; h++)
+        if (h->fd == fd) return h->fn;
+    return "?";
+}
+
+/*  An offset can be in a partition of the current file, 'p2+400' or    */
+/*  'gpt:esp+10' (libszap parses them).  A file's partition table is    */
+/*  read the first time one is used and kept with its handle, so every  */
+/*  later card, and a deck going back and forth between targets, costs   */
+/*  no I/O; any write over the sectors it came from drops it.            */
+static int nlayouts = 0;  /*  handles with one: a write needn't look if there are none  */
+
+static ssize_t layout_pread(void *arg, void *buf, size_t len, uint64_t off) {
+    return pread_full(*(int *) arg, buf, len, off);
+}
+
+/*  like try_offset, for an offset in 'fd': hex, or in one of its partitions  */
+int try_address(char *p, int fd, uint64_t *v) {
+handle_t *h;
+char     *text;
+size_t   n;
+int      rc;
+    if (!szap_is_symbolic(p)) return try_offset(p, v);
+    for (h = handles; h < handles + nhandles && (fd == -1 || h->fd != fd); h++) ;
+    if (h == handles + nhandles) {
+        printf("offset '%s' is in a partition: it needs a file opened by a 'name' or 'dump' card (not --compile); exiting\n", p);
+        exit(4);
+    }
+    if (h->layout == NULL) {
+        io_flush();  /*  a queued 'rep' may be rewriting the table  */
+        if ((rc = szap_layout_read(layout_pread, &h->fd, &h->layout)) != SZAP_OK) {
+            printf("the partition table of %s could not be read (%s); exiting\n", h->fn,
+                   rc == SZAP_EIO ? strerror(errno) : szap_strerror(rc));
+            exit(4);
+        }
+        nlayouts++;
+        n = szap_layout_print(h->layout, h->fn, NULL, 0);
+        if ((text = malloc(n + 1)) != NULL) {
+            szap_layout_print(h->layout, h->fn, text, n + 1);
+            fputs(text, stdout);
+            free(text);
+        }
+    }
+    if ((rc = szap_layout_offset(h->layout, p, v)) != SZAP_OK) {
+        printf("offset '%s' of %s: %s; exiting\n", p, h->fn,
+               rc == SZAP_EINVAL ? "not a partition and a hex offset, like p2+400" : szap_strerror(rc));
+        exit(4);
+    }
+    if(debug) printf("(debug) %s is offset %" PRIx64 " of %s\n", p, *v, h->fn);
+    return 1;
+}
+
+uint64_t do_address(char *p, int fd) {
+uint64_t ui;
+    if (!try_address(p, fd, &ui)) {
+        printf("offset '%s' is not hex (or in a partition, like p2+400); exiting\n", p);
+        exit(4);
+    }
+    return ui;
+}
+
+/*  [off, off+len) of 'fd' is being written: if its partition table was read from there, read it again next time  */
+void layout_forget(int fd, off64_t off, uint64_t len) {
+handle_t *h;
+    if (nlayouts == 0 || len == 0) return;
+    for (h = handles; h < handles + nhandles; h++) {
+        if (h->fd != fd || h->layout == NULL || !szap_layout_touches(h->layout, off, len)) continue;
+        if(debug) printf("(debug) the write at %" PRIx64 " changes the partition table of %s\n", (uint64_t) off, h->fn);
+        szap_layout_free(h->layout);
+        h->layout = NULL;
+        nlayouts--;
+    }
+}
+
+void handle_closeall(void) {
+handle_t *h;
+    for (h = handles; h < handles + nhandles; h++) {
+        if (h->fd == -1) continue;
+        if(debug) printf("(debug) closing %s\n", h->fn);
+        zclose(h->fd);
+        h->fd = -1;
+    }
+}
+
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*                                                                      */
+/*  --plan: hold the reps, run every ver, then write the reps merged   */
+/*                                                                      */
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*  In plan mode a 'rep' card only records its data against the file   */
+/*  it names.  'ver' cards still run as they are read, but they see the */
+/*  file as it will be with the planned reps in place, and a 'dump' of  */
+/*  a file with planned reps waits until they are written.  After the   */
+/*  last card, if nothing has cleared ok_to_write, each file's reps are */
+/*  sorted, adjacent and overlapping ones are merged (a later card wins */
+/*  over an earlier one), and each merged range goes out in one pwritev */
+/*  (or a few, if it is made of more than IOV_MAX pieces).  A failed    */
+/*  'ver' anywhere in the deck means nothing is written at all.         */
+static plantarget_t *plans = NULL;
+static size_t       nplans = 0;
+static plandump_t   *plandumps = NULL;
+static size_t       nplandumps = 0;
+static unsigned     planseq = 0;
+
+/*  the plan for 'fn' (made, with 'fd', if 'create' and there isn't one), or NULL  */
+plantarget_t *plan_target(char *fn, int fd, int create) {
+size_t i;
+    for (i = 0; i < nplans; i++)
+        if (strcmp(plans[i].fn, fn) == 0) return &plans[i];
+    if (!create) return NULL;
+    if ((plans = realloc(plans, (nplans + 1) * sizeof(*plans))) == NULL) {
+        printf("unable to allocate the plan; exiting\n");
+        exit(4);
+    }
+    memset(&plans[nplans], 0, sizeof(*plans));
+    plans[nplans].fn = strdup(fn);
+    plans[nplans].fd = fd;
+    return &plans[nplans++];
+}
+
+void plan_rep(plantarget_t *t, off64_t off, char *data, size_t len) {
+planrep_t *r;
+    if (len == 0) return;
+    if (t->nreps == t->cap) {
+        t->cap = t->cap ? 2 * t->cap : 64;
+        if ((t->reps = realloc(t->reps, t->cap * sizeof(*t->reps))) == NULL) {
+            printf("unable to allocate the plan; exiting\n");
+            exit(4);
+        }
+    }
+    r = &t->reps[t->nreps++];
+    r->off = off;
+    r->len = len;
+    r->seq = planseq++;
+    if ((r->data = malloc(len)) == NULL) {
+        printf("unable to allocate %zu bytes for a planned rep; exiting\n", len);
+        exit(4);
+    }
+    memcpy(r->data, data, len);
+}
+
+/*  lay the planned reps that touch [off, off+len) over 'buf', in card order  */
+void plan_overlay(plantarget_t *t, char *buf, size_t len, off64_t off) {
+size_t i;
+off64_t from, to;
+planrep_t *r;
+    if (t == NULL) return;
+    for (i = 0; i < t->nreps; i++) {
+        r = &t->reps[i];
+        from = (r->off > off) ? r->off : off;
+        to = (r->off + (off64_t) r->len < off + (off64_t) len) ? r->off + (off64_t) r->len : off + (off64_t) len;
+        if (from < to) memcpy(buf + (from - off), r->data + (from - r->off), to - from);
+    }
+}
+
+void plan_dump(char *fn, uint64_t len, uint64_t skip) {
+    if ((plandumps = realloc(plandumps, (nplandumps + 1) * sizeof(*plandumps))) == NULL) {
+        printf("unable to allocate the plan; exiting\n");
+        exit(4);
+    }
+    plandumps[nplandumps].fn = strdup(fn);
+    plandumps[nplandumps].len = len;
+    plandumps[nplandumps].skip = skip;
+    nplandumps++;
+}
+
+static int plan_byoff(const void *a, const void *b) {
+const planrep_t *x = a, *y = b;
+    if (x->off != y->off) return (x->off < y->off) ? -1 : 1;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static int plan_byseq(const void *a, const void *b) {
+const planrep_t *x = a, *y = b;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+void plan_commit(void) {
+plantarget_t *t;
+planrep_t    *r, *grp = NULL;
+struct iovec *iov = NULL;
+size_t  i, j, k, n, ranges, calls, bytes, want;
+ssize_t got;
+off64_t start, end, at;
+handle_t *h;
+int     overlap, cnt, m, errsv;
+char    *merged;
+
+    for (t = plans; t < plans + nplans; t++) {
+        qsort(t->reps, t->nreps, sizeof(*t->reps), plan_byoff);
+        /*  ------------------------------------------------  */
+        /*  --journal: every range's old bytes, all of the    */
+        /*  plan in one batch, before anything is written     */
+        /*  ------------------------------------------------  */
+        for (i = 0; journal && ok_to_write && i < t->nreps; i = j) {
+            end = t->reps[i].off + t->reps[i].len;
+            for (j = i + 1; j < t->nreps && t->reps[j].off <= end; j++)
+                if (t->reps[j].off + (off64_t) t->reps[j].len > end) end = t->reps[j].off + t->reps[j].len;
+            journal_range(t->fd, t->reps[i].off, end - t->reps[i].off);
+        }
+    }
+    if (ok_to_write) journal_commit();
+
+    for (t = plans; t < plans + nplans; t++) {
+        printf("*** plan for %s: %zu rep(s) ***\n", t->fn, t->nreps);
+        if (!ok_to_write) {
+            printf("*** a 'ver' failed (or dryrun is set); none of them will be written ***\n");
+            continue;
+        }
+        iov = realloc(iov, (t->nreps ? t->nreps : 1) * sizeof(*iov));
+        grp = realloc(grp, (t->nreps ? t->nreps : 1) * sizeof(*grp));
+        if (iov == NULL || grp == NULL) {
+            printf("unable to allocate the plan; exiting\n");
+            exit(4);
+        }
+        ranges = calls = bytes = 0;
+        for (i = 0; i < t->nreps; i = j) {
+            /*  --------------------------------------------  */
+            /*  gather the reps that touch or overlap this one  */
+            /*  --------------------------------------------  */
+            start = t->reps[i].off;
+            end = start + t->reps[i].len;
+            overlap = 0;
+            for (j = i + 1; j < t->nreps && t->reps[j].off <= end; j++) {
+                if (t->reps[j].off < end) overlap = 1;
+                if (t->reps[j].off + (off64_t) t->reps[j].len > end) end = t->reps[j].off + t->reps[j].len;
+            }
+            ranges++;
+            /*  --------------------------------------------  */
+            /*  overlapping reps are flattened, in card order,  */
+            /*  into one buffer; merely adjacent ones go out    */
+            /*  as they are, one iovec each                     */
+            /*  --------------------------------------------  */
+            merged = NULL;
+            if (overlap) {
+                if ((merged = malloc(end - start)) == NULL) {
+                    printf("unable to allocate %zu bytes to merge reps; exiting\n", (size_t) (end - start));
+                    exit(4);
+                }
+                memcpy(grp, &t->reps[i], (j - i) * sizeof(*grp));
+                qsort(grp, j - i, sizeof(*grp), plan_byseq);
+                for (k = 0; k < j - i; k++) memcpy(merged + (grp[k].off - start), grp[k].data, grp[k].len);
+                iov[0].iov_base = merged;
+                iov[0].iov_len = end - start;
+                n = 1;
+            } else {
+                for (n = 0, r = &t->reps[i]; r < &t->reps[j]; r++, n++) {
+                    iov[n].iov_base = r->data;
+                    iov[n].iov_len = r->len;
+                }
+            }
+            if(debug) printf("(debug) %s: writing %" PRIx64 "-%" PRIx64 " from %zu rep(s)\n",
+                             t->fn, (uint64_t) start, (uint64_t) end, j - i);
+            for (k = 0, at = start; k < n; k += cnt) {
+                cnt = (n - k > IOV_MAX) ? IOV_MAX : n - k;
+                for (m = 0, want = 0; m < cnt; m++) want += iov[k + m].iov_len;
+                cache_forget(t->fd, at, end - at);
+                if ((got = pwritev_full(t->fd, &iov[k], cnt, at)) != (ssize_t) want) {
+                    errsv = (got == -1) ? errno : EIO;  /*  short: the device is full, or gone  */
+                    printf("*** write at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n",
+                           (uint64_t) at, strerror(errsv));
+                    ok_to_write = 0;
+                    break;
+                }
+                calls++;
+                at += want;
+                bytes += want;
+            }
+            free(merged);
+            if (!ok_to_write) break;
+        }
+        printf("*** %s: %zu bytes written in %zu range(s) with %zu pwritev call(s) ***\n",
+               t->fn, bytes, ranges, calls);
+    }
+    free(iov);
+    free(grp);
+
+    /*  ---------------------------------------------  */
+    /*  the dumps that were waiting for the writes     */
+    /*  ---------------------------------------------  */
+    for (i = 0; i < nplandumps; i++) {
+        printf("> (deferred) dump %s %" PRIx64 " %" PRIx64 "\n", plandumps[i].fn, plandumps[i].len, plandumps[i].skip);
+        if ((h = handle_open(plandumps[i].fn, 0)) == NULL) {
+            perror("open");
+            printf("(filename=%s)\n", plandumps[i].fn);
+            continue;
+        }
+        dump_range(h->fd, plandumps[i].len, plandumps[i].skip);
+    }
+}
+
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*                                                                      */
+/*  --compile / --apply: a deck, decoded once, as a binary patch file   */
+/*                                                                      */
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*  --compile keeps the deck's 'ver' and 'rep' cards the way --plan     */
+/*  keeps its reps, then writes each file's as sorted, merged ranges:   */
+/*  the reps flattened as plan_commit would write them, the vers joined */
+/*  where they touch.  Where a 'ver' checks bytes an earlier 'rep'      */
+/*  wrote, it is settled there and then (a 'ver' that would always fail */
+/*  is an error), so what is left of it is checked against the file as  */
+/*  it was, and --apply can run every ver before any rep.  The file is  */
+/*  a patchhdr_t (with a CRC32C of the rest), then for each file a      */
+/*  patchtgt_t, the path (to 8 bytes), its ranges (vers, then reps) and */
+/*  their data, in the same order (to 8 bytes).  --apply maps it and    */
+/*  works straight from the map.  Numbers are in the compiling          */
+/*  machine's byte order; 'order' lets another machine tell.            */
+#define PATCH_MAGIC "SZAPPAT\001"
+#define PATCH_ORDER 0x01020304
+
+typedef struct {
+    char     magic[8];
+    uint32_t crc;       /*  crc32c of everything after this header  */
+    uint32_t order;     /*  PATCH_ORDER                             */
+    uint64_t size;      /*  of the whole file                       */
+    uint32_t ntargets;
+    uint32_t cards;     /*  'ver'/'rep' cards compiled              */
+} patchhdr_t;
+
+typedef struct {
+    uint32_t pathlen;
+    uint32_t pad;
+    uint64_t nvers, nreps;
+    uint64_t bytes;     /*  of data, without the padding            */
+} patchtgt_t;
+
+typedef struct {
+    uint64_t off, len;
+} patchrange_t;
+
+typedef struct {        /*  a range being put together  */
+    off64_t off;
+    size_t  len;
+    char    *data;
+} patchrun_t;
+
+void plan_ver(plantarget_t *t, off64_t off, char *data, size_t len) {
+planrep_t *v;
+    if (len == 0) return;
+    if (t->nvers == t->vcap) {
+        t->vcap = t->vcap ? 2 * t->vcap : 64;
+        if ((t->vers = realloc(t->vers, t->vcap * sizeof(*t->vers))) == NULL) {
+            printf("unable to allocate the plan; exiting\n");
+            exit(4);
+        }
+    }
+    v = &t->vers[t->nvers++];
+    v->off = off;
+    v->len = len;
+    v->seq = planseq++;
+    if ((v->data = malloc(len)) == NULL) {
+        printf("unable to allocate %zu bytes for a compiled ver; exiting\n", len);
+        exit(4);
+    }
+    memcpy(v->data, data, len);
+}
+
+static void patch_run(patchrun_t **runs, size_t *n, size_t *cap, off64_t off, size_t len, char *data) {
+    if (*n == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        if ((*runs = realloc(*runs, *cap * sizeof(**runs))) == NULL) {
+            printf("unable to allocate the patch; exiting\n");
+            exit(4);
+        }
+    }
+    (*runs)[*n].off = off;
+    (*runs)[*n].len = len;
+    (*runs)[*n].data = data;
+    (*n)++;
+}
+
+static int patch_byoff(const void *a, const void *b) {
+const patchrun_t *x = a, *y = b;
+    return (x->off > y->off) - (x->off < y->off);
+}
+
+static int patch_byseq(const void *a, const void *b) {
+const planrep_t *x = *(planrep_t * const *) a, *y = *(planrep_t * const *) b;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static void patch_put(FILE *f, const void *p, size_t n, uint32_t *crc, uint64_t *size) {
+static const char zeros[8];
+    if (p == NULL) p = zeros;
+    if (n && fwrite(p, 1, n, f) != n) {
+        perror("compile");
+        exit(4);
+    }
+    *crc = crc32c(*crc, p, n);
+    *size += n;
+}
+
+/*  write every plan's vers and reps to 'out'  */
+void patch_write(char *out) {
+plantarget_t *t;
+planrep_t    *r, **grp = NULL;
+patchrun_t   *reps = NULL, *vers = NULL, *pieces = NULL;
+size_t       nreps, nvers, npieces, rcap = 0, vcap = 0, pcap = 0, ngrp;
+size_t       i, j, k, m;
+off64_t      end, *maxend = NULL, from, to;
+patchhdr_t   hdr;
+patchtgt_t   tgt;
+patchrange_t pr;
+uint64_t     size = 0, vbytes, rbytes, totv = 0, totr = 0;
+uint32_t     crc = 0, cards = 0;
+char         *merged, *covered;
+FILE         *f;
+
+    if ((f = fopen(out, "wb")) == NULL) {
+        perror("compile");
+        printf("(filename=%s)\n", out);
+        exit(4);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {  /*  filled in at the end  */
+        perror("compile");
+        exit(4);
+    }
+    for (t = plans; t < plans + nplans; t++) {
+        cards += t->nvers + t->nreps;
+        /*  ----------------------------------------------  */
+        /*  the reps, flattened as plan_commit writes them  */
+        /*  ----------------------------------------------  */
+        qsort(t->reps, t->nreps, sizeof(*t->reps), plan_byoff);
+        maxend = realloc(maxend, (t->nreps + 1) * sizeof(*maxend));
+        grp = realloc(grp, (t->nreps + 1) * sizeof(*grp));
+        if (maxend == NULL || grp == NULL) {
+            printf("unable to allocate the patch; exiting\n");
+            exit(4);
+        }
+        for (i = 0; i < t->nreps; i++) {
+            end = t->reps[i].off + t->reps[i].len;
+            maxend[i] = (i && maxend[i - 1] > end) ? maxend[i - 1] : end;
+        }
+        for (nreps = 0, i = 0; i < t->nreps; i = j) {
+            end = t->reps[i].off + t->reps[i].len;
+            for (j = i + 1; j < t->nreps && t->reps[j].off <= end; j++)
+                if (t->reps[j].off + (off64_t) t->reps[j].len > end) end = t->reps[j].off + t->reps[j].len;
+            if ((merged = malloc(end - t->reps[i].off)) == NULL) {
+                printf("unable to allocate the patch; exiting\n");
+                exit(4);
+            }
+            for (k = 0; k < j - i; k++) grp[k] = &t->reps[i + k];
+            qsort(grp, j - i, sizeof(*grp), patch_byseq);  /*  in card order: the later wins  */
+            for (k = 0; k < j - i; k++) memcpy(merged + (grp[k]->off - t->reps[i].off), grp[k]->data, grp[k]->len);
+            patch_run(&reps, &nreps, &rcap, t->reps[i].off, end - t->reps[i].off, merged);
+        }
+
+        /*  ----------------------------------------------  */
+        /*  each ver, less what earlier reps settle         */
+        /*  ----------------------------------------------  */
+        for (npieces = 0, i = 0; i < t->nvers; i++) {
+            r = &t->vers[i];
+            end = r->off + r->len;
+            /*  the earlier reps that overlap it, in card order  */
+            for (ngrp = 0, k = t->nreps; k-- > 0 && maxend[k] > r->off; )
+                if (t->reps[k].off < end && t->reps[k].off + (off64_t) t->reps[k].len > r->off && t->reps[k].seq < r->seq)
+                    grp[ngrp++] = &t->reps[k];
+            if (ngrp == 0) {
+                patch_run(&pieces, &npieces, &pcap, r->off, r->len, r->data);
+                continue;
+            }
+            qsort(grp, ngrp, sizeof(*grp), patch_byseq);
+            if ((merged = malloc(2 * r->len)) == NULL) {
+                printf("unable to allocate the patch; exiting\n");
+                exit(4);
+            }
+            covered = merged + r->len;
+            memset(covered, 0, r->len);
+            for (k = 0; k < ngrp; k++) {
+                from = grp[k]->off > r->off ? grp[k]->off : r->off;
+                to = grp[k]->off + (off64_t) grp[k]->len < end ? grp[k]->off + (off64_t) grp[k]->len : end;
+                memcpy(merged + (from - r->off), grp[k]->data + (from - grp[k]->off), to - from);
+                memset(covered + (from - r->off), 1, to - from);
+            }
+            for (k = 0; k < r->len; k = m) {
+                if (covered[k]) {
+                    if (merged[k] != r->data[k]) {
+                        printf("*** %s: the ver at %" PRIx64 " checks byte %" PRIx64 ", which an earlier rep sets to %02x, for %02x; it would always fail; exiting ***\n",
+                               t->fn, (uint64_t) r->off, (uint64_t) (r->off + k), (unsigned char) merged[k], (unsigned char) r->data[k]);
+                        exit(4);
+                    }
+                    m = k + 1;
+                    continue;
+                }
+                for (m = k; m < r->len && !covered[m]; m++) ;
+                patch_run(&pieces, &npieces, &pcap, r->off + k, m - k, r->data + k);
+            }
+            free(merged);
+        }
+        /*  ----------------------------------------------  */
+        /*  sorted, and joined where they touch             */
+        /*  ----------------------------------------------  */
+        qsort(pieces, npieces, sizeof(*pieces), patch_byoff);
+        for (nvers = 0, i = 0; i < npieces; i = j) {
+            end = pieces[i].off + pieces[i].len;
+            for (j = i + 1; j < npieces && pieces[j].off <= end; j++)
+                if (pieces[j].off + (off64_t) pieces[j].len > end) end = pieces[j].off + pieces[j].len;
+            if ((merged = malloc(end - pieces[i].off)) == NULL) {
+                printf("unable to allocate the patch; exiting\n");
+                exit(4);
+            }
+            for (to = pieces[i].off, k = i; k < j; k++) {
+                from = pieces[k].off;
+                m = (from + (off64_t) pieces[k].len > to) ? (size_t) (to - from) : pieces[k].len;
+                if (memcmp(merged + (from - pieces[i].off), pieces[k].data, m) != 0) {
+                    printf("*** %s: two vers around %" PRIx64 " want different bytes; they could never both pass; exiting ***\n",
+                           t->fn, (uint64_t) from);
+                    exit(4);
+                }
+                memcpy(merged + (from - pieces[i].off), pieces[k].data, pieces[k].len);
+                if (from + (off64_t) pieces[k].len > to) to = from + pieces[k].len;
+            }
+            patch_run(&vers, &nvers, &vcap, pieces[i].off, end - pieces[i].off, merged);
+        }
+
+        /*  ----------------------------------------------  */
+        /*  and out they go                                 */
+        /*  ----------------------------------------------  */
+        for (vbytes = 0, i = 0; i < nvers; i++) vbytes += vers[i].len;
+        for (rbytes = 0, i = 0; i < nreps; i++) rbytes += reps[i].len;
+        memset(&tgt, 0, sizeof(tgt));
+        tgt.pathlen = strlen(t->fn);
+        tgt.nvers = nvers;
+        tgt.nreps = nreps;
+        tgt.bytes = vbytes + rbytes;
+        patch_put(f, &tgt, sizeof(tgt), &crc, &size);
+        patch_put(f, t->fn, tgt.pathlen, &crc, &size);
+        patch_put(f, NULL, -tgt.pathlen & 7, &crc, &size);
+        for (i = 0; i < nvers + nreps; i++) {
+            pr.off = (i < nvers) ? vers[i].off : reps[i - nvers].off;
+            pr.len = (i < nvers) ? vers[i].len : reps[i - nvers].len;
+            patch_put(f, &pr, sizeof(pr), &crc, &size);
+        }
+        for (i = 0; i < nvers; i++) patch_put(f, vers[i].data, vers[i].len, &crc, &size);
+        for (i = 0; i < nreps; i++) patch_put(f, reps[i].data, reps[i].len, &crc, &size);
+        patch_put(f, NULL, -tgt.bytes & 7, &crc, &size);
+        printf("*** %s: %zu ver range(s) (%" PRIu64 " bytes), %zu rep range(s) (%" PRIu64 " bytes) ***\n",
+               t->fn, nvers, vbytes, nreps, rbytes);
+        for (i = 0; i < nvers; i++) free(vers[i].data);
+        for (i = 0; i < nreps; i++) free(reps[i].data);
+        totv += nvers;
+        totr += nreps;
+    }
+    memcpy(hdr.magic, PATCH_MAGIC, 8);
+    hdr.crc = crc;
+    hdr.order = PATCH_ORDER;
+    hdr.size = size + sizeof(hdr);
+    hdr.ntargets = nplans;
+    hdr.cards = cards;
+    if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1 || fclose(f) != 0) {
+        perror("compile");
+        exit(4);
+    }
+    printf("*** compiled %u card(s) for %zu file(s) into %s: %" PRIu64 " ver and %" PRIu64 " rep range(s), %" PRIu64 " bytes ***\n",
+           cards, nplans, out, totv, totr, hdr.size);
+    free(reps);
+    free(vers);
+    free(pieces);
+    free(maxend);
+    free(grp);
+}
+
+/*  the file entry at 'p': sets its header, ranges and data; returns the next one, or NULL if it runs past 'end'  */
+static char *patch_next(char *p, char *end, patchtgt_t **tgt, patchrange_t **pr, char **data) {
+uint64_t n, k, sum;
+    *tgt = (patchtgt_t *) p;
+    if (end - p < (off64_t) sizeof(**tgt)) return NULL;
+    n = sizeof(**tgt) + (((uint64_t) (*tgt)->pathlen + 7) & ~(uint64_t) 7);
+    if ((*tgt)->nvers + (*tgt)->nreps > (uint64_t) (end - p) / sizeof(**pr)) return NULL;
+    *pr = (patchrange_t *) (p + n);
+    n += ((*tgt)->nvers + (*tgt)->nreps) * sizeof(**pr);
+    *data = p + n;
+    if ((*tgt)->bytes > (uint64_t) (end - p) || n + (((*tgt)->bytes + 7) & ~(uint64_t) 7) > (uint64_t) (end - p)) return NULL;
+    /*  the ranges' data has to be exactly what is there: --apply steps through it on their lengths  */
+    for (sum = 0, k = 0; k < (*tgt)->nvers + (*tgt)->nreps; k++) {
+        if ((*pr)[k].len > (*tgt)->bytes - sum) return NULL;
+        sum += (*pr)[k].len;
+    }
+    if (sum != (*tgt)->bytes) return NULL;
+    return *data + (((*tgt)->bytes + 7) & ~(uint64_t) 7);
+}
+
+/*  --apply: check a compiled patch, run its vers, and if they all pass, its reps  */
+void patch_apply(char *fn) {
+struct stat  st;
+patchhdr_t   *hdr;
+patchtgt_t   *tgt;
+patchrange_t *pr;
+char         *map, *end, *p, *data, *path;
+arena_t      disk = { NULL, 0 };
+int          fd, *fds, pass, errsv;
+uint32_t     i;
+uint64_t     k, vers = 0, reps = 0, bytes = 0;
+handle_t     *h;
+ssize_t      got;
+
+    if ((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        perror("apply");
+        printf("(filename=%s)\n", fn);
+        exit(4);
+    }
+    if (st.st_size < (off_t) sizeof(*hdr)
+        || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+        || memcmp(map, PATCH_MAGIC, 8) != 0) {
+        printf("'%s' is not a compiled patch; exiting\n", fn);
+        exit(4);
+    }
+    close(fd);
+    hdr = (patchhdr_t *) map;
+    end = map + st.st_size;
+    if (hdr->order != PATCH_ORDER) {
+        printf("'%s' was compiled on a machine of the other byte order; exiting\n", fn);
+        exit(4);
+    }
+    if (hdr->size != (uint64_t) st.st_size || crc32c(0, map + sizeof(*hdr), st.st_size - sizeof(*hdr)) != hdr->crc) {
+        printf("'%s' is damaged (its size or checksum is wrong); exiting\n", fn);
+        exit(4);
+    }
+    for (p = map + sizeof(*hdr), i = 0; i < hdr->ntargets; i++)
+        if ((p = patch_next(p, end, &tgt, &pr, &data)) == NULL) {
+            printf("'%s' is damaged (file %u runs past the end, or its ranges don't add up); exiting\n", fn, i);
+            exit(4);
+        }
+    printf("apply %s: %u card(s) for %u file(s)\n", fn, hdr->cards, hdr->ntargets);
+    if ((fds = calloc(hdr->ntargets + 1, sizeof(*fds))) == NULL) {
+        printf("unable to allocate the file table; exiting\n");
+        exit(4);
+    }
+
+    /*  ----------------------------------------------  */
+    /*  every ver, in every file, first                 */
+    /*  ----------------------------------------------  */
+    for (p = map + sizeof(*hdr), i = 0; i < hdr->ntargets; i++) {
+        p = patch_next(p, end, &tgt, &pr, &data);
+        path = strndup((char *) (tgt + 1), tgt->pathlen);
+        if ((h = handle_open(path, tgt->nreps > 0)) == NULL) {
+            errsv = errno;
+            printf("*** %s could not be opened (%s); no writes will be performed ***\n", path, strerror(errsv));
+            ok_to_write = 0;
+            fds[i] = -1;
+            free(path);
+            continue;
+        }
+        fds[i] = h->fd;
+        for (k = 0; k < tgt->nvers; k++) {
+            got = pread_full(fds[i], arena_reserve(&disk, pr[k].len), pr[k].len, pr[k].off);
+            if (got != (ssize_t) pr[k].len || memcmp(disk.base, data, pr[k].len) != 0) {
+                printf("*** %s: 'data' at offset %" PRIx64 " discompares; no writes will be performed ***\n", path, pr[k].off);
+                hexDump("hexDump of data in named file", disk.base, got < 0 ? 0 : got, pr[k].off);
+                hexDumpEnd();
+                ok_to_write = 0;
+            }
+            data += pr[k].len;
+            vers++;
+        }
+        free(path);
+    }
+    if (!ok_to_write) printf("write will NOT be done\n");
+
+    /*  ----------------------------------------------  */
+    /*  then the reps: journaled (if asked) all in one  */
+    /*  batch on the first pass, written on the second  */
+    /*  ----------------------------------------------  */
+    for (pass = 0; ok_to_write && pass < 2; pass++) {
+        for (p = map + sizeof(*hdr), i = 0; ok_to_write && i < hdr->ntargets; i++) {
+            p = patch_next(p, end, &tgt, &pr, &data);
+            for (k = 0; k < tgt->nvers; k++) data += pr[k].len;
+            for (; k < tgt->nvers + tgt->nreps; data += pr[k].len, k++) {
+                if (pass == 0) {
+                    journal_range(fds[i], pr[k].off, pr[k].len);
+                    continue;
+                }
+                if (pwrite_full(fds[i], data, pr[k].len, pr[k].off) != (ssize_t) pr[k].len) {
+                    errsv = errno;
+                    printf("*** write at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n",
+                           pr[k].off, strerror(errsv));
+                    ok_to_write = 0;
+                    break;
+                }
+                reps++;
+                bytes += pr[k].len;
+            }
+        }
+        if (pass == 0) journal_commit();
+    }
+    printf("*** %" PRIu64 " ver range(s) checked, %" PRIu64 " rep range(s) (%" PRIu64 " bytes) written ***\n", vers, reps, bytes);
+    munmap(map, st.st_size);
+    free(disk.base);
+    free(fds);
+}
+
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*                                                                 */
+/*  --journal: what every write is about to overwrite, kept first  */
+/*                                                                 */
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*  Before a batch of writes (a run of 'rep' cards, or the merged      */
+/*  ranges of a --plan) is started, the bytes each one will cover are  */
+/*  read and appended to the journal, one record apiece, with a single */
+/*  write and a single fdatasync for the whole batch.  The files       */
+/*  written get one fdatasync each at the end of the run.  A record is */
+/*  a jrec_t, then the path, then the old bytes; its CRC32C covers all */
+/*  three, so a record torn by a crash (whose batch was never started) */
+/*  is recognised.  'undo <journal>' puts the old bytes back, last     */
+/*  record first, and cuts a file that a write made longer back to the */
+/*  size it was.  Numbers are in the byte order of the machine.  The   */
+/*  journal file isn't emptied until the first batch goes in (or the    */
+/*  run ends), so an 'undo' of it in the same run is refused before     */
+/*  anything in it is lost.                                             */
+#define JNL_MAGIC "SZAPJNL\001"
+#define JNL_REC   0x524a5a53      /* "SZJR" */
+#define JNLCHUNK  (64 * 1024 * 1024)  /* most old bytes in one batch of a big write */
+
+typedef struct {
+    uint32_t magic;    /*  JNL_REC                                            */
+    uint32_t crc;      /*  crc32c of the rest of this, the path and the data  */
+    uint64_t off;
+    uint64_t len;      /*  old bytes that follow the path                     */
+    int64_t  size;     /*  the file's size before the write, or -1            */
+    uint32_t pathlen;
+    uint32_t pad;
+} jrec_t;
+
+static int      jfd = -1;
+static int      jstarted = 0;        /*  emptied, and the magic written  */
+static char     *jname;
+static arena_t  jbuf = { NULL, 0 };  /*  the batch being put together  */
+static size_t   jlen = 0;
+static int      *jfds = NULL;        /*  files written, for the final flush  */
+static size_t   njfds = 0;
+static uint64_t jrecs = 0, jbytes = 0, jbatches = 0;
+
+void journal_open(char *fn) {
+char *dir, *slash;
+int  dfd;
+    if ((jfd = open(fn, O_WRONLY | O_CREAT, 0600)) == -1) {
+        perror("journal");
+        printf("(filename=%s)\n", fn);
+        exit(4);
+    }
+    jname = strdup(fn);
+    /*  the new journal's directory entry has to last too  */
+    dir = strdup(fn);
+    if ((slash = strrchr(dir, '/')) != NULL) slash[slash == dir] = '\0';
+    if ((dfd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY)) != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+    free(dir);
+    journal = 1;
+}
+
+/*  what was in the journal file goes, and the magic starts it; 0, or -1  */
+static int journal_start(void) {
+    if (jstarted) return 0;
+    if (ftruncate(jfd, 0) == -1 || write(jfd, JNL_MAGIC, 8) != 8) return -1;
+    jstarted = 1;
+    return 0;
+}
+
+/*  add a record of [off, off+len) of fd, as it is now, to the batch  */
+void journal_range(int fd, off64_t off, size_t len) {
+jrec_t  r;
+char    *path, *p;
+ssize_t got;
+size_t  i;
+    if (!journal) return;
+    if ((path = realpath(handle_name(fd), NULL)) == NULL) path = strdup(handle_name(fd));
+    memset(&r, 0, sizeof(r));
+    r.magic = JNL_REC;
+    r.off = off;
+    r.size = target_size(fd);
+    r.pathlen = strlen(path);
+    p = arena_reserve(&jbuf, jlen + sizeof(r) + r.pathlen + len);
+    if ((got = pread_full(fd, p + jlen + sizeof(r) + r.pathlen, len, off)) == -1) got = 0;
+    r.len = got;
+    memcpy(p + jlen + sizeof(r), path, r.pathlen);
+    memcpy(p + jlen, &r, sizeof(r));
+    r.crc = crc32c(0, p + jlen + 8, sizeof(r) - 8 + r.pathlen + r.len);
+    memcpy(p + jlen, &r, sizeof(r));  /*  (copied, not cast: the paths aren't padded, so a header may be anywhere)  */
+    jlen += sizeof(r) + r.pathlen + r.len;
+    jrecs++;
+    jbytes += r.len;
+    free(path);
+    for (i = 0; i < njfds && jfds[i] != fd; i++) ;
+    if (i == njfds) {
+        if ((jfds = realloc(jfds, (njfds + 1) * sizeof(*jfds))) == NULL) {
+            printf("unable to allocate the journal; exiting\n");
+            exit(4);
+        }
+        jfds[njfds++] = fd;
+    }
+}
+
+/*  write the batch to the journal and make it stick; 0, or -1 (and no writes from here on)  */
+int journal_commit(void) {
+int errsv;
+ssize_t n;
+uint64_t t0 = 0;
+    if (!journal || jlen == 0) return 0;
+    if (journal_start() == -1) n = -1;
+    else {
+        if (stats) t0 = stat_now();
+        n = write(jfd, jbuf.base, jlen);
+        if (stats) stat_io(ST_WRITE, t0, n, jlen);
+    }
+    if (n != (ssize_t) jlen || zsync(jfd) == -1) {
+        errsv = errno;
+        printf("*** the journal could not be written (%s); no writes will be performed ***\n", strerror(errsv));
+        ok_to_write = 0;
+        jlen = 0;
+        return -1;
+    }
+    if(debug) printf("(debug) journal: batch of %zu bytes synced\n", jlen);
+    jlen = 0;
+    jbatches++;
+    return 0;
+}
+
+/*  [off, off+len) of a 'zero', 'fill', 'copy' or 'inject' into the journal, JNLCHUNK   */
+/*  at a time (each batch written before the next is read), all before any of it is    */
+/*  written; with 'zeros', holes are skipped, as zeros over them change nothing.  A     */
+/*  first record, empty if need be, keeps the file's size for 'undo'.  0, or -1 (and    */
+/*  no writes from here on)                                                              */
+int journal_big(int fd, off64_t off, uint64_t len, int zeros) {
+off64_t  pos = off, end, dstart, dend;
+uint64_t n;
+int      recs = 0;
+    if (!journal) return 0;
+    end = (len > (uint64_t) INT64_MAX - off) ? INT64_MAX : off + (off64_t) len;
+    while (pos < end) {
+        if (zeros && !gz_image(fd)) {
+            if (!next_data(fd, pos, end, &dstart, &dend)) break;
+            pos = dstart;
+        } else dend = end;
+        n = (dend - pos > JNLCHUNK) ? JNLCHUNK : dend - pos;
+        journal_range(fd, pos, n);
+        recs++;
+        if (journal_commit() == -1) return -1;
+        pos += n;
+    }
+    if (recs == 0) {
+        journal_range(fd, off, 0);
+        if (journal_commit() == -1) return -1;
+    }
+    return 0;
+}
+
+/*  the one flush of the data, at the end of the run  */
+void journal_close(void) {
+size_t i;
+int    errsv;
+    if (!journal) return;
+    for (i = 0; i < njfds; i++) {
+        if (zsync(jfds[i]) == -1) {
+            errsv = errno;
+            printf("*** fdatasync of %s failed (%s) ***\n", handle_name(jfds[i]), strerror(errsv));
+        }
+    }
+    if (journal_start() == -1) perror("journal");  /*  nothing was written: an empty journal  */
+    close(jfd);
+    printf("*** journal %s: %" PRIu64 " record(s), %" PRIu64 " old byte(s), %" PRIu64 " sync(s); %zu file(s) flushed ***\n",
+           jname, jrecs, jbytes, jbatches, njfds);
+}
+
+/*  'undo <journal>': put back what the journal says was there  */
+void journal_undo(char *fn) {
+struct stat st;
+jrec_t   r;        /*  (each header copied out: they aren't aligned)  */
+char     *map, *path;
+off64_t  pos, *recs = NULL;
+size_t   nrecs = 0, i, k;
+off64_t  size;
+handle_t *h;
+int      fd, errsv, *fds;
+struct stat js;
+    if ((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        perror("undo");
+        printf("(filename=%s)\n", fn);
+        exit(4);
+    }
+    if (journal && fstat(jfd, &js) == 0 && js.st_dev == st.st_dev && js.st_ino == st.st_ino) {
+        printf("'undo %s' would replay the journal this run is writing (--journal %s); exiting\n", fn, jname);
         exit(4);
     }
-    /*  ------------------------------------------  */
-    /*  now that we know srclen we can set destlen  */
-    /*  ------------------------------------------  */
-    destlen = srclen / 2;
-    /*  ----------------------  */
-    /*  now process the source  */
-    /*  ----------------------  */
-    for (i = 0; i < destlen; i++) {
-        /*  -----------  */
-        /*  sscanf data  */
-        /*  -----------  */
-        if ((ret = sscanf(srcP, "%02x", (unsigned int *) destP)) != 1) {
-            perror("sscanf data error");
+    if (st.st_size < 8 || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+        || memcmp(map, JNL_MAGIC, 8) != 0) {
+        printf("'%s' is not a szap journal; exiting\n", fn);
+        exit(4);
+    }
+    close(fd);
+    /*  ----------------------------------------------  */
+    /*  find the records, stopping at a torn one        */
+    /*  ----------------------------------------------  */
+    for (pos = 8; pos + (off64_t) sizeof(r) <= st.st_size; ) {
+        memcpy(&r, map + pos, sizeof(r));
+        if (r.magic != JNL_REC || r.pathlen > PATH_MAX
+            || (uint64_t) (st.st_size - pos - sizeof(r)) < r.pathlen + r.len
+            || crc32c(0, map + pos + 8, sizeof(r) - 8 + r.pathlen + r.len) != r.crc) break;
+        if ((recs = realloc(recs, (nrecs + 1) * sizeof(*recs))) == NULL) {
+            printf("unable to allocate the journal index; exiting\n");
             exit(4);
         }
-        /*  -------------  */
-        /*  bump pointers. */
-        /*  -------------  */
-        srcP += 2;
-        destP++;
+        recs[nrecs++] = pos;
+        pos += sizeof(r) + r.pathlen + r.len;
     }
-    /*  --------------  */
-    /*  return destlen  */
-    /*  --------------  */
-    return destlen;
+    if (pos != st.st_size)
+        printf("**  the journal ends with %" PRIu64 " byte(s) of a torn record (its writes never started); ignored  **\n",
+               (uint64_t) (st.st_size - pos));
+    printf("undo %s: %zu record(s)\n", fn, nrecs);
+    if (!ok_to_write) printf("write will NOT be done\n");
+
+    /*  ----------------------------------------------  */
+    /*  open them all, and journal what is about to be  */
+    /*  overwritten (so an undo can be undone, too)     */
+    /*  ----------------------------------------------  */
+    if ((fds = calloc(nrecs + 1, sizeof(*fds))) == NULL) {
+        printf("unable to allocate the journal index; exiting\n");
+        exit(4);
+    }
+    for (i = nrecs; ok_to_write && i-- > 0; ) {
+        memcpy(&r, map + recs[i], sizeof(r));
+        path = strndup(map + recs[i] + sizeof(r), r.pathlen);
+        if ((h = handle_open(path, 1)) == NULL) {
+            errsv = errno;
+            printf("*** %s could not be opened (%s); nothing will be undone ***\n", path, strerror(errsv));
+            ok_to_write = 0;
+        } else {
+            fds[i] = h->fd;
+            journal_range(fds[i], r.off, r.len);
+            if (r.size >= 0 && (size = target_size(fds[i])) > r.size)
+                journal_range(fds[i], r.size, size - r.size);  /*  and what the ftruncate will cut off  */
+        }
+        free(path);
+    }
+    if (ok_to_write) journal_commit();
+
+    /*  ----------------------------------------------  */
+    /*  last first, so the oldest bytes end up on top   */
+    /*  ----------------------------------------------  */
+    for (i = nrecs; i-- > 0; ) {
+        memcpy(&r, map + recs[i], sizeof(r));
+        printf("  %.*s: %" PRIu64 " byte(s) at offset %" PRIx64 "\n", (int) r.pathlen, map + recs[i] + sizeof(r), r.len, r.off);
+        if (!ok_to_write) continue;
+        if (pwrite_full(fds[i], map + recs[i] + sizeof(r) + r.pathlen, r.len, r.off) != (ssize_t) r.len
+            || (r.size >= 0 && target_size(fds[i]) > r.size && (cache_forget(fds[i], r.size, UINT64_MAX), ztruncate(fds[i], r.size) == -1))) {
+            errsv = errno;
+            printf("*** undo at offset %" PRIx64 " failed (%s); undo stopped ***\n", r.off, strerror(errsv));
+            ok_to_write = 0;
+        }
+    }
+    /*  ----------------------------------------------  */
+    /*  then one flush per file                         */
+    /*  ----------------------------------------------  */
+    for (i = 0; i < nrecs; i++) {
+        for (k = 0; k < i && fds[k] != fds[i]; k++) ;
+        if (fds[i] > 0 && k == i && zsync(fds[i]) == -1 && errno != EINVAL) perror("fdatasync");
+    }
+    free(fds);
+    munmap(map, st.st_size);
+    free(recs);
+}
+
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*                                                                 */
+/*  the 'ver'/'rep' I/O batch, and what to do as each one is done  */
+/*                                                                 */
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*  Requests are done in the order they were queued as far as any one  */
+/*  offset is concerned: a batch is all reads or all writes (a card of  */
+/*  the other kind flushes it first), and a write that overlaps one     */
+/*  already queued flushes the batch before it is added.  The slots,    */
+/*  and their buffers, are kept and reused from one batch to the next.  */
+static ioreq_t *ioq = NULL;
+static size_t  nioq = 0, ioqcap = 0;
+
+void io_queue(int op, int fd, off64_t off, char *data, size_t len, plantarget_t *t) {
+ioreq_t *r;
+size_t  i;
+    io_expect(op);
+    if (op == IO_WRITE) layout_forget(fd, off, len);  /*  (now: the next offset's reread flushes it first)  */
+    if (op == IO_WRITE)
+        for (i = 0; i < nioq; i++)
+            if (ioq[i].fd == fd && off < ioq[i].off + (off64_t) ioq[i].len && ioq[i].off < off + (off64_t) len) {
+                io_flush();
+                break;
+            }
+    if (nioq == ioqcap) {
+        ioqcap = ioqcap ? 2 * ioqcap : 16;
+        if ((ioq = realloc(ioq, ioqcap * sizeof(*ioq))) == NULL) {
+            printf("unable to allocate the I/O batch; exiting\n");
+            exit(4);
+        }
+        memset(ioq + nioq, 0, (ioqcap - nioq) * sizeof(*ioq));
+    }
+    r = &ioq[nioq++];
+    r->op = op;
+    r->fd = fd;
+    r->off = off;
+    r->len = len;
+    r->t = t;
+    r->res = 0;
+    memcpy(arena_reserve(&r->data, len), data, len);
+    if (op == IO_READ) arena_reserve(&r->disk, len);
+}
+
+/*  the next card wants to add an 'op' request: finish a batch of the other kind  */
+void io_expect(int op) {
+    if (nioq && ioq[0].op != op) io_flush();
+}
+
+/*  a 'ver' read is in: compare it, and complain if it doesn't agree  */
+static void ver_done(ioreq_t *r) {
+ssize_t got = r->res;
+    if (r->t != NULL && got > 0) plan_overlay(r->t, r->disk.base, got, r->off);
+    if (got != (ssize_t) r->len || !memcmp(r->data.base, r->disk.base, r->len) == 0) {
+        if (uring) printf("*** 'data' at offset %" PRIx64 " discompares; no writes will be performed ***\n", (uint64_t) r->off);
+        else       printf("*** 'data' discompares; no writes will be performed ***\n");
+        if (got < 0) got = 0;
+        if(debug) hexDump("(debug) hexDump of data in ver", r->data.base, r->len, r->off);
+        hexDump("hexDump of data in named file", r->disk.base, got, r->off);
+        hexDumpEnd();
+        ok_to_write = 0;
+    } else {
+        if(debug) hexDump("(debug) hexDump of data in ver", r->data.base, r->len, r->off);
+    }
+}
+
+/*  a 'rep' write is out: complain only if it didn't all make it  */
+static void rep_done(ioreq_t *r) {
+    if (r->res != (ssize_t) r->len) {
+        printf("*** write at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n",
+               (uint64_t) r->off, r->res < 0 ? strerror(-r->res) : "short write");
+        ok_to_write = 0;
+    }
+}
+
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*  the plain path: with nothing to plan, batch, journal, align or  */
+/*  count, 'name', 'ver', 'rep' and 'dump' are libszap's            */
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*  libszap keeps its own open files, so each 'name' and 'dump' makes  */
+/*  the file its current one as well.  Its writes go to the same file  */
+/*  as szap's descriptor, so the block cache and partition table are   */
+/*  told about them here; what they print is what ver_done, rep_done   */
+/*  and dump_range would.  A .gz image is inflated by szap, so it      */
+/*  stays on szap's own path.                                          */
+static void zlib_out(void *arg, const char *text, size_t len) {
+    (void) arg;
+    fwrite(text, 1, len, stdout);
+}
+
+int zlib_for(int fd) {
+    return zlib != NULL && fd != -1 && !gz_image(fd);
+}
+
+/*  'fn' becomes libszap's current file ('rw' as for a 'name', else as for a 'dump')  */
+void zlib_open(char *fn, int rw) {
+int rc;
+    if (rw) rc = szap_name(zlib, fn);
+    else {
+        szap_set_output(zlib, NULL, NULL);  /*  an empty dump, quietly: it only opens the file  */
+        rc = szap_dump(zlib, fn, 0, 0);
+        szap_set_output(zlib, zlib_out, NULL);
+    }
+    if (rc != SZAP_OK) {
+        printf("libszap could not open '%s' (%s); exiting\n", fn,
+               rc == SZAP_EOPEN ? strerror(szap_errno(zlib)) : szap_strerror(rc));
+        exit(4);
+    }
+}
+
+void ver_lib(off64_t off, char *data, size_t len) {
+static arena_t disk = { NULL, 0 };  /*  what the file has, for the discompare  */
+ssize_t got;
+    if (szap_ver(zlib, off, data, len) == SZAP_OK) {
+        if(debug) hexDump("(debug) hexDump of data in ver", data, len, off);
+        return;
+    }
+    printf("*** 'data' discompares; no writes will be performed ***\n");
+    if ((got = szap_read(zlib, off, arena_reserve(&disk, len ? len : 1), len)) < 0) got = 0;
+    if(debug) hexDump("(debug) hexDump of data in ver", data, len, off);
+    hexDump("hexDump of data in named file", disk.base, got, off);
+    hexDumpEnd();
+    ok_to_write = 0;
+}
+
+void rep_lib(int fd, off64_t off, char *data, size_t len) {
+int rc;
+    szap_set_dryrun(zlib, !ok_to_write);
+    if ((rc = szap_rep(zlib, off, data, len)) == SZAP_OK) {
+        cache_write(fd, data, len, off);
+        return;
+    }
+    cache_forget(fd, off, len);  /*  (some of it may be out)  */
+    printf("*** write at offset %" PRIx64 " failed (%s); no further writes will be performed ***\n",
+           (uint64_t) off, rc == SZAP_EIO ? strerror(szap_errno(zlib)) : szap_strerror(rc));
+    ok_to_write = 0;
+}
+
+void io_flush(void) {
+ioreq_t  *r;
+size_t   next = 0, pending = 0;
+uint64_t tag;
+int      res;
+ssize_t  more;
+
+    if (nioq == 0) return;
+    if (journal && ioq[0].op == IO_WRITE) {
+        /*  ------------------------------------------------  */
+        /*  the old bytes are safe in the journal before any  */
+        /*  of the batch is written                           */
+        /*  ------------------------------------------------  */
+        for (r = ioq; r < ioq + nioq; r++) journal_range(r->fd, r->off, r->len);
+        if (journal_commit() == -1) {
+            nioq = 0;
+            return;
+        }
+    }
+    if (uring) {
+        /*  ------------------------------------------------  */
+        /*  keep the ring as full as it will go until all of  */
+        /*  the batch has completed                           */
+        /*  ------------------------------------------------  */
+        while (next < nioq || pending) {
+            while (next < nioq) {
+                r = &ioq[next];
+                if (dio_blocksize(r->fd) || gz_image(r->fd) || (r->op == IO_READ && cache_covers(r->fd, r->off, r->len))) {
+                    /*  an O_DIRECT request takes the aligned path, a .gz image's is inflated,  */
+                    /*  and a cached read needs no I/O                                          */
+                    if (r->op == IO_READ) r->res = cache_pread(r->fd, r->disk.base, r->len, r->off);
+                    else                  r->res = pwrite_full(r->fd, r->data.base, r->len, r->off);
+                    if (r->res < 0) r->res = -errno;
+                    next++;
+                    continue;
+                }
+                r->iov.iov_base = (r->op == IO_READ) ? r->disk.base : r->data.base;
+                r->iov.iov_len = r->len;
+                if (uring_submit(r->op, r->fd, &r->iov, r->off, next) == -1) break;
+                next++;
+                pending++;
+            }
+            if (!pending) continue;
+            if (uring_reap(&tag, &res) == -1) {
+                perror("io_uring_enter");
+                exit(4);
+            }
+            pending--;
+            r = &ioq[tag];
+            r->res = res;
+            if (r->op == IO_WRITE && res > 0) cache_write(r->fd, r->data.base, res, r->off);
+            /*  a short transfer is finished off the ordinary way  */
+            if (res > 0 && (size_t) res < r->len) {
+                if (r->op == IO_READ) more = pread_full(r->fd, r->disk.base + res, r->len - res, r->off + res);
+                else                  more = pwrite_full(r->fd, r->data.base + res, r->len - res, r->off + res);
+                r->res = (more < 0) ? -errno : res + more;
+            }
+        }
+        if(debug) printf("(debug) io_uring batch of %zu %s(s) done\n", nioq, ioq[0].op == IO_READ ? "read" : "write");
+    } else {
+        for (r = ioq; r < ioq + nioq; r++) {
+            if (r->op == IO_READ) r->res = cache_pread(r->fd, r->disk.base, r->len, r->off);
+            else                  r->res = pwrite_full(r->fd, r->data.base, r->len, r->off);
+            if (r->res < 0) r->res = -errno;
+        }
+    }
+    /*  ---------------------------------------------  */
+    /*  report, in card order                          */
+    /*  ---------------------------------------------  */
+    for (r = ioq; r < ioq + nioq; r++) {
+        if (r->op == IO_READ) ver_done(r);
+        else                  rep_done(r);
+    }
+    nioq = 0;
+}
+
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*                                                                 */
+/*  a minimal io_uring: just enough to queue preadv/pwritev        */
+/*                                                                 */
+/*  -------------------------------------------------------------  */
+/*  -------------------------------------------------------------  */
+/*  There is no liburing here; the rings are set up and driven with the  */
+/*  raw system calls.  If io_uring_setup fails (an old kernel, or one    */
+/*  with io_uring turned off) uring_init says so and szap carries on     */
+/*  with the blocking calls.                                             */
+static struct {
+    int                 fd;
+    unsigned            *sqhead, *sqtail, *sqmask, *sqarray, sqentries;
+    unsigned            *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned            inflight;
+} ring = { .fd = -1 };
+
+int uring_init(unsigned entries) {
+struct io_uring_params p;
+char   *sq, *cq;
+size_t sqsize, cqsize;
+    memset(&p, 0, sizeof(p));
+    if ((ring.fd = syscall(__NR_io_uring_setup, entries, &p)) == -1) return -1;
+    sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && cqsize > sqsize) sqsize = cqsize;
+    sq = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) cq = sq;
+    else {
+        cq = mmap(NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) goto fail;
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) goto fail;
+    ring.sqhead    = (unsigned *) (sq + p.sq_off.head);
+    ring.sqtail    = (unsigned *) (sq + p.sq_off.tail);
+    ring.sqmask    = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring.sqarray   = (unsigned *) (sq + p.sq_off.array);
+    ring.sqentries = p.sq_entries;
+    ring.cqhead    = (unsigned *) (cq + p.cq_off.head);
+    ring.cqtail    = (unsigned *) (cq + p.cq_off.tail);
+    ring.cqmask    = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring.cqes      = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+fail:
+    close(ring.fd);
+    ring.fd = -1;
+    return -1;
+}
+
+/*  queue one preadv/pwritev; returns -1 (queueing nothing) if the ring is full  */
+int uring_submit(int op, int fd, struct iovec *iov, off64_t off, uint64_t tag) {
+struct io_uring_sqe *sqe;
+unsigned tail, idx;
+    if (ring.inflight >= ring.sqentries) return -1;
+    tail = *ring.sqtail;
+    idx = tail & *ring.sqmask;
+    sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (op == IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->off = off;
+    sqe->user_data = tag;
+    ring.sqarray[idx] = idx;
+    __atomic_store_n(ring.sqtail, tail + 1, __ATOMIC_RELEASE);
+    ring.inflight++;
+    return 0;
+}
+
+/*  hand the kernel whatever is queued and take one completion (waiting for it)  */
+int uring_reap(uint64_t *tag, int *res) {
+struct io_uring_cqe *cqe;
+unsigned head, tosubmit;
+uint64_t t0 = 0;
+long     r;
+    for (;;) {
+        head = *ring.cqhead;
+        if (head != __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)) break;
+        tosubmit = *ring.sqtail - __atomic_load_n(ring.sqhead, __ATOMIC_ACQUIRE);
+        if (stats) t0 = stat_now();
+        r = syscall(__NR_io_uring_enter, ring.fd, tosubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (stats) stat_io(ST_URING, t0, r == -1 ? -1 : 0, 0);
+        if (r == -1 && errno != EINTR) return -1;
+    }
+    cqe = &ring.cqes[head & *ring.cqmask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    if (stats && cqe->res > 0) stat_bytes(ST_URING, cqe->res);
+    __atomic_store_n(ring.cqhead, head + 1, __ATOMIC_RELEASE);
+    ring.inflight--;
+    return 0;
+}
+
+/*  the device half of dump_range, with DUMPDEPTH chunk reads kept in flight  */
+void dump_uring(int fd, off64_t pos, off64_t end) {
+char         *chunk[DUMPDEPTH];
+struct iovec iov[DUMPDEPTH];
+off64_t      at[DUMPDEPTH];
+int          res[DUMPDEPTH], done[DUMPDEPTH];
+off64_t      next = pos;
+uint64_t     tag;
+ssize_t      more;
+int          i, r, head = 0, inflight = 0, eof = 0;
+char         *desc = "dump";
+
+    for (i = 0; i < DUMPDEPTH; i++)
+        if (posix_memalign((void **) &chunk[i], 4096, DUMPCHUNK) != 0) {
+            printf("unable to allocate a %i byte dump buffer; exiting\n", DUMPCHUNK);
+            exit(4);
+        }
+    /*  slot i holds the read at at[i]; the slots are printed round robin  */
+    for (i = 0; i < DUMPDEPTH; i++) {
+        done[i] = 0;
+        iov[i].iov_base = chunk[i];
+        iov[i].iov_len = 0;
+        if (next >= end) continue;
+        iov[i].iov_len = (end - next > DUMPCHUNK) ? DUMPCHUNK : end - next;
+        at[i] = next;
+        uring_submit(IO_READ, fd, &iov[i], next, i);
+        next += iov[i].iov_len;
+        inflight++;
+    }
+    while (inflight) {
+        while (!done[head]) {
+            if (uring_reap(&tag, &r) == -1) {
+                perror("io_uring_enter");
+                exit(4);
+            }
+            res[tag] = r;
+            done[tag] = 1;
+        }
+        done[head] = 0;
+        inflight--;
+        r = res[head];
+        if (!eof && r > 0 && r < (int) iov[head].iov_len) {
+            /*  short isn't necessarily the end (a pipe, a char device); finish it off  */
+            more = pread_full(fd, chunk[head] + r, iov[head].iov_len - r, at[head] + r);
+            if (more > 0) r += more;
+        }
+        if (!eof && r < 0) {
+            errno = -r;
+            perror("pread");
+        }
+        if (!eof && r > 0) {
+            hexDump(desc, chunk[head], r, at[head]);
+            desc = NULL;
+        }
+        if (r < (int) iov[head].iov_len) eof = 1;  /* end of the device (or an error) */
+        if (!eof && next < end) {
+            iov[head].iov_len = (end - next > DUMPCHUNK) ? DUMPCHUNK : end - next;
+            at[head] = next;
+            uring_submit(IO_READ, fd, &iov[head], next, head);
+            next += iov[head].iov_len;
+            inflight++;
+        }
+        head = (head + 1) % DUMPDEPTH;
+    }
+    hexDumpEnd();
+    if (desc != NULL) printf("dump\n  (nothing read at offset %" PRIx64 ")\n", (uint64_t) pos);
+    for (i = 0; i < DUMPDEPTH; i++) free(chunk[i]);
+}
+
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*                                                                      */
+/*  --stats: what a run did, and where the time went                    */
+/*                                                                      */
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*  Every hook is behind an 'if (stats)', so with --stats off the cost  */
+/*  is a test of a global per call.  The I/O counters are bumped with   */
+/*  atomics, as 'find', 'sum' and 'diff' read from several threads; the */
+/*  card and phase counters are only touched by the main thread.  Each  */
+/*  I/O type keeps a histogram of its latencies: bucket k counts the    */
+/*  calls that took [2^k, 2^(k+1)) ns.  A card's time runs from its     */
+/*  verb to the start of the next card, so a batch of 'ver's or 'rep's  */
+/*  (--uring, --journal) is charged to the card that ends it.           */
+static iostat_t    stio[ST_NIO];
+static phasestat_t stphase[SP_NPHASE];
+static phasestat_t stverb[V_NVERBS];
+static uint64_t    ststart, stlexstart;
+
+static const char *stioname[ST_NIO] = { "read", "write", "writev", "sync", "mmap", "uring", "stdin", "copy", "zero" };
+static const char *stphasename[SP_NPHASE] = { "lex", "decode", "print" };
+static const char *stverbname[V_NVERBS] = { "(other)", "ver", "rep", "name", "dump", "find", "sum", "diff",
+                                            "undo", "alias", "reset", "extract", "inject", "zero", "fill", "copy" };
+
+uint64_t stat_now(void) {
+struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*  one system call of 'type', started at 't0', that asked for 'want' bytes and got 'got'  */
+void stat_io(int type, uint64_t t0, ssize_t got, size_t want) {
+iostat_t *s = &stio[type];
+uint64_t ns = stat_now() - t0;
+int      k = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (k >= STATBUCKETS) k = STATBUCKETS - 1;
+    __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->hist[k], 1, __ATOMIC_RELAXED);
+    if (got < 0) __atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+    else {
+        __atomic_fetch_add(&s->bytes, got, __ATOMIC_RELAXED);
+        if ((size_t) got < want) __atomic_fetch_add(&s->shorts, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*  bytes that 'type' moved, but not in the call that was timed (io_uring completions)  */
+void stat_bytes(int type, uint64_t n) {
+    __atomic_fetch_add(&stio[type].bytes, n, __ATOMIC_RELAXED);
+}
+
+void stat_phase(int phase, uint64_t t0, uint64_t bytes) {
+    stphase[phase].calls++;
+    stphase[phase].bytes += bytes;
+    stphase[phase].ns += stat_now() - t0;
+}
+
+void stat_start(void) {
+    ststart = stat_now();
+}
+
+void stat_lexstart(void) {
+    stlexstart = stat_now();
+}
+
+/*  a card of 'verb' that started at 't0' and ended when the next card was read for  */
+void stat_card(int verb, uint64_t t0) {
+    stverb[verb].calls++;
+    stverb[verb].ns += stlexstart - t0;
+}
+
+static double stat_mbs(uint64_t bytes, uint64_t ns) {
+    return ns ? bytes / (ns / 1e9) / (1024.0 * 1024.0) : 0.0;
+}
+
+/*  the table (--stats) or one line of JSON (--stats=json)  */
+void stat_report(void) {
+uint64_t total = stat_now() - ststart;
+iostat_t *s;
+int      i, k, first;
+    if (stats == 2) {
+        printf("{\"seconds\":%.6f,\"verbs\":{", total / 1e9);
+        for (first = 1, i = 0; i < V_NVERBS; i++) {
+            if (stverb[i].calls == 0) continue;
+            printf("%s\"%s\":{\"cards\":%" PRIu64 ",\"seconds\":%.6f}", first ? "" : ",",
+                   stverbname[i], stverb[i].calls, stverb[i].ns / 1e9);
+            first = 0;
+        }
+        printf("},\"phases\":{");
+        for (i = 0; i < SP_NPHASE; i++)
+            printf("%s\"%s\":{\"calls\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"seconds\":%.6f}", i ? "," : "",
+                   stphasename[i], stphase[i].calls, stphase[i].bytes, stphase[i].ns / 1e9);
+        printf("},\"io\":{");
+        for (i = 0; i < ST_NIO; i++) {
+            s = &stio[i];
+            printf("%s\"%s\":{\"calls\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"short\":%" PRIu64 ",\"errors\":%" PRIu64
+                   ",\"seconds\":%.6f,\"latency_log2_ns\":[", i ? "," : "", stioname[i], s->calls, s->bytes,
+                   s->shorts, s->errors, s->ns / 1e9);
+            for (k = 0; k < STATBUCKETS; k++) printf("%s%" PRIu64, k ? "," : "", s->hist[k]);
+            printf("]}");
+        }
+        printf("},\"cache\":{\"hits\":%" PRIu64 ",\"misses\":%" PRIu64 ",\"reads\":%" PRIu64 ",\"evictions\":%" PRIu64
+               ",\"updates\":%" PRIu64 ",\"forgotten\":%" PRIu64 "}}\n", cachestat.hits, cachestat.misses, cachestat.reads,
+               cachestat.evictions, cachestat.updates, cachestat.forgotten);
+        return;
+    }
+    printf("*** stats: %.6f seconds ***\n", total / 1e9);
+    printf("  %-10s %12s %12s\n", "verb", "cards", "seconds");
+    for (i = 0; i < V_NVERBS; i++)
+        if (stverb[i].calls)
+            printf("  %-10s %12" PRIu64 " %12.6f\n", stverbname[i], stverb[i].calls, stverb[i].ns / 1e9);
+    printf("  %-10s %12s %14s %12s %10s\n", "phase", "calls", "bytes", "seconds", "MB/s");
+    for (i = 0; i < SP_NPHASE; i++)
+        printf("  %-10s %12" PRIu64 " %14" PRIu64 " %12.6f %10.1f\n", stphasename[i], stphase[i].calls,
+               stphase[i].bytes, stphase[i].ns / 1e9, stat_mbs(stphase[i].bytes, stphase[i].ns));
+    printf("  %-10s %12s %14s %8s %8s %12s %10s\n", "syscall", "calls", "bytes", "short", "errors", "seconds", "MB/s");
+    for (i = 0; i < ST_NIO; i++) {
+        s = &stio[i];
+        if (s->calls == 0) continue;
+        printf("  %-10s %12" PRIu64 " %14" PRIu64 " %8" PRIu64 " %8" PRIu64 " %12.6f %10.1f\n", stioname[i],
+               s->calls, s->bytes, s->shorts, s->errors, s->ns / 1e9, stat_mbs(s->bytes, s->ns));
+    }
+    printf("  cache: %" PRIu64 " block hit(s), %" PRIu64 " miss(es) in %" PRIu64 " read(s), %" PRIu64 " evicted, %" PRIu64
+           " updated by writes, %" PRIu64 " forgotten\n", cachestat.hits, cachestat.misses, cachestat.reads,
+           cachestat.evictions, cachestat.updates, cachestat.forgotten);
+    printf("  latency, calls by how long they took (at least 1ns, 2ns, 4ns, ...; a us here is 1024ns):\n");
+    for (i = 0; i < ST_NIO; i++) {
+        s = &stio[i];
+        if (s->calls == 0) continue;
+        printf("  %-10s", stioname[i]);
+        for (k = 0; k < STATBUCKETS; k++) {
+            if (s->hist[k] == 0) continue;
+            if (k < 10) printf(" %uns:%" PRIu64, 1u << k, s->hist[k]);
+            else if (k < 20) printf(" %uus:%" PRIu64, 1u << (k - 10), s->hist[k]);
+            else if (k < 30) printf(" %ums:%" PRIu64, 1u << (k - 20), s->hist[k]);
+            else printf(" %us:%" PRIu64, 1u << (k - 30), s->hist[k]);
+        }
+        printf("\n");
+    }
+}
+
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*                                                                      */
+/*  the control card reader: stdin a block at a time, lexed in place    */
+/*                                                                      */
+/*  ------------------------------------------------------------------  */
+/*  ------------------------------------------------------------------  */
+/*  stdin is read CARDBLOCK bytes at a time into one buffer, which only */
+/*  grows if a single card is longer than it, so a card can be any      */
+/*  length.  Each physical line is echoed (unless --quiet) as it is     */
+/*  reached, then split into tokens in the same buffer: the token       */
+/*  bytes are moved down over the blanks and each is ended with a NUL.  */
+/*  A line whose last non-blank is a backslash goes on to the next      */
+/*  line; the backslash and the newline vanish, so a <data> can be      */
+/*  broken over as many lines as it needs ("aabb\" then "ccdd" is       */
+/*  "aabbccdd").  Tokens are valid until the next card_read.            */
+static void card_grow(card_t *c) {
+    c->cap = c->cap ? 2 * c->cap : CARDBLOCK;
+    if ((c->buf = realloc(c->buf, c->cap)) == NULL) {
+        printf("unable to allocate %zu bytes for a control card; exiting\n", c->cap);
+        exit(4);
+    }
+}
+
+/*  more of stdin, after moving what is left of it to the front  */
+static void card_fill(card_t *c, size_t *pos, size_t *w) {
+size_t  i, shift = c->beg;
+ssize_t n;
+uint64_t t0 = 0;
+    if (shift) {
+        memmove(c->buf, c->buf + shift, c->fill - shift);
+        c->fill -= shift;
+        c->beg = 0;
+        *pos -= shift;
+        *w -= shift;
+        for (i = 0; i < c->ntok; i++) c->off[i] -= shift;
+    }
+    if (c->fill == c->cap) card_grow(c);
+    do {
+        if (stats) t0 = stat_now();
+        n = read(STDIN_FILENO, c->buf + c->fill, c->cap - c->fill);
+        if (stats) stat_io(ST_STDIN, t0, n, 0);  /*  (less than the buffer is not short, for a pipe)  */
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        if (n == -1) perror("read");
+        c->eof = 1;
+        return;
+    }
+    c->fill += n;
+}
+
+/*  the next card into c->tok[0..ntok); 0 at the end of the input  */
+int card_read(card_t *c) {
+size_t pos = c->beg, w = c->beg, r, e, end;
+uint64_t bytes0 = c->bytes;
+char   *nl;
+int    intok = 0, more;
+    if (stats) stat_lexstart();
+    c->ntok = c->next = 0;
+    if (c->cap == 0 || (pos == c->fill && !c->eof)) card_fill(c, &pos, &w);
+    if (pos == c->fill && c->eof) return 0;
+    do {
+        /*  ------------------------------------------------  */
+        /*  a whole physical line, reading more if need be    */
+        /*  ------------------------------------------------  */
+        while ((nl = memchr(c->buf + pos, '\n', c->fill - pos)) == NULL && !c->eof) card_fill(c, &pos, &w);
+        e = nl ? (size_t) (nl - c->buf) : c->fill;
+        c->lineno++;
+        c->bytes += e - pos + (nl != NULL);
+        if (echo) {
+            fputs("> ", stdout);
+            fwrite(c->buf + pos, 1, e - pos, stdout);
+            putchar('\n');
+        }
+        for (end = e; end > pos && (c->buf[end - 1] == ' ' || c->buf[end - 1] == '\t' || c->buf[end - 1] == '\r'); end--) ;
+        more = (end > pos && c->buf[end - 1] == '\\');
+        if (more) end--;
+        /*  ------------------------------------------------  */
+        /*  split it, packing the tokens down as we go        */
+        /*  ------------------------------------------------  */
+        for (r = pos; r < end; r++) {
+            if (c->buf[r] == ' ' || c->buf[r] == '\t' || c->buf[r] == '\r') {
+                if (intok) c->buf[w++] = '\0';
+                intok = 0;
+                continue;
+            }
+            if (!intok) {
+                if (c->ntok == c->tcap) {
+                    c->tcap = c->tcap ? 2 * c->tcap : 16;
+                    c->off = realloc(c->off, c->tcap * sizeof(*c->off));
+                    c->tok = realloc(c->tok, c->tcap * sizeof(*c->tok));
+                    if (c->off == NULL || c->tok == NULL) {
+                        printf("unable to allocate the token table; exiting\n");
+                        exit(4);
+                    }
+                }
+                c->off[c->ntok++] = w;
+                intok = 1;
+            }
+            c->buf[w++] = c->buf[r];
+        }
+        pos = nl ? e + 1 : e;
+        if (more && !nl) more = 0;  /*  a backslash on the very last line  */
+        if (!more && intok) {
+            if (w == c->cap) card_grow(c);  /*  a last line that fills the buffer: room for the NUL  */
+            c->buf[w++] = '\0';
+        }
+    } while (more);
+    c->beg = pos;
+    for (r = 0; r < c->ntok; r++) c->tok[r] = c->buf + c->off[r];
+    if (stats) stat_phase(SP_LEX, stlexstart, c->bytes - bytes0);
+    return 1;
+}
+
+/*  the card's next token, or NULL if there are no more  */
+char *card_tok(card_t *c) {
+    return (c->next < c->ntok) ? c->tok[c->next++] : NULL;
+}
+
+/*  the verb a (lower case) token names, or V_NONE: a switch on the first letter, then at most two compares  */
+int verb_lookup(const char *p) {
+    switch (p[0]) {
+        case 'a': return (strcmp(p, "alias") == 0) ? V_ALIAS : V_NONE;
+        case 'c': return (strcmp(p, "copy") == 0) ? V_COPY : V_NONE;
+        case 'd': return (strcmp(p, "dump") == 0) ? V_DUMP : (strcmp(p, "diff") == 0) ? V_DIFF : V_NONE;
+        case 'e': return (strcmp(p, "extract") == 0) ? V_EXTRACT : V_NONE;
+        case 'f': return (strcmp(p, "find") == 0) ? V_FIND : (strcmp(p, "fill") == 0) ? V_FILL : V_NONE;
+        case 'i': return (strcmp(p, "inject") == 0) ? V_INJECT : V_NONE;
+        case 'n': return (strcmp(p, "name") == 0) ? V_NAME : V_NONE;
+        case 'r': return (strcmp(p, "rep") == 0) ? V_REP : (strcmp(p, "reset") == 0) ? V_RESET : V_NONE;
+        case 's': return (strcmp(p, "sum") == 0) ? V_SUM : V_NONE;
+        case 'u': return (strcmp(p, "undo") == 0) ? V_UNDO : V_NONE;
+        case 'v': return (strcmp(p, "ver") == 0 || strcmp(p, "verify") == 0) ? V_VER : V_NONE;
+        case 'z': return (strcmp(p, "zero") == 0) ? V_ZERO : V_NONE;
+    }
+    return V_NONE;
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  --serve: decks from many clients at once, over a unix socket     */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  Each connection is a session on a thread of its own, with its own  */
+/*  libszap context (so its own ok_to_write: dryrun to start with      */
+/*  under --dryrun), and all of them share one table of open files:    */
+/*  a target is opened once, its 'ver's and 'dump's run side by side   */
+/*  and its 'rep's go one at a time.  Cards are run a line at a time   */
+/*  as they arrive; what each prints is sent back at once, then a line */
+/*  "= <rc> <message>" ends it, so a client can keep sending without   */
+/*  waiting.  A card that would end szap ends no session, but nothing  */
+/*  more is written in it until a 'reset'.  The socket is made for its */
+/*  owner only, as szap is usually root.                               */
+#define SERVELINE 4096  /* first size of a session's card buffer; it grows */
+
+static szap_files *servefiles;
+static char       *servepath;
+
+static void serve_out(void *arg, const char *text, size_t len) {
+int     sfd = *(int *) arg;
+ssize_t n;
+    while (len) {
+        n = send(sfd, text, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;  /* the client has gone; its next read says so */
+        text += n;
+        len -= n;
+    }
+}
+
+/*  the file a 'name' or 'dump' card opens, if it is a compressed image (libszap would zap its compressed bytes)  */
+static char *serve_compressed(char *card, char *fn, size_t cap) {
+size_t n;
+    card += strspn(card, " \t\r");
+    n = strcspn(card, " \t\r");
+    if (!((n == 4 && strncasecmp(card, "name", 4) == 0) || (n == 4 && strncasecmp(card, "dump", 4) == 0))) return NULL;
+    card += n;
+    card += strspn(card, " \t\r");
+    n = strcspn(card, " \t\r");
+    if (n == 0 || n >= cap) return NULL;
+    memcpy(fn, card, n);
+    fn[n] = '\0';
+    return gz_named(fn) ? fn : NULL;
+}
+
+static void serve_card(szap_ctx *z, int sfd, char *card) {
+static const char off[] = "*** no writes will be performed in this session until a 'reset' ***\n";
+char status[128], fn[PATH_MAX];
+int  rc, n;
+    if (serve_compressed(card, fn, sizeof(fn)) != NULL) {
+        n = snprintf(status, sizeof(status), "*** '%.64s' is compressed; --serve zaps raw files only ***\n", fn);
+        serve_out(&sfd, status, n);
+        rc = SZAP_EOPEN;
+    } else rc = szap_card(z, card);
+    if (rc != SZAP_OK && rc != SZAP_EVERIFY && rc != SZAP_EDRYRUN && rc != SZAP_EVERB && szap_ok_to_write(z)) {
+        szap_set_dryrun(z, 1);
+        serve_out(&sfd, off, sizeof(off) - 1);
+    }
+    n = snprintf(status, sizeof(status), "= %d %s\n", rc, szap_strerror(rc));
+    serve_out(&sfd, status, n);
+}
+
+static void *serve_session(void *arg) {
+int      sfd = (int) (intptr_t) arg;
+szap_ctx *z;
+char     *buf, *nb, *nl;
+size_t   cap = SERVELINE, fill = 0, beg;
+ssize_t  n;
+    if ((z = szap_new_shared(servefiles)) == NULL || (buf = malloc(cap)) == NULL) {
+        szap_free(z);
+        close(sfd);
+        return NULL;
+    }
+    szap_set_output(z, serve_out, &sfd);
+    szap_set_debug(z, debug);
+    szap_set_dryrun(z, !ok_to_write);
+    for (;;) {
+        if (fill == cap) {
+            if ((nb = realloc(buf, 2 * cap)) == NULL) break;
+            buf = nb;
+            cap *= 2;
+        }
+        n = read(sfd, buf + fill, cap - fill);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0 && fill) {  /*  a last card with no newline  */
+                buf[fill] = '\0';
+                serve_card(z, sfd, buf);
+            }
+            break;
+        }
+        fill += n;
+        beg = 0;
+        while ((nl = memchr(buf + beg, '\n', fill - beg)) != NULL) {
+            *nl = '\0';
+            serve_card(z, sfd, buf + beg);
+            beg = nl - buf + 1;
+        }
+        memmove(buf, buf + beg, fill - beg);
+        fill -= beg;
+    }
+    free(buf);
+    szap_free(z);
+    close(sfd);
+    return NULL;
+}
+
+static void serve_stop(int sig) {
+    (void) sig;
+    unlink(servepath);
+    _exit(0);
+}
+
+void serve(char *path) {
+struct sockaddr_un sa;
+struct stat        st;
+pthread_attr_t     attr;
+pthread_t          tid;
+mode_t             mask;
+int                lfd, sfd;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        printf("--serve socket path '%s' is too long; exiting\n", path);
+        exit(4);
+    }
+    if ((servefiles = szap_files_new()) == NULL) {
+        printf("unable to allocate the open file table; exiting\n");
+        exit(4);
+    }
+    servepath = path;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);  /*  left by an earlier run  */
+    mask = umask(0177);
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1
+        || bind(lfd, (struct sockaddr *) &sa, sizeof(sa)) == -1
+        || listen(lfd, SOMAXCONN) == -1) {
+        perror("--serve");
+        printf("(socket=%s)\n", path);
+        exit(4);
+    }
+    umask(mask);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serve_stop);
+    signal(SIGTERM, serve_stop);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    printf("**  serving on %s  **\n", path);
+    fflush(stdout);
+
+    for (;;) {
+        if ((sfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(100000);  /*  out of something; let a session finish  */
+                continue;
+            }
+            exit(4);
+        }
+        if(debug) printf("(debug) session on fd %i\n", sfd);
+        if (pthread_create(&tid, &attr, serve_session, (void *) (intptr_t) sfd) != 0) {
+            printf("*** unable to start a session thread; connection closed ***\n");
+            close(sfd);
+        }
+        if(debug) fflush(stdout);
+    }
+}
+
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*                                                                   */
+/*  --fleet: one deck, read once, against many targets in parallel   */
+/*                                                                   */
+/*  ---------------------------------------------------------------  */
+/*  ---------------------------------------------------------------  */
+/*  The deck is read and decoded once into a list of steps; '{}' in a  */
+/*  'name' or 'dump' card stands for the target.  A pool of threads     */
+/*  (--threads, default one per CPU) takes the targets in turn and      */
+/*  runs the steps on each through a libszap context of its own, so     */
+/*  each target has its own ok_to_write, exactly as a run of szap on    */
+/*  it alone would.  What a target prints is held until it is done and  */
+/*  then printed in one piece, with a line saying how it went; a        */
+/*  summary follows the last.                                           */
+#define FLEETMARK "{}"
+
+typedef struct {
+    int      verb;      /*  V_NAME, V_VER, V_REP, V_DUMP or V_RESET  */
+    uint64_t off, len;  /*  (a 'dump': its skip and length)           */
+    char     *sym;      /*  an offset in a partition, or NULL         */
+    size_t   data;      /*  where its bytes start in 'fleetdata'      */
+} fleetop_t;
+
+typedef struct {
+    char      **fn;
+    size_t    nfn;
+    fleetop_t *op;
+    size_t    nop;
+    char      *data;
+    uint64_t  next;     /*  the next target to take (atomically)  */
+    pthread_mutex_t mu; /*  over the printing and the totals       */
+    int       zapped, verfailed, dry, errors;
+} fleetjob_t;
+
+typedef struct {
+    fleetjob_t *job;
+    arena_t    out;     /*  what the current target has printed  */
+    size_t     outlen;
+} fleetwork_t;
+
+static void fleet_out(void *arg, const char *text, size_t len) {
+fleetwork_t *w = arg;
+    memcpy(arena_reserve(&w->out, w->outlen + len) + w->outlen, text, len);
+    w->outlen += len;
+}
+
+/*  the deck, from stdin, as steps; anything fleet can't do ends the run before a target is touched  */
+static size_t fleet_deck(fleetop_t **ops, arena_t *fleetdata) {
+card_t   card;
+arena_t  data = { NULL, 0 };
+fleetop_t *op = NULL;
+size_t   nop = 0, cap = 0, datalen, used = 0;
+int      verb;
+char     *p;
+    memset(&card, 0, sizeof(card));
+    while (card_read(&card)) {
+        if ((p = card_tok(&card)) == NULL) continue;
+        strtolower(p);
+        if ((verb = verb_lookup(p)) == V_NONE) continue;  /*  a comment  */
+        if (verb != V_NAME && verb != V_VER && verb != V_REP && verb != V_DUMP && verb != V_RESET) {
+            printf("'%s' can't be run by --fleet; exiting\n", p);
+            exit(4);
+        }
+        if (nop == cap) {
+            cap = cap ? 2 * cap : 64;
+            if ((op = realloc(op, cap * sizeof(*op))) == NULL) {
+                printf("unable to allocate the --fleet deck; exiting\n");
+                exit(4);
+            }
+        }
+        memset(&op[nop], 0, sizeof(*op));
+        op[nop].verb = verb;
+        if (verb == V_NAME || verb == V_DUMP) {
+            if ((p = card_tok(&card)) == NULL || strcmp(p, FLEETMARK) != 0) {
+                printf("under --fleet, '%s' must name " FLEETMARK " (the target); exiting\n", verb == V_NAME ? "name" : "dump");
+                exit(4);
+            }
+            op[nop].len = LENTODUMP;
+            if (verb == V_DUMP && (p = card_tok(&card)) != NULL && try_offset(p, &op[nop].len)
+                && (p = card_tok(&card)) != NULL) {
+                if (szap_is_symbolic(p)) op[nop].sym = strdup(p);  /*  found on each target  */
+                else try_offset(p, &op[nop].off);
+            }
+        } else if (verb == V_VER || verb == V_REP) {
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing offset; exiting\n");
+                exit(4);
+            }
+            if (szap_is_symbolic(p)) op[nop].sym = strdup(p);
+            else op[nop].off = do_offset(p);
+            if ((p = card_tok(&card)) == NULL) {
+                printf("missing data; exiting\n");
+                exit(4);
+            }
+            datalen = do_data(&data, p);
+            memcpy(arena_reserve(fleetdata, used + datalen) + used, data.base, datalen);
+            op[nop].data = used;
+            op[nop].len = datalen;
+            used += datalen;
+        }
+        nop++;
+    }
+    free(data.base);
+    *ops = op;
+    return nop;
+}
+
+/*  every target, one at a time, until there are none left  */
+static void *fleet_worker(void *arg) {
+static const char discompares[] = "*** 'data' discompares; no writes will be performed ***\n";
+fleetwork_t *w = arg;
+fleetjob_t  *job = w->job;
+fleetop_t   *op;
+szap_ctx    *z;
+uint64_t    i, off;
+char        *fn, why[256];
+int         rc, vers, reps, written, verfailed;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nfn) {
+        fn = job->fn[i];
+        w->outlen = 0;
+        rc = SZAP_OK;
+        vers = reps = written = verfailed = 0;
+        why[0] = '\0';
+        if ((z = szap_new()) == NULL) {
+            snprintf(why, sizeof(why), "%s", szap_strerror(SZAP_ENOMEM));
+            goto done;
+        }
+        szap_set_output(z, fleet_out, w);
+        szap_set_debug(z, debug);
+        szap_set_dryrun(z, !ok_to_write);
+        for (op = job->op; op < job->op + job->nop; op++) {
+            off = op->off;
+            if (op->sym != NULL && op->verb == V_DUMP) {
+                szap_set_output(z, NULL, NULL);  /*  an empty dump, quietly: the partition is found in what it opens  */
+                szap_dump(z, fn, 0, 0);
+                szap_set_output(z, fleet_out, w);
+            }
+            if (op->sym != NULL && (rc = szap_offset(z, op->sym, &off)) != SZAP_OK) {
+                snprintf(why, sizeof(why), "; stopped at '%s': %s", op->sym, szap_strerror(rc));
+                break;
+            }
+            switch (op->verb) {
+                case V_NAME:
+                    rc = szap_name(z, fn);
+                    break;
+                case V_DUMP:
+                    rc = szap_dump(z, fn, op->len, off);
+                    break;
+                case V_VER:
+                    if ((rc = szap_ver(z, off, job->data + op->data, op->len)) == SZAP_OK) vers++;
+                    else if (rc == SZAP_EVERIFY) {
+                        if (!verfailed++) snprintf(why, sizeof(why), "; the 'ver' at offset %" PRIx64 " discompares", off);
+                        fleet_out(w, discompares, sizeof(discompares) - 1);
+                        szap_dump(z, NULL, op->len, off);
+                        rc = SZAP_OK;
+                    }
+                    break;
+                case V_REP:
+                    reps++;
+                    if ((rc = szap_rep(z, off, job->data + op->data, op->len)) == SZAP_OK) written++;
+                    else if (rc == SZAP_EDRYRUN) rc = SZAP_OK;
+                    break;
+                default:  /*  V_RESET  */
+                    szap_reset(z);
+                    rc = SZAP_OK;
+            }
+            if (rc != SZAP_OK) {
+                snprintf(why, sizeof(why), "; stopped at a '%s': %s (%s)",
+                         op->verb == V_NAME ? "name" : op->verb == V_DUMP ? "dump" : op->verb == V_VER ? "ver" : "rep",
+                         szap_strerror(rc), strerror(szap_errno(z)));
+                break;
+            }
+        }
+        szap_free(z);
+    done:
+        pthread_mutex_lock(&job->mu);
+        if (w->outlen) fwrite(w->out.base, 1, w->outlen, stdout);
+        printf("fleet %s: %i 'ver'(s) passed, %i of %i 'rep'(s) written%s\n", fn, vers, written, reps, why);
+        if (z == NULL || rc != SZAP_OK) job->errors++;
+        else if (verfailed) job->verfailed++;
+        else if (written < reps) job->dry++;
+        else job->zapped++;
+        pthread_mutex_unlock(&job->mu);
+    }
+    return NULL;
+}
+
+void fleet(char *targets) {
+fleetjob_t  job;
+fleetwork_t *w;
+arena_t     data = { NULL, 0 };
+glob_t      g;
+FILE        *f;
+char        *line = NULL;
+size_t      cap = 0, i;
+ssize_t     n;
+int         nt, rc;
+uint64_t    t0;
+
+    memset(&job, 0, sizeof(job));
+    memset(&g, 0, sizeof(g));
+    if (targets[0] == '@') {
+        /*  -----------------------------------------  */
+        /*  a list of targets, one a line              */
+        /*  -----------------------------------------  */
+        if ((f = fopen(targets + 1, "r")) == NULL) {
+            perror("--fleet");
+            printf("(filename=%s)\n", targets + 1);
+            exit(4);
+        }
+        while ((n = getline(&line, &cap, f)) != -1) {
+            while (n && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+            if (n == 0) continue;
+            if ((job.fn = realloc(job.fn, (job.nfn + 1) * sizeof(*job.fn))) == NULL
+                || (job.fn[job.nfn++] = strdup(line)) == NULL) {
+                printf("unable to allocate the --fleet targets; exiting\n");
+                exit(4);
+            }
+        }
+        free(line);
+        fclose(f);
+    } else if ((rc = glob(targets, GLOB_BRACE | GLOB_TILDE, NULL, &g)) == 0) {
+        job.fn = g.gl_pathv;
+        job.nfn = g.gl_pathc;
+    } else if (rc != GLOB_NOMATCH) {
+        printf("--fleet can't expand '%s'; exiting\n", targets);
+        exit(4);
+    }
+    if (job.nfn == 0) {
+        printf("--fleet '%s' names no targets; exiting\n", targets);
+        exit(4);
+    }
+    for (i = 0; i < job.nfn; i++)
+        if (gz_named(job.fn[i])) {
+            printf("--fleet zaps raw images, and '%s' is compressed (zap it with a deck of its own); exiting\n", job.fn[i]);
+            exit(4);
+        }
+
+    job.nop = fleet_deck(&job.op, &data);
+    job.data = data.base;
+    printf("*** end of control cards ***\n");
+    pthread_mutex_init(&job.mu, NULL);
+
+    nt = pool_size(job.nfn);
+    if ((w = calloc(nt, sizeof(*w))) == NULL) {
+        printf("unable to allocate the --fleet workers; exiting\n");
+        exit(4);
+    }
+    for (i = 0; i < (size_t) nt; i++) w[i].job = &job;
+    t0 = stat_now();
+    nt = pool_run(fleet_worker, w, sizeof(*w), nt);
+    printf("*** fleet: %zu target(s) in %.3f s on %i thread(s): %i zapped, %i failed a 'ver', %i not (all) written, %i error(s) ***\n",
+           job.nfn, (stat_now() - t0) / 1e9, nt, job.zapped, job.verfailed, job.dry, job.errors);
+    fflush(stdout);
+    exit((job.verfailed || job.errors) ? 4 : EXIT_SUCCESS);
 }
 
 /*  ------------------------------------------  */
@@ -532,6 +6258,7 @@ size_t srclen;
 /*  ------------------------------------------  */
 /*  ------------------------------------------  */
 void strtolower(char *p) {
+    for (; *p; p++) *p = tolower((unsigned char) *p);
 }
 
 /*  ---------------------------------------  */
@@ -565,47 +6292,101 @@ SOFTWARE.
 */
 #include <stdio.h>
 
-void hexDump(char *desc, void *addr, int len, uint skip) {
-    int i;
-    unsigned char buff[17];
-    unsigned char *pc = (unsigned char*)addr;
+/*
+    The line layout is the same one the old printf() version produced:
+        "  oooo  xx xx ... xx  aaaaaaaaaaaaaaaa"
+    but each line is built by szap_hexline (libszap.c: lookup tables and,
+    where the compiler targets SSSE3, a pshufb nibble-to-hex shuffle) into
+    'hexout', which is written to stdout in big blocks rather than a printf
+    per byte.
 
-    // Output description if given.
-    if (desc != NULL)
-        printf ("%s\n", desc);
+    With --squeeze, a full line identical to the one before it is not
+    printed; the first such line is replaced by a '*', like 'hexdump -C'.
+*/
+#define HEXOUTSIZE (256 * 1024)  /* bytes of formatted lines buffered between fwrites */
+#define HEXLINEMAX SZAP_LINEMAX  /* longest line: 16 digit offset, 48 hex, 16 ascii, spacing */
+
+static char          hexout[HEXOUTSIZE];
+static size_t        hexoutlen = 0;
+static unsigned char hexprev[16];    /* the last full line, for --squeeze                 */
+static int           hexhaveprev = 0;
+static int           hexfolding = 0; /* a '*' is out and we are skipping duplicates       */
+static uint64_t      hexnext = 0;    /* offset of the line after the last one seen        */
 
-    // Process every byte in the data.
-    for (i = 0; i < len; i++) {
-        // Multiple of 16 means new line (with lne offset).
+static void hexFlush(void) {
+    if (hexoutlen) fwrite(hexout, 1, hexoutlen, stdout);
+    hexoutlen = 0;
+}
 
-        if ((i % 16) == 0) {
-            // Just don't print ASCII for the zeroth line.
-            if (i != 0)
-                printf ("  %s\n", buff);
+/*  (a NULL 'desc' continues a dump begun by an earlier call)  */
+void hexDump(char *desc, void *addr, int len, uint64_t skip) {
+const unsigned char *pc = (const unsigned char *) addr;
+int  i, n;
+uint64_t t0 = stats ? stat_now() : 0;
 
-            // Output the addr. of the data in storage
-            printf ("  %04x ", skip+i);
-            // and the offset into that area
-//          printf ("  %04x ", i);
-        }
+    // Output description if given; it also starts a new dump.
+    if (desc != NULL) {
+        hexFlush();
+        printf ("%s\n", desc);
+        hexhaveprev = 0;
+        hexfolding = 0;
+    }
 
-        // Now the hex code for the specific character.
-        printf (" %02x", pc[i]);
+    // Process the data a line at a time.
+    for (i = 0; i < len; i += 16, skip += 16) {
+        n = (len - i < 16) ? len - i : 16;
+
+        if (n == 16 && squeeze && hexhaveprev && memcmp(hexprev, pc + i, 16) == 0) {
+            if (!hexfolding) {
+                if (hexoutlen + HEXLINEMAX > HEXOUTSIZE) hexFlush();
+                memcpy(hexout + hexoutlen, "*\n", 2);
+                hexoutlen += 2;
+                hexfolding = 1;
+            }
+            continue;
+        }
+        hexfolding = 0;
+        if (n == 16) {
+            memcpy(hexprev, pc + i, 16);
+            hexhaveprev = 1;
+        } else hexhaveprev = 0;
 
-        // And store a printable ASCII character for later.
-        if ((pc[i] < 0x20) || (pc[i] > 0x7e))
-            buff[i % 16] = '.';
-        else
-            buff[i % 16] = pc[i];
-        buff[(i % 16) + 1] = '\0';
+        if (hexoutlen + HEXLINEMAX > HEXOUTSIZE) hexFlush();
+        hexoutlen += szap_hexline(hexout + hexoutlen, skip, pc + i, n);
     }
+    hexnext = skip;
+    hexFlush();
+    if (stats) stat_phase(SP_PRINT, t0, len);
+}
 
-    // Pad out last line if not exactly 16 characters.
-    while ((i % 16) != 0) {
-        printf ("   ");
-        i++;
+/*  'len' bytes of zeros at 'skip' (a hole): one line of them, then a '*'  */
+void hexDumpZeros(uint64_t skip, uint64_t len) {
+static const unsigned char zeros[16];
+    if (len >= 16) {
+        hexDump(NULL, (void *) zeros, 16, skip);
+        if (len >= 32) {
+            if (!hexfolding) {
+                hexFlush();
+                fwrite("*\n", 1, 2, stdout);
+            }
+            hexfolding = 1;
+            memcpy(hexprev, zeros, 16);
+            hexhaveprev = 1;
+        }
+        skip += len & ~(uint64_t) 15;
+        len &= 15;
     }
+    if (len) hexDump(NULL, (void *) zeros, len, skip);  /* a short last line */
+    hexnext = skip + len;
+}
 
-    // And print the final ASCII bit.
-    printf ("  %s\n", buff);
+/*  close a --squeeze'd dump: if it ended in a fold, say where the fold stops  */
+void hexDumpEnd(void) {
+    if (hexfolding) {
+        hexoutlen = szap_hexoffset(hexout, hexnext);
+        hexout[hexoutlen++] = '\n';
+        hexFlush();
+    }
+    hexfolding = 0;
+    hexhaveprev = 0;
 }
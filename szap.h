@@ -0,0 +1,108 @@
+/*
+    szap.h - libszap, the part of szap that other programs can call
+
+    A 'szap_ctx' holds what the command line program keeps in globals: the
+    files named so far, the current one, the dryrun and debug flags and
+    whether a 'ver' has failed.  Nothing else is shared between contexts, so
+    any number of threads can each zap through their own; one context must
+    not be used by two threads at once.  Nothing calls exit(): every function
+    that can fail returns one of the SZAP_E codes below (negative), and
+    szap_errno() gives the errno behind an SZAP_EOPEN or SZAP_EIO.  Data,
+    dumps and cards live in buffers the caller provides.
+
+    Contexts made by szap_new_shared() with the same szap_files share their
+    open files, so a file is opened once however many of them use it: their
+    'ver's and 'dump's of it run together and their 'rep's to it go one at a
+    time, never while a 'ver' is reading.  A device is the same file under any
+    of its paths.
+
+    Where a card takes an offset it can also take one in a partition of the
+    current file, 'p2+400' or 'gpt:esp+10'.  The partition table is read
+    the first time one is used and kept with the file (shared like it)
+    until a 'rep' writes over the sectors it came from.
+
+    Text a card prints (dumps, discompares, "write will be done") goes to the
+    context's output function, stdout until szap_set_output() says otherwise.
+
+    Build it with 'make lib' (libszap.a and libszap.so), or just compile
+    libszap.c in with the program; link with -pthread.
+*/
+#ifndef SZAP_H
+#define SZAP_H
+
+#include  <stddef.h>
+#include  <stdint.h>
+#include  <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SZAP_OK        0
+#define SZAP_EINVAL   -1   /* an offset or 'data' that isn't hex, or a field missing  */
+#define SZAP_ENOFILE  -2   /* 'ver' or 'rep' before any 'name'                        */
+#define SZAP_EOPEN    -3   /* the file could not be opened                             */
+#define SZAP_EIO      -4   /* a read or write failed, or came up short                 */
+#define SZAP_EVERIFY  -5   /* a 'ver' discompared; no writes will be performed         */
+#define SZAP_EDRYRUN  -6   /* a 'rep' was not written: dryrun, or an earlier failure   */
+#define SZAP_ENOSPACE -7   /* the caller's buffer is too small                         */
+#define SZAP_ENOMEM   -8
+#define SZAP_EVERB    -9   /* a card the library doesn't run ('find', 'undo', ...)     */
+#define SZAP_ENOPART  -10  /* 'p3' or 'gpt:esp' names no partition the file has        */
+#define SZAP_EPASTEND -11  /* 'p3+...' is past the end of the partition                */
+
+#define SZAP_LINEMAX  96   /* the longest line szap_hexline() makes                    */
+
+typedef struct szap_ctx szap_ctx;
+typedef struct szap_files szap_files;
+typedef struct szap_layout szap_layout;
+typedef void (*szap_out_fn)(void *arg, const char *text, size_t len);
+typedef ssize_t (*szap_pread_fn)(void *arg, void *buf, size_t len, uint64_t off);
+
+/*  contexts  */
+szap_ctx   *szap_new(void);
+szap_ctx   *szap_new_shared(szap_files *fs);  /* NULL fs: as szap_new */
+void        szap_free(szap_ctx *z);  /* closes the files, unless another context has them */
+szap_files *szap_files_new(void);
+void        szap_files_free(szap_files *fs);  /* the files close when the last context is freed too */
+void        szap_set_output(szap_ctx *z, szap_out_fn fn, void *arg);  /* NULL fn: print nothing */
+void        szap_set_debug(szap_ctx *z, int on);
+void        szap_set_dryrun(szap_ctx *z, int on);
+int         szap_ok_to_write(const szap_ctx *z);
+void        szap_reset(szap_ctx *z);  /* the 'reset' card */
+int         szap_errno(const szap_ctx *z);
+const char *szap_strerror(int err);
+
+/*  the card fields  */
+int     szap_parse_offset(const char *s, uint64_t *v);
+int     szap_parse_data(const char *hex, void *buf, size_t cap, size_t *len);
+long    szap_hexdecode(unsigned char *dest, const char *src, size_t n);
+int     szap_offset(szap_ctx *z, const char *s, uint64_t *v);  /* hex, or in a partition of the current file */
+
+/*  partitions: 'p2+400' and 'gpt:esp+10' are offsets in the file's MBR or GPT partitions  */
+int     szap_is_symbolic(const char *s);
+int     szap_layout_read(szap_pread_fn rd, void *arg, szap_layout **l);  /* no table: a layout with none */
+void    szap_layout_free(szap_layout *l);
+int     szap_layout_offset(const szap_layout *l, const char *s, uint64_t *v);
+int     szap_layout_touches(const szap_layout *l, uint64_t off, uint64_t len);  /* a write there changes it */
+size_t  szap_layout_print(const szap_layout *l, const char *fn, char *out, size_t cap);  /* as snprintf */
+
+/*  dump lines: 'out' must have room for SZAP_LINEMAX bytes a line  */
+size_t  szap_hexoffset(char *out, uint64_t off);
+size_t  szap_hexline(char *out, uint64_t off, const void *data, size_t n);
+size_t  szap_hexdump(char *out, size_t cap, const void *data, size_t len, uint64_t off);
+
+/*  the cards themselves  */
+int     szap_name(szap_ctx *z, const char *path);
+int     szap_ver(szap_ctx *z, uint64_t off, const void *data, size_t len);
+int     szap_rep(szap_ctx *z, uint64_t off, const void *data, size_t len);
+ssize_t szap_read(szap_ctx *z, uint64_t off, void *buf, size_t len);
+int     szap_dump(szap_ctx *z, const char *path, uint64_t len, uint64_t off);
+int     szap_card(szap_ctx *z, char *card);
+int     szap_deck(szap_ctx *z, char *deck);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
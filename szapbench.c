@@ -0,0 +1,308 @@
+/*
+    szapbench - end to end benchmarks for szap
+
+    It makes a scratch directory (under $TMPDIR, or /tmp), builds a dense
+    image of pseudo-random bytes and a sparse image that is mostly holes,
+    writes decks of control cards for them (many small 'rep's and 'ver's,
+    one card with a long <data>, large 'dump's, 'find', 'sum' and 'diff'),
+    and runs szap on each deck with its output thrown away.
+
+    Each run is reported as one line of JSON on stdout, so the numbers can
+    be kept and compared from release to release:
+        {"bench":"reps","image":"dense","flags":"-p","cards":20000,
+         "bytes":80000,"seconds":0.0213,"cards_per_sec":938967.1,
+         "mb_per_sec":3.58,"syscr":12,"syscw":20006,"user":0.012,
+         "sys":0.009,"maxrss_kb":3456,"status":0}
+    'syscr' and 'syscw' are the read and write type system calls szap made
+    (from /proc/<pid>/io); 'bytes' is what the MB/s is of: the bytes
+    replaced, decoded, dumped, searched or summed.
+
+    No root is needed; only regular files in the scratch directory are
+    touched, and they are removed at the end.  Build and run it with
+    'make bench', or by hand:
+        gcc -O2 -pthread -o szap szap.c libszap.c -lz
+        gcc -O2 -o szapbench szapbench.c && ./szapbench [./szap [scale]]
+    'scale' (default 1) multiplies the image sizes and card counts.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static char     dir[4096];      /*  the scratch directory  */
+static char     *szap = "./szap";
+static uint64_t seed = 88172645463325252ULL;
+static const char hex[] = "0123456789abcdef";
+static char     *scratch[] = { "dense.img", "sparse.img", "copy.img", "reps.txt", "vers.txt", "long.txt",
+                               "dump-dense.txt", "dump-sparse.txt", "find.txt", "find-sparse.txt", "sum.txt",
+                               "sum-sparse.txt", "diff.txt", "diff-reps.txt" };
+
+/*  xorshift64: the same images and decks every run  */
+static uint64_t rnd(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static double now(void) {
+struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(char *what, char *fn) {
+    fprintf(stderr, "szapbench: %s '%s': %s\n", what, fn, strerror(errno));
+    exit(4);
+}
+
+static char *path(char *name) {
+static char p[8][4096+64];
+static int  n = 0;
+    n = (n + 1) % 8;
+    snprintf(p[n], sizeof(p[n]), "%s/%s", dir, name);
+    return p[n];
+}
+
+static FILE *deck(char *name) {
+FILE *f;
+    if ((f = fopen(path(name), "w")) == NULL) die("can't create", path(name));
+    return f;
+}
+
+static void hexout(FILE *f, const unsigned char *p, size_t n) {
+size_t i;
+    for (i = 0; i < n; i++) {
+        fputc(hex[p[i] >> 4], f);
+        fputc(hex[p[i] & 15], f);
+    }
+}
+
+/*  ---------------------------------------------------------------  */
+/*  the images                                                       */
+/*  ---------------------------------------------------------------  */
+static void make_dense(char *fn, uint64_t size) {
+uint64_t *buf, done, i;
+size_t   n;
+int      fd;
+    if ((fd = open(fn, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) die("can't create", fn);
+    if ((buf = malloc(1 << 20)) == NULL) die("can't allocate for", fn);
+    for (done = 0; done < size; done += n) {
+        n = size - done < (1 << 20) ? size - done : (1 << 20);
+        for (i = 0; i < (1 << 20) / 8; i++) buf[i] = rnd();
+        if (write(fd, buf, n) != (ssize_t) n) die("can't write", fn);
+    }
+    free(buf);
+    close(fd);
+}
+
+/*  'size' bytes of holes, with 64 KB of data every 64 MB  */
+static void make_sparse(char *fn, uint64_t size) {
+uint64_t buf[8192], off, i;
+int      fd;
+    if ((fd = open(fn, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) die("can't create", fn);
+    if (ftruncate(fd, size) == -1) die("can't size", fn);
+    for (off = 0; off + sizeof(buf) <= size; off += 64 << 20) {
+        for (i = 0; i < 8192; i++) buf[i] = rnd();
+        if (pwrite(fd, buf, sizeof(buf), off) != sizeof(buf)) die("can't write", fn);
+    }
+    close(fd);
+}
+
+static void copy_file(char *from, char *to) {
+char    buf[1 << 16];
+ssize_t n;
+int     in, out;
+    if ((in = open(from, O_RDONLY)) == -1) die("can't open", from);
+    if ((out = open(to, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) die("can't create", to);
+    while ((n = read(in, buf, sizeof(buf))) > 0)
+        if (write(out, buf, n) != n) die("can't write", to);
+    close(in);
+    close(out);
+}
+
+/*  ---------------------------------------------------------------  */
+/*  one run of szap, and its JSON line                               */
+/*  ---------------------------------------------------------------  */
+static void run(char *bench, char *image, char *flags, char *deckname, uint64_t cards, uint64_t bytes) {
+struct rusage ru;
+siginfo_t si;
+char     fn[64], line[256];
+uint64_t syscr = 0, syscw = 0;
+double   t, secs;
+pid_t    pid;
+FILE     *io;
+int      status, in, out;
+
+    if ((in = open(path(deckname), O_RDONLY)) == -1) die("can't open", path(deckname));
+    if ((out = open("/dev/null", O_WRONLY)) == -1) die("can't open", "/dev/null");
+    t = now();
+    if ((pid = fork()) == -1) die("can't fork for", szap);
+    if (pid == 0) {
+        dup2(in, 0);
+        dup2(out, 1);
+        if (*flags) execl(szap, szap, "-q", flags, (char *) NULL);
+        else execl(szap, szap, "-q", (char *) NULL);
+        _exit(127);
+    }
+    close(in);
+    close(out);
+
+    /*  wait for it, but leave it a zombie so its /proc/<pid>/io is still there  */
+    memset(&si, 0, sizeof(si));
+    while (waitid(P_PID, pid, &si, WEXITED | WNOWAIT) == -1)
+        if (errno != EINTR) die("can't wait for", szap);
+    secs = now() - t;
+    snprintf(fn, sizeof(fn), "/proc/%d/io", (int) pid);
+    if ((io = fopen(fn, "r")) != NULL) {
+        while (fgets(line, sizeof(line), io) != NULL) {
+            sscanf(line, "syscr: %" SCNu64, &syscr);
+            sscanf(line, "syscw: %" SCNu64, &syscw);
+        }
+        fclose(io);
+    }
+    if (wait4(pid, &status, 0, &ru) == -1) die("can't wait for", szap);
+    if (secs <= 0) secs = 1e-9;
+
+    printf("{\"bench\":\"%s\",\"image\":\"%s\",\"flags\":\"%s\",\"cards\":%" PRIu64 ",\"bytes\":%" PRIu64
+           ",\"seconds\":%.4f,\"cards_per_sec\":%.1f,\"mb_per_sec\":%.2f,\"syscr\":%" PRIu64 ",\"syscw\":%" PRIu64
+           ",\"user\":%.3f,\"sys\":%.3f,\"maxrss_kb\":%ld,\"status\":%d}\n",
+           bench, image, flags, cards, bytes, secs, cards / secs, bytes / secs / (1024.0 * 1024.0), syscr, syscw,
+           ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6, ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+           ru.ru_maxrss, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+uint64_t scale = 1, dsize, ssize, ncards, i, off, len;
+uint64_t data[2];         /*  a card's <data>  */
+char     *tmp, *dense, *sparse, *copy;
+FILE     *f;
+
+    if (argc > 1) szap = argv[1];
+    if (argc > 2) scale = strtoull(argv[2], NULL, 0);
+    if (scale == 0) scale = 1;
+    if (access(szap, X_OK) == -1) die("can't run", szap);
+
+    if ((tmp = getenv("TMPDIR")) == NULL || *tmp == '\0') tmp = "/tmp";
+    snprintf(dir, sizeof(dir), "%s/szapbench.XXXXXX", tmp);
+    if (mkdtemp(dir) == NULL) die("can't make a directory like", dir);
+
+    dsize = scale * (64 << 20);
+    ssize = scale * ((uint64_t) 4 << 30);
+    ncards = scale * 20000;
+    dense = strdup(path("dense.img"));
+    make_dense(dense, dsize);
+    sparse = strdup(path("sparse.img"));
+    make_sparse(sparse, ssize);
+    fprintf(stderr, "szapbench: %s, %" PRIu64 " MB dense and %" PRIu64 " MB sparse images in %s\n",
+            szap, dsize >> 20, ssize >> 20, dir);
+
+    /*  --------------------------------------------  */
+    /*  many small reps, then vers of the same bytes  */
+    /*  --------------------------------------------  */
+    f = deck("reps.txt");
+    fprintf(f, "name %s\n", dense);
+    for (i = 0; i < ncards; i++) {
+        off = rnd() % (dsize - 4);
+        data[0] = rnd();
+        fprintf(f, "rep %" PRIx64 " ", off);
+        hexout(f, (unsigned char *) data, 4);
+        fputc('\n', f);
+    }
+    fclose(f);
+    run("reps", "dense", "", "reps.txt", ncards + 1, ncards * 4);
+    run("reps", "dense", "-p", "reps.txt", ncards + 1, ncards * 4);
+    run("reps", "dense", "-u", "reps.txt", ncards + 1, ncards * 4);
+
+    f = deck("vers.txt");
+    fprintf(f, "name %s\n", dense);
+    for (i = 0; i < ncards; i++) {
+        off = rnd() % (dsize - 4);
+        fprintf(f, "ver %" PRIx64 " 00000000\n", off);  /*  most fail; all are read  */
+    }
+    fprintf(f, "reset\n");
+    fclose(f);
+    run("vers", "dense", "", "vers.txt", ncards + 2, ncards * 4);
+    run("vers", "dense", "-u", "vers.txt", ncards + 2, ncards * 4);
+
+    /*  --------------------------------------------  */
+    /*  one card with a long <data>: the hex decoder  */
+    /*  --------------------------------------------  */
+    len = scale * (8 << 20);
+    f = deck("long.txt");
+    fprintf(f, "name %s\nrep 0 ", dense);
+    for (i = 0; i < len; i += 16) {
+        data[0] = rnd();
+        data[1] = rnd();
+        hexout(f, (unsigned char *) data, 16);
+    }
+    fputc('\n', f);
+    fclose(f);
+    run("decode", "dense", "", "long.txt", 2, len);
+
+    /*  --------------------------------------------  */
+    /*  dumps: hexDump, and holes that aren't read    */
+    /*  --------------------------------------------  */
+    f = deck("dump-dense.txt");
+    fprintf(f, "dump %s %" PRIx64 " 0\n", dense, dsize);
+    fclose(f);
+    run("dump", "dense", "", "dump-dense.txt", 1, dsize);
+    run("dump", "dense", "-s", "dump-dense.txt", 1, dsize);
+
+    f = deck("dump-sparse.txt");
+    fprintf(f, "dump %s %" PRIx64 " 0\n", sparse, ssize);
+    fclose(f);
+    run("dump", "sparse", "-s", "dump-sparse.txt", 1, ssize);
+
+    /*  --------------------------------------------  */
+    /*  find, sum and diff                            */
+    /*  --------------------------------------------  */
+    f = deck("find.txt");
+    fprintf(f, "dump %s 10 0\nfind 5a5a5a5a5a5a\n", dense);
+    fclose(f);
+    run("find", "dense", "", "find.txt", 2, dsize);
+    f = deck("find-sparse.txt");
+    fprintf(f, "dump %s 10 0\nfind 5a5a5a5a5a5a\n", sparse);
+    fclose(f);
+    run("find", "sparse", "", "find-sparse.txt", 2, ssize);
+
+    f = deck("sum.txt");
+    fprintf(f, "dump %s 10 0\nsum 0 %" PRIx64 " crc32c\nsum 0 %" PRIx64 " fast64\n", dense, dsize, dsize);
+    fclose(f);
+    run("sum", "dense", "", "sum.txt", 3, 2 * dsize);
+    f = deck("sum-sparse.txt");
+    fprintf(f, "dump %s 10 0\nsum 0 %" PRIx64 " crc32c\nsum 0 %" PRIx64 " fast64\n", sparse, ssize, ssize);
+    fclose(f);
+    run("sum", "sparse", "", "sum-sparse.txt", 3, 2 * ssize);
+
+    copy = strdup(path("copy.img"));
+    copy_file(dense, copy);
+    f = deck("diff.txt");
+    fprintf(f, "diff %s %s\n", dense, copy);  /*  the same, but for the reps below  */
+    fclose(f);
+    f = deck("diff-reps.txt");
+    fprintf(f, "name %s\n", copy);
+    for (i = 0; i < ncards / 10; i++) fprintf(f, "rep %" PRIx64 " 00\n", rnd() % dsize);
+    fclose(f);
+    run("reps", "copy", "-p", "diff-reps.txt", ncards / 10 + 1, ncards / 10);
+    run("diff", "dense", "", "diff.txt", 1, 2 * dsize);
+
+    /*  --------------------------------------------  */
+    /*  clean up                                      */
+    /*  --------------------------------------------  */
+    for (i = 0; i < sizeof(scratch) / sizeof(scratch[0]); i++) unlink(path(scratch[i]));
+    rmdir(dir);
+    return 0;
+}